@@ -329,6 +329,9 @@
 /* Version number of package */
 #define VERSION "3.1"
 
+/* Define to 1 to serialize the calls made from other threads */
+#define _REENTRANT 1
+
 /* Define to empty if `const' does not conform to ANSI C. */
 /* #undef const */
 
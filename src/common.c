@@ -308,6 +308,28 @@ edited_ed_next_char(Edited *el, wint_t c __attribute__((__unused__)))
 }
 
 
+/* edited_ed_accept_suggestion():
+ *	Insert the rest of the line suggested from the history,
+ *	or move to the right one character if there is none
+ */
+libedited_private edited_action_t
+edited_ed_accept_suggestion(Edited *el, wint_t c)
+{
+	const wchar_t *s;
+	size_t n;
+
+	if ((s = hist_suggest(el, &n)) == NULL)
+		return edited_ed_next_char(el, c);
+	if (el->edited_line.lastchar + n >= el->edited_line.limit &&
+	    !ch_enlargebufs(el, n))
+		return CC_ERROR;
+	edited_c_insert(el, (int)n);
+	(void) wmemcpy(el->edited_line.cursor, s, n);
+	el->edited_line.cursor += n;
+	return CC_REFRESH;
+}
+
+
 /* edited_ed_prev_word():
  *	Move to the beginning of the current word
  *	[M-b] [b]
@@ -624,9 +646,7 @@ libedited_private edited_action_t
 /*ARGSUSED*/
 edited_ed_search_prev_history(Edited *el, wint_t c __attribute__((__unused__)))
 {
-	const wchar_t *hp;
 	int h;
-	int found = 0;
 
 	el->edited_chared.edited_c_vcmd.action = NOP;
 	el->edited_chared.edited_c_undo.len = -1;
@@ -648,31 +668,10 @@ edited_ed_search_prev_history(Edited *el, wint_t c __attribute__((__unused__)))
 	if (el->edited_history.ref == NULL)
 		return CC_ERROR;
 
-	hp = HIST_FIRST(el);
-	if (hp == NULL)
-		return CC_ERROR;
-
 	edited_c_setpat(el);		/* Set search pattern !! */
 
-	for (h = 1; h <= el->edited_history.eventno; h++)
-		hp = HIST_NEXT(el);
-
-	while (hp != NULL) {
-#ifdef SDEBUG
-		(void) fprintf(el->edited_errfile, "Comparing with \"%ls\"\n", hp);
-#endif
-		if ((wcsncmp(hp, el->edited_line.buffer, (size_t)
-			    (el->edited_line.lastchar - el->edited_line.buffer)) ||
-			hp[el->edited_line.lastchar - el->edited_line.buffer]) &&
-		    edited_c_hmatch(el, hp)) {
-			found = 1;
-			break;
-		}
-		h++;
-		hp = HIST_NEXT(el);
-	}
-
-	if (!found) {
+	h = el->edited_history.eventno + 1;
+	if (edited_c_hsearch(el, 1, 1, &h) == NULL) {
 #ifdef SDEBUG
 		(void) fprintf(el->edited_errfile, "not found\n");
 #endif
@@ -692,7 +691,6 @@ libedited_private edited_action_t
 /*ARGSUSED*/
 edited_ed_search_next_history(Edited *el, wint_t c __attribute__((__unused__)))
 {
-	const wchar_t *hp;
 	int h;
 	int found = 0;
 
@@ -706,23 +704,12 @@ edited_ed_search_next_history(Edited *el, wint_t c __attribute__((__unused__)))
 	if (el->edited_history.ref == NULL)
 		return CC_ERROR;
 
-	hp = HIST_FIRST(el);
-	if (hp == NULL)
-		return CC_ERROR;
-
 	edited_c_setpat(el);		/* Set search pattern !! */
 
-	for (h = 1; h < el->edited_history.eventno && hp; h++) {
-#ifdef SDEBUG
-		(void) fprintf(el->edited_errfile, "Comparing with \"%ls\"\n", hp);
-#endif
-		if ((wcsncmp(hp, el->edited_line.buffer, (size_t)
-			    (el->edited_line.lastchar - el->edited_line.buffer)) ||
-			hp[el->edited_line.lastchar - el->edited_line.buffer]) &&
-		    edited_c_hmatch(el, hp))
-			found = h;
-		hp = HIST_NEXT(el);
-	}
+	/* the closest match is the first one walking towards newer events */
+	h = el->edited_history.eventno - 1;
+	if (h > 0 && edited_c_hsearch(el, 0, 1, &h) != NULL)
+		found = h;
 
 	if (!found) {		/* is it the current history number? */
 		if (!edited_c_hmatch(el, el->edited_history.buf)) {
@@ -10,6 +10,7 @@ libedited_private edited_action_t	edited_ed_move_to_end (Edited *, wint_t);
 libedited_private edited_action_t	edited_ed_move_to_beg (Edited *, wint_t);
 libedited_private edited_action_t	edited_ed_transpose_chars (Edited *, wint_t);
 libedited_private edited_action_t	edited_ed_next_char (Edited *, wint_t);
+libedited_private edited_action_t	edited_ed_accept_suggestion (Edited *, wint_t);
 libedited_private edited_action_t	edited_ed_prev_word (Edited *, wint_t);
 libedited_private edited_action_t	edited_ed_prev_char (Edited *, wint_t);
 libedited_private edited_action_t	edited_ed_quoted_insert (Edited *, wint_t);
@@ -161,6 +161,9 @@ unsigned char	_fn_sh_complete(Edited *, int);
 #define	EL_SAFEREAD	25	/* , int);			      set/get */
 #define EL_USE_STYLE 26 /* , int);			      set/get */
 #define EL_STYLE_FUNC 27 /* , edited_stylefunc_t);		      set/get */
+#define	EL_FRAMEDROP	28	/* , int);			      set/get */
+#define	EL_REFLOW	29	/* , int);			      set/get */
+#define	EL_SUGGEST	30	/* , int);			      set/get */
 
 #define	EL_BUILTIN_GETCFN	(NULL)
 
@@ -176,6 +179,25 @@ int		edited_source(Edited *, const char *);
  */
 void		 edited_resize(Edited *);
 
+/*
+ * Asynchronous prompts: a prompt function that cannot produce its
+ * text right away returns a placeholder and the token obtained from
+ * edited_prompt_defer(). Completing the token from any thread, when
+ * built with POSIX threads, replaces the placeholder and repaints the
+ * prompt while the line is being edited; completions for a finished
+ * line are ignored.
+ */
+int		 edited_prompt_defer(Edited *, int);
+int		 edited_prompt_complete(Edited *, int, const char *);
+
+/*
+ * Print output above the line being edited, from any thread when
+ * built with POSIX threads. Output queued while a line is edited is
+ * written in batches, each followed by a single redraw of the prompt
+ * and the line.
+ */
+int		 edited_print_above(Edited *, const char *);
+
 /*
  * User-defined function interface.
  */
@@ -196,6 +218,25 @@ typedef struct HistEvent {
 	const char	*str;
 } HistEvent;
 
+/*
+ * What is known of an event, see H_SETMETA
+ */
+typedef struct HistMeta {
+	time_t		 time;		/* When entered, 0 if unknown	*/
+	int		 duration;	/* Seconds it ran, -1 if unknown */
+	int		 status;	/* Its exit status, -1 if unknown */
+	const char	*cwd;		/* Its directory, NULL if unknown */
+} HistMeta;
+
+/*
+ * The events searches look at, see H_SETFILTER
+ */
+typedef struct HistFilter {
+	time_t		 since;		/* Entered since, 0 for any	*/
+	int		 status;	/* With this status, -1 for any	*/
+	const char	*cwd;		/* In this directory, NULL for any */
+} HistFilter;
+
 /*
  * History access functions.
  */
@@ -232,6 +273,40 @@ int		history(History *, HistEvent *, int, ...);
 #define	H_REPLACE	25	/* , const char *, histdata_t);	*/
 #define	H_SAVE_FP	26	/* , FILE *);		*/
 #define	H_NSAVE_FP	27	/* , size_t, FILE *);	*/
+#define	H_NTH		28	/* , int);		*/
+#define	H_SETARENA	29	/* , int);		*/
+#define	H_GETARENA	30	/* , void);		*/
+#define	H_SETERASEDUPS	31	/* , int);		*/
+#define	H_GETERASEDUPS	32	/* , void);		*/
+#define	H_SETTRIGRAMS	33	/* , int);		*/
+#define	H_GETTRIGRAMS	34	/* , void);		*/
+#define	H_PREV_SUBSTR	35	/* , const char *, int *);	*/
+#define	H_NEXT_SUBSTR	36	/* , const char *, int *);	*/
+#define	H_SETFRECENCY	37	/* , int);		*/
+#define	H_GETFRECENCY	38	/* , void);		*/
+#define	H_FRECENT	39	/* , const char *, const char **, int);	*/
+#define	H_SETPREFIXES	40	/* , int);		*/
+#define	H_GETPREFIXES	41	/* , void);		*/
+#define	H_SETJOURNAL	42	/* , const char *, int);	*/
+#define	H_GETJOURNAL	43	/* , void);		*/
+#define	H_SAVE_BIN	44	/* , const char *);	*/
+#define	H_SETSHARE	45	/* , int);		*/
+#define	H_GETSHARE	46	/* , void);		*/
+#define	H_SYNC		47	/* , void);		*/
+#define	H_SETMETA	48	/* , int);		*/
+#define	H_GETMETA	49	/* , void);		*/
+#define	H_SETEVMETA	50	/* , int, const HistMeta *);	*/
+#define	H_GETEVMETA	51	/* , int, HistMeta *);	*/
+#define	H_SETFILTER	52	/* , const HistFilter *);	*/
+#define	H_IMPORT	53	/* , const char *);	*/
+#define	H_SETMAXBYTES	54	/* , size_t, size_t);	*/
+#define	H_GETMAXBYTES	55	/* , size_t *, size_t *);	*/
+#define	H_GETBYTES	56	/* , size_t *);		*/
+#define	H_SETCOLD	57	/* , int);		*/
+#define	H_GETCOLD	58	/* , void);		*/
+#define	H_SETMULTIBYTE	59	/* , int);		*/
+#define	H_GETMULTIBYTE	60	/* , void);		*/
+#define	H_GETGENERATION	61	/* , void);		*/
 
 
 
@@ -287,6 +362,8 @@ const LineInfoW	*edited_wline(Edited *);
 int		 edited_winsertstr(Edited *, const wchar_t *);
 #define          edited_wdeletestr  edited_deletestr
 int		 edited_wreplacestr(Edited *, const wchar_t *);
+int		 edited_wprompt_complete(Edited *, int, const wchar_t *);
+int		 edited_wprint_above(Edited *, const wchar_t *);
 
 /*
  * ==== History ====
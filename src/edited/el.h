@@ -60,6 +60,9 @@
 #define	NO_RESET	0x080
 #define	FIXIO		0x100
 #define	FROM_ELLINE	0x200
+#define	FRAMEDROP	0x400
+#define	REFLOW		0x800
+#define	SUGGEST		0x1000
 
 typedef unsigned char edited_action_t;	/* Index to command array	*/
 
@@ -9,6 +9,7 @@ libedited_private edited_action_t	edited_em_kill_region (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_copy_region (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_gosmacs_transpose (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_next_word (Edited *, wint_t);
+libedited_private edited_action_t	edited_em_accept_word (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_upper_case (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_capitol_case (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_lower_case (Edited *, wint_t);
@@ -20,5 +21,6 @@ libedited_private edited_action_t	edited_em_toggle_overwrite (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_copy_prev_word (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_inc_search_next (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_inc_search_prev (Edited *, wint_t);
+libedited_private edited_action_t	edited_em_fuzzy_search (Edited *, wint_t);
 libedited_private edited_action_t	edited_em_delete_prev_char (Edited *, wint_t);
 #endif /* _h_emacs_c */
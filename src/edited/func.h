@@ -1,51 +1,53 @@
 /* Automatically generated file, do not edit */
 static const edited_func_t edited_func[] = {
-    edited_ed_argument_digit,                edited_ed_clear_screen,                  
-    edited_ed_command,                       edited_ed_delete_next_char,              
-    edited_ed_delete_prev_char,              edited_ed_delete_prev_word,              
-    edited_ed_digit,                         edited_ed_end_of_file,                   
-    edited_ed_ignore,                        edited_ed_insert,                        
-    edited_ed_kill_line,                     edited_ed_move_to_beg,                   
-    edited_ed_move_to_end,                   edited_ed_newline,                       
-    edited_ed_next_char,                     edited_ed_next_history,                  
-    edited_ed_next_line,                     edited_ed_prev_char,                     
-    edited_ed_prev_history,                  edited_ed_prev_line,                     
-    edited_ed_prev_word,                     edited_ed_quoted_insert,                 
-    edited_ed_redisplay,                     edited_ed_search_next_history,           
-    edited_ed_search_prev_history,           edited_ed_sequence_lead_in,              
-    edited_ed_start_over,                    edited_ed_transpose_chars,               
-    edited_ed_unassigned,                    edited_em_capitol_case,                  
+    edited_ed_accept_suggestion,             edited_ed_argument_digit,                
+    edited_ed_clear_screen,                  edited_ed_command,                       
+    edited_ed_delete_next_char,              edited_ed_delete_prev_char,              
+    edited_ed_delete_prev_word,              edited_ed_digit,                         
+    edited_ed_end_of_file,                   edited_ed_ignore,                        
+    edited_ed_insert,                        edited_ed_kill_line,                     
+    edited_ed_move_to_beg,                   edited_ed_move_to_end,                   
+    edited_ed_newline,                       edited_ed_next_char,                     
+    edited_ed_next_history,                  edited_ed_next_line,                     
+    edited_ed_prev_char,                     edited_ed_prev_history,                  
+    edited_ed_prev_line,                     edited_ed_prev_word,                     
+    edited_ed_quoted_insert,                 edited_ed_redisplay,                     
+    edited_ed_search_next_history,           edited_ed_search_prev_history,           
+    edited_ed_sequence_lead_in,              edited_ed_start_over,                    
+    edited_ed_transpose_chars,               edited_ed_unassigned,                    
+    edited_em_accept_word,                   edited_em_capitol_case,                  
     edited_em_copy_prev_word,                edited_em_copy_region,                   
     edited_em_delete_next_word,              edited_em_delete_or_list,                
     edited_em_delete_prev_char,              edited_em_exchange_mark,                 
-    edited_em_gosmacs_transpose,             edited_em_inc_search_next,               
-    edited_em_inc_search_prev,               edited_em_kill_line,                     
-    edited_em_kill_region,                   edited_em_lower_case,                    
-    edited_em_meta_next,                     edited_em_next_word,                     
-    edited_em_set_mark,                      edited_em_toggle_overwrite,              
-    edited_em_universal_argument,            edited_em_upper_case,                    
-    edited_em_yank,                          edited_vi_add,                           
-    edited_vi_add_at_eol,                    edited_vi_alias,                         
-    edited_vi_change_case,                   edited_vi_change_meta,                   
-    edited_vi_change_to_eol,                 edited_vi_command_mode,                  
-    edited_vi_comment_out,                   edited_vi_delete_meta,                   
-    edited_vi_delete_prev_char,              edited_vi_end_big_word,                  
-    edited_vi_end_word,                      edited_vi_histedit,                      
-    edited_vi_history_word,                  edited_vi_insert,                        
-    edited_vi_insert_at_bol,                 edited_vi_kill_line_prev,                
-    edited_vi_list_or_eof,                   edited_vi_match,                         
-    edited_vi_next_big_word,                 edited_vi_next_char,                     
-    edited_vi_next_word,                     edited_vi_paste_next,                    
-    edited_vi_paste_prev,                    edited_vi_prev_big_word,                 
-    edited_vi_prev_char,                     edited_vi_prev_word,                     
-    edited_vi_redo,                          edited_vi_repeat_next_char,              
-    edited_vi_repeat_prev_char,              edited_vi_repeat_search_next,            
-    edited_vi_repeat_search_prev,            edited_vi_replace_char,                  
-    edited_vi_replace_mode,                  edited_vi_search_next,                   
-    edited_vi_search_prev,                   edited_vi_substitute_char,               
-    edited_vi_substitute_line,               edited_vi_to_column,                     
-    edited_vi_to_history_line,               edited_vi_to_next_char,                  
-    edited_vi_to_prev_char,                  edited_vi_undo,                          
-    edited_vi_undo_line,                     edited_vi_yank,                          
-    edited_vi_yank_end,                      edited_vi_zero,                          
+    edited_em_fuzzy_search,                  edited_em_gosmacs_transpose,             
+    edited_em_inc_search_next,               edited_em_inc_search_prev,               
+    edited_em_kill_line,                     edited_em_kill_region,                   
+    edited_em_lower_case,                    edited_em_meta_next,                     
+    edited_em_next_word,                     edited_em_set_mark,                      
+    edited_em_toggle_overwrite,              edited_em_universal_argument,            
+    edited_em_upper_case,                    edited_em_yank,                          
+    edited_vi_add,                           edited_vi_add_at_eol,                    
+    edited_vi_alias,                         edited_vi_change_case,                   
+    edited_vi_change_meta,                   edited_vi_change_to_eol,                 
+    edited_vi_command_mode,                  edited_vi_comment_out,                   
+    edited_vi_delete_meta,                   edited_vi_delete_prev_char,              
+    edited_vi_end_big_word,                  edited_vi_end_word,                      
+    edited_vi_histedit,                      edited_vi_history_word,                  
+    edited_vi_insert,                        edited_vi_insert_at_bol,                 
+    edited_vi_kill_line_prev,                edited_vi_list_or_eof,                   
+    edited_vi_match,                         edited_vi_next_big_word,                 
+    edited_vi_next_char,                     edited_vi_next_word,                     
+    edited_vi_paste_next,                    edited_vi_paste_prev,                    
+    edited_vi_prev_big_word,                 edited_vi_prev_char,                     
+    edited_vi_prev_word,                     edited_vi_redo,                          
+    edited_vi_repeat_next_char,              edited_vi_repeat_prev_char,              
+    edited_vi_repeat_search_next,            edited_vi_repeat_search_prev,            
+    edited_vi_replace_char,                  edited_vi_replace_mode,                  
+    edited_vi_search_next,                   edited_vi_search_prev,                   
+    edited_vi_substitute_char,               edited_vi_substitute_line,               
+    edited_vi_to_column,                     edited_vi_to_history_line,               
+    edited_vi_to_next_char,                  edited_vi_to_prev_char,                  
+    edited_vi_undo,                          edited_vi_undo_line,                     
+    edited_vi_yank,                          edited_vi_yank_end,                      
+    edited_vi_zero,                          
 };
@@ -110,6 +110,8 @@ static const struct edited_bindings_t edited_func_help[] = {
       L"Exchange the two characters before the cursor" },
     { L"em-next-word",                                   EDITED_EM_NEXT_WORD,                              
       L"Move next to end of current word" },
+    { L"em-accept-word",                                 EDITED_EM_ACCEPT_WORD,                            
+      L"Insert the next word of the line suggested from the history," },
     { L"em-upper-case",                                  EDITED_EM_UPPER_CASE,                             
       L"Uppercase the characters from cursor to end of current word" },
     { L"em-capitol-case",                                EDITED_EM_CAPITOL_CASE,                           
@@ -132,6 +134,8 @@ static const struct edited_bindings_t edited_func_help[] = {
       L"Emacs incremental next search" },
     { L"em-inc-search-prev",                             EDITED_EM_INC_SEARCH_PREV,                        
       L"Emacs incremental reverse search" },
+    { L"em-fuzzy-search",                                EDITED_EM_FUZZY_SEARCH,                           
+      L"Emacs fuzzy history search" },
     { L"em-delete-prev-char",                            EDITED_EM_DELETE_PREV_CHAR,                       
       L"Delete the character to the left of the cursor" },
     { L"ed-end-of-file",                                 EDITED_ED_END_OF_FILE,                            
@@ -152,6 +156,8 @@ static const struct edited_bindings_t edited_func_help[] = {
       L"Exchange the character to the left of the cursor with the one under it" },
     { L"ed-next-char",                                   EDITED_ED_NEXT_CHAR,                              
       L"Move to the right one character" },
+    { L"ed-accept-suggestion",                           EDITED_ED_ACCEPT_SUGGESTION,                      
+      L"Insert the rest of the line suggested from the history," },
     { L"ed-prev-word",                                   EDITED_ED_PREV_WORD,                              
       L"Move to the beginning of the current word" },
     { L"ed-prev-char",                                   EDITED_ED_PREV_CHAR,                              
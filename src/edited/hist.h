@@ -42,14 +42,32 @@
 
 typedef int (*hist_fun_t)(void *, HistEventW *, int, ...);
 
+typedef struct edited_sugg_t {
+	wchar_t		*str;		/* A line of the history	*/
+	size_t		 len;		/* Its length			*/
+	int		 num;		/* Newest event it was entered	*/
+} edited_sugg_t;
+
 typedef struct edited_history_t {
 	wchar_t		*buf;		/* The history buffer		*/
 	size_t		 sz;		/* Size of history buffer	*/
 	wchar_t		*last;		/* The last character		*/
 	int		 eventno;	/* Event we are looking for	*/
+	int		 navno;		/* Event the cursor is on, or 0	*/
+	int		 navnum;	/* Its event number		*/
 	void		*ref;		/* Argument for history fcns	*/
 	hist_fun_t	 fun;		/* Event access			*/
 	HistEventW	 ev;		/* Event cookie			*/
+	edited_sugg_t	*sugg;		/* Distinct lines, sorted	*/
+	int		 nsugg;		/* Number of lines		*/
+	int		*snewest;	/* Tree of the newest line	*/
+	int		 sleaves;	/* Leaves of that tree		*/
+	int		 snum;		/* Newest event in sugg		*/
+	int		 sold;		/* Oldest event in the history	*/
+	int		 sgen;		/* Its generation when indexed	*/
+	int		 slo, shi;	/* Lines starting with spfx	*/
+	wchar_t		*spfx;		/* Buffer they were found for	*/
+	size_t		 slen, ssz;	/* Its length and size		*/
 } edited_history_t;
 
 #define	HIST_FUN_INTERNAL(el, fn, arg)	\
@@ -63,6 +81,7 @@ typedef struct edited_history_t {
 #define	HIST_FIRST(el)			HIST_FUN(el, H_FIRST, NULL)
 #define	HIST_LAST(el)			HIST_FUN(el, H_LAST, NULL)
 #define	HIST_PREV(el)			HIST_FUN(el, H_PREV, NULL)
+#define	HIST_CURR(el)			HIST_FUN(el, H_CURR, NULL)
 #define	HIST_SET(el, num)		HIST_FUN(el, H_SET, num)
 #define	HIST_LOAD(el, fname)		HIST_FUN(el, H_LOAD fname)
 #define	HIST_SAVE(el, fname)		HIST_FUN(el, H_SAVE fname)
@@ -72,6 +91,12 @@ typedef struct edited_history_t {
 libedited_private int		hist_init(Edited *);
 libedited_private void		hist_end(Edited *);
 libedited_private edited_action_t	hist_get(Edited *);
+libedited_private const wchar_t	*hist_seek(Edited *, int *);
+libedited_private void		hist_mark(Edited *, int);
+libedited_private const void	*hist_raw(Edited *, int);
+libedited_private const wchar_t	*hist_search(Edited *, const wchar_t *, int,
+    int *);
+libedited_private const wchar_t	*hist_suggest(Edited *, size_t *);
 libedited_private int		hist_set(Edited *, hist_fun_t, void *);
 libedited_private int		hist_command(Edited *, int, const wchar_t **);
 libedited_private int		hist_enlargebuf(Edited *, size_t, size_t);
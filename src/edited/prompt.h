@@ -42,13 +42,31 @@
 
 typedef wchar_t    *(*edited_pfunc_t)(Edited *);
 
+typedef struct edited_pcell_t {
+	wint_t		c_char;		/* character or EL_LITERAL index */
+	int		c_width;	/* column width of a literal */
+} edited_pcell_t;
+
 typedef struct edited_prompt_t {
 	edited_pfunc_t	p_func;		/* Function to return the prompt */
 	coord_t		p_pos;		/* position in the line after prompt */
 	wchar_t		p_ignore;	/* character to start/end literal */
 	int		p_wide;
+	void		*p_key;		/* prompt string last rendered */
+	size_t		p_keylen;	/* bytes used in p_key */
+	size_t		p_keysize;	/* bytes allocated for p_key */
+	edited_pcell_t	*p_cells;	/* rendered prompt */
+	size_t		p_ncells;	/* cells used */
+	size_t		p_csize;	/* cells allocated */
+	int		p_keywide;	/* p_key holds a wide string */
+	int		p_gen;		/* line the deferred tokens are for */
+	wchar_t		*p_async;	/* completed prompt for this line */
+	wchar_t		*p_pending;	/* completion not yet applied */
 } edited_prompt_t;
 
+libedited_private void	edited_prompt_prepare(Edited *);
+libedited_private void	edited_prompt_newline(Edited *);
+libedited_private int	edited_prompt_pending(Edited *);
 libedited_private void	edited_prompt_print(Edited *, int);
 libedited_private int	edited_prompt_set(Edited *, edited_pfunc_t, wchar_t, int, int);
 libedited_private int	edited_prompt_get(Edited *, edited_pfunc_t *, wchar_t *, int);
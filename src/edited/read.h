@@ -43,5 +43,9 @@ libedited_private void		edited_read_prepare(Edited *);
 libedited_private void		edited_read_finish(Edited *);
 libedited_private int		edited_read_setfn(struct edited_read_t *, edited_rfunc_t);
 libedited_private edited_rfunc_t	edited_read_getfn(struct edited_read_t *);
+libedited_private int		edited_read_wakeinit(Edited *);
+libedited_private void		edited_read_wakeup(Edited *);
+libedited_private void		edited_read_lock(Edited *);
+libedited_private void		edited_read_unlock(Edited *);
 
 #endif /* _h_read */
@@ -44,16 +44,21 @@ typedef struct {
 	coord_t	r_cursor;	/* Refresh cursor position	*/
 	int	r_oldcv;	/* Vertical locations		*/
 	int	r_newcv;
+	int	r_deferred;	/* Refresh skipped, output busy	*/
+	coord_t	r_ghostat;	/* Where the suggestion starts	*/
+	int	r_ghost;	/* Its width, 0 if not shown	*/
 } edited_refresh_t;
 
 libedited_private void	edited_re_putc(Edited *, wint_t, int);
-libedited_private void	edited_re_putliteral(Edited *, const wchar_t *,
-    const wchar_t *);
+libedited_private void	edited_re_putliteral(Edited *, wint_t, int);
 libedited_private void	edited_re_clear_lines(Edited *);
+libedited_private void	edited_re_print_above(Edited *, const char *, size_t);
 libedited_private void	edited_re_clear_display(Edited *);
 libedited_private void	edited_re_refresh(Edited *);
 libedited_private void	edited_re_refresh_cursor(Edited *);
 libedited_private void	edited_re_fastaddc(Edited *);
 libedited_private void	edited_re_goto_bottom(Edited *);
+libedited_private void	edited_re_deferred(Edited *);
+libedited_private int	edited_re_reflow(Edited *, int);
 
 #endif /* _h_refresh */
@@ -40,6 +40,12 @@
 #ifndef _h_search
 #define	_h_search
 
+#if defined(REGEX)
+#include <regex.h>
+#elif defined(REGEXP)
+#include <regexp.h>
+#endif
+
 typedef struct edited_search_t {
 	wchar_t	*patbuf;		/* The pattern buffer		*/
 	size_t	 patlen;		/* Length of the pattern buffer	*/
@@ -47,6 +53,14 @@ typedef struct edited_search_t {
 	int	 chadir;		/* Character search direction	*/
 	wchar_t	 chacha;		/* Character we are looking for	*/
 	char	 chatflg;		/* 0 if f, 1 if t */
+	wchar_t	*repat;			/* Pattern last compiled	*/
+	char	*mbpat;			/* The same, encoded		*/
+	int	 reok;			/* If it compiled		*/
+#if defined(REGEX)
+	regex_t	 re;			/* The compiled pattern		*/
+#elif defined(REGEXP)
+	regexp	*re;
+#endif
 } edited_search_t;
 
 
@@ -54,8 +68,11 @@ libedited_private int		edited_match(const wchar_t *, const wchar_t *);
 libedited_private int		search_init(Edited *);
 libedited_private void		search_end(Edited *);
 libedited_private int		edited_c_hmatch(Edited *, const wchar_t *);
+libedited_private int		edited_c_literal(Edited *);
+libedited_private const wchar_t	*edited_c_hsearch(Edited *, int, int, int *);
 libedited_private void		edited_c_setpat(Edited *);
 libedited_private edited_action_t	edited_ce_inc_search(Edited *, int);
+libedited_private edited_action_t	edited_ce_fuzzy_search(Edited *);
 libedited_private edited_action_t	edited_cv_search(Edited *, int);
 libedited_private edited_action_t	edited_ce_search_line(Edited *, int);
 libedited_private edited_action_t	edited_cv_repeat_srch(Edited *, wint_t);
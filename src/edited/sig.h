@@ -60,6 +60,7 @@ typedef struct {
 	struct sigaction edited_sig_action[ALLSIGSNO];
 	sigset_t edited_sig_set;
 	volatile sig_atomic_t edited_sig_no;
+	volatile sig_atomic_t edited_sig_winch;	/* resize not applied yet */
 } *edited_signal_t;
 
 libedited_private void	edited_sig_end(Edited*);
@@ -17,6 +17,7 @@
 #define EDITED_COLOR_WHITE 15
 #define EDITED_COLOR_DEFAULT 1
 #define EDITED_COLOR_UNSET 0
+#define EDITED_STYLE_MAXLEN 20 /* Longest escape sequence of a style */
 
 union edited_style_t {
 	uint16_t color;
@@ -28,6 +29,7 @@ union edited_style_t {
 		unsigned italic : 1;
 		unsigned underline : 1;
 		unsigned strikethrough : 1;
+		unsigned dim : 1;
 	};
 };
 
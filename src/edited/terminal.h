@@ -66,6 +66,11 @@ typedef struct {
 	int	 *t_val;		/* termcap values	*/
 	char	 *t_cap;		/* Termcap buffer	*/
 	funckey_t	 *t_fkey;		/* Array of keys	*/
+	char	 *t_obuf;		/* Output not yet written	*/
+	size_t	  t_ooff;		/* first byte not written	*/
+	size_t	  t_olen;		/* bytes in t_obuf	*/
+	size_t	  t_osize;		/* bytes allocated	*/
+	coord_t	  t_alloc;		/* size of the display buffers	*/
 } edited_terminal_t;
 
 /*
@@ -115,6 +120,10 @@ libedited_private int	edited_term_echotc(Edited *, int, const wchar_t **);
 libedited_private void	edited_term_writec(Edited *, wint_t);
 libedited_private int	edited_term__putc(Edited *, wint_t);
 libedited_private void	edited_term__flush(Edited *);
+libedited_private void	edited_term__drain(Edited *);
+libedited_private void	edited_term__write(Edited *, const char *, size_t);
+libedited_private int	edited_term_backlog(Edited *);
+libedited_private int	edited_term_congested(Edited *);
 libedited_private void edited_term_overwrite_styled(Edited *, const wchar_t *, size_t, edited_style_t *);
 libedited_private void edited_term_insertwrite_styled(Edited *, wchar_t *, int, edited_style_t *);
 
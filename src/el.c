@@ -418,6 +418,34 @@ edited_wset(Edited *el, int op, ...)
 		el->edited_style_func = va_arg(ap, edited_stylefunc_t);
 		break;
 
+	case EL_FRAMEDROP:
+		if (va_arg(ap, int))
+			el->edited_flags |= FRAMEDROP;
+		else if (el->edited_flags & FRAMEDROP) {
+			edited_term__drain(el);
+			el->edited_flags &= ~FRAMEDROP;
+			edited_re_deferred(el);
+			edited_term__flush(el);
+		}
+		rv = 0;
+		break;
+
+	case EL_REFLOW:
+		if (va_arg(ap, int))
+			el->edited_flags |= REFLOW;
+		else
+			el->edited_flags &= ~REFLOW;
+		rv = 0;
+		break;
+
+	case EL_SUGGEST:
+		if (va_arg(ap, int))
+			el->edited_flags |= SUGGEST;
+		else
+			el->edited_flags &= ~SUGGEST;
+		rv = 0;
+		break;
+
 	default:
 		rv = -1;
 		break;
@@ -542,6 +570,18 @@ edited_wget(Edited *el, int op, ...)
 		*fp = el->edited_style_func;
 		break;
 	}
+	case EL_FRAMEDROP:
+		*va_arg(ap, int *) = (el->edited_flags & FRAMEDROP) != 0;
+		rv = 0;
+		break;
+	case EL_REFLOW:
+		*va_arg(ap, int *) = (el->edited_flags & REFLOW) != 0;
+		rv = 0;
+		break;
+	case EL_SUGGEST:
+		*va_arg(ap, int *) = (el->edited_flags & SUGGEST) != 0;
+		rv = 0;
+		break;
 	default:
 		rv = -1;
 		break;
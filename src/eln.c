@@ -156,6 +156,9 @@ edited_set(Edited *el, int op, ...)
 	case EL_SAFEREAD:
 	case EL_UNBUFFERED:
 	case EL_PREP_TERM:
+	case EL_FRAMEDROP:
+	case EL_REFLOW:
+	case EL_SUGGEST:
 		ret = edited_wset(el, op, va_arg(ap, int));
 		break;
 
@@ -323,6 +326,9 @@ edited_get(Edited *el, int op, ...)
 	case EL_SAFEREAD:
 	case EL_UNBUFFERED:
 	case EL_PREP_TERM:
+	case EL_FRAMEDROP:
+	case EL_REFLOW:
+	case EL_SUGGEST:
 		ret = edited_wget(el, op, va_arg(ap, int *));
 		break;
 
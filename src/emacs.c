@@ -280,6 +280,30 @@ edited_em_next_word(Edited *el, wint_t c __attribute__((__unused__)))
 }
 
 
+/* edited_em_accept_word():
+ *	Insert the next word of the line suggested from the history,
+ *	or move next to the end of the current word if there is none
+ */
+libedited_private edited_action_t
+edited_em_accept_word(Edited *el, wint_t c)
+{
+	const wchar_t *s;
+	size_t n;
+
+	if ((s = hist_suggest(el, &n)) == NULL)
+		return edited_em_next_word(el, c);
+	n = (size_t)(edited_c__next_word((wchar_t *)s, (wchar_t *)s + n,
+	    el->edited_state.argument, edited_ce__isword) - s);
+	if (el->edited_line.lastchar + n >= el->edited_line.limit &&
+	    !ch_enlargebufs(el, n))
+		return CC_ERROR;
+	edited_c_insert(el, (int)n);
+	(void) wmemcpy(el->edited_line.cursor, s, n);
+	el->edited_line.cursor += n;
+	return CC_REFRESH;
+}
+
+
 /* edited_em_upper_case():
  *	Uppercase the characters from cursor to end of current word
  *	[M-u]
@@ -489,6 +513,18 @@ edited_em_inc_search_prev(Edited *el, wint_t c __attribute__((__unused__)))
 }
 
 
+/* edited_em_fuzzy_search():
+ *	Emacs fuzzy history search
+ */
+libedited_private edited_action_t
+/*ARGSUSED*/
+edited_em_fuzzy_search(Edited *el, wint_t c __attribute__((__unused__)))
+{
+
+	return edited_ce_fuzzy_search(el);
+}
+
+
 /* edited_em_delete_prev_char():
  *	Delete the character to the left of the cursor
  *	[^?]
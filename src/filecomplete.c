@@ -547,6 +547,9 @@ edited_fn_display_match_list(Edited * el, char **matches, size_t num, size_t wid
 	matches++;
 	num--;
 
+	/* our own output may still be queued for the terminal */
+	edited_term__drain(el);
+
 	/*
 	 * Find out how many entries can be put on one line; count
 	 * with one space between strings the same way it's printed.
@@ -767,6 +770,7 @@ edited_fn_complete2(Edited *el,
 		matches_num = (size_t)(i - 1);
 
 		/* newline to get on next line from command line */
+		edited_term__drain(el);
 		(void)fprintf(el->edited_outfile, "\n");
 
 		/*
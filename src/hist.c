@@ -50,6 +50,8 @@ __RCSID("$NetBSD: hist.c,v 1.34 2019/07/23 10:19:35 christos Exp $");
 
 #include "edited/el.h"
 
+static void	hist_sfree(Edited *);
+
 /* hist_init():
  *	Initialization function.
  */
@@ -64,6 +66,7 @@ hist_init(Edited *el)
 		return -1;
 	el->edited_history.sz  = EL_BUFSIZ;
 	el->edited_history.last = el->edited_history.buf;
+	el->edited_history.navno = 0;
 	return 0;
 }
 
@@ -77,6 +80,9 @@ hist_end(Edited *el)
 
 	edited_free(el->edited_history.buf);
 	el->edited_history.buf = NULL;
+	hist_sfree(el);
+	edited_free(el->edited_history.spfx);
+	el->edited_history.spfx = NULL;
 }
 
 
@@ -89,10 +95,451 @@ hist_set(Edited *el, hist_fun_t fun, void *ptr)
 
 	el->edited_history.ref = ptr;
 	el->edited_history.fun = fun;
+	el->edited_history.navno = 0;
+	hist_sfree(el);
+	return 0;
+}
+
+
+/* hist_nth():
+ *	Make the n-th most recent event current, 0 being the most
+ *	recent one, if the history supports H_NTH.
+ */
+static const wchar_t *
+hist_nth(Edited *el, int n)
+{
+	edited_history_t *h = &el->edited_history;
+
+	if ((*h->fun)(h->ref, &h->ev, H_NTH, n) == -1)
+		return NULL;
+	if (el->edited_flags & NARROW_HISTORY)
+		return edited_ct_decode_string(
+		    (const char *)(const void *)h->ev.str, &el->edited_scratch);
+	return h->ev.str;
+}
+
+
+/* hist_mark():
+ *	Remember that the history cursor is on event eventno, so
+ *	that the next hist_seek() can step from there.
+ */
+libedited_private void
+hist_mark(Edited *el, int eventno)
+{
+
+	el->edited_history.navno = eventno;
+	el->edited_history.navnum = el->edited_history.ev.num;
+}
+
+
+/* hist_seek():
+ *	Move the history cursor to event *eventno, 1 being the most
+ *	recent one, and return it. When the cursor is still where the
+ *	last seek left it, step from there so that moving through the
+ *	history costs one step per event; otherwise seek directly with
+ *	H_NTH, or walk from the most recent event if that fails.
+ *	If there are fewer events, leave the cursor on the oldest one,
+ *	store its number in *eventno and return NULL.
+ */
+libedited_private const wchar_t *
+hist_seek(Edited *el, int *eventno)
+{
+	edited_history_t *h = &el->edited_history;
+	const wchar_t *hp;
+	int n = h->navno;
+
+	h->navno = 0;
+	if (h->ref == NULL || *eventno <= 0)
+		return NULL;
+
+	if (n > 0 && (hp = HIST_CURR(el)) != NULL && h->ev.num == h->navnum)
+		;
+	else if ((hp = hist_nth(el, *eventno - 1)) != NULL)
+		n = *eventno;
+	else if ((hp = HIST_FIRST(el)) != NULL)
+		n = 1;
+	else
+		return NULL;
+
+	hist_mark(el, n);
+	while (n != *eventno) {
+		hp = n < *eventno ? HIST_NEXT(el) : HIST_PREV(el);
+		if (hp == NULL) {
+			*eventno = n;
+			return NULL;
+		}
+		n += n < *eventno ? 1 : -1;
+		hist_mark(el, n);
+	}
+	return hp;
+}
+
+
+/* hist_search():
+ *	Make current the closest event containing pat, from event
+ *	*eventno towards older events if older is set or newer ones
+ *	otherwise, and store its position in *eventno. The builtin
+ *	history finds it with H_PREV_SUBSTR or H_NEXT_SUBSTR, which
+ *	can use its substring index.
+ */
+libedited_private const wchar_t *
+hist_search(Edited *el, const wchar_t *pat, int older, int *eventno)
+{
+	edited_history_t *h = &el->edited_history;
+	const void *arg = pat;
+	const wchar_t *hp;
+	int moved = 0, n = *eventno;
+
+	if ((hp = hist_seek(el, &n)) == NULL)
+		return NULL;
+
+	if (h->fun == (hist_fun_t)history_w || h->fun == (hist_fun_t)history) {
+		if (el->edited_flags & NARROW_HISTORY)
+			arg = edited_ct_encode_string(pat, &el->edited_scratch);
+		if (arg == NULL || (*h->fun)(h->ref, &h->ev,
+		    older ? H_PREV_SUBSTR : H_NEXT_SUBSTR, arg, &moved) == -1)
+			return NULL;
+		hp = h->ev.str;
+		if (el->edited_flags & NARROW_HISTORY)
+			hp = edited_ct_decode_string(
+			    (const char *)(const void *)hp, &el->edited_scratch);
+		n += older ? moved : -moved;
+	} else {
+		while (hp != NULL && wcsstr(hp, pat) == NULL) {
+			hp = older ? HIST_NEXT(el) : HIST_PREV(el);
+			n += older ? 1 : -1;
+		}
+	}
+	if (hp == NULL)
+		return NULL;
+
+	hist_mark(el, n);
+	*eventno = n;
+	return hp;
+}
+
+
+/* hist_sfree():
+ *	Forget the lines indexed for suggestions
+ */
+static void
+hist_sfree(Edited *el)
+{
+	edited_history_t *h = &el->edited_history;
+	int i;
+
+	for (i = 0; i < h->nsugg; i++)
+		edited_free(h->sugg[i].str);
+	edited_free(h->sugg);
+	edited_free(h->snewest);
+	h->sugg = NULL;
+	h->snewest = NULL;
+	h->nsugg = h->sleaves = h->snum = h->sold = 0;
+	h->slo = h->shi = 0;
+	h->slen = 0;
+}
+
+
+/* hist_scmp():
+ *	Order suggestion lines by their text, newest first
+ */
+static int
+hist_scmp(const void *a, const void *b)
+{
+	const edited_sugg_t *x = a, *y = b;
+	int r = wcscmp(x->str, y->str);
+
+	if (r != 0)
+		return r;
+	return x->num < y->num ? 1 : x->num > y->num ? -1 : 0;
+}
+
+
+/* hist_snewer():
+ *	Return whichever of lines a and b was entered last
+ */
+static int
+hist_snewer(const edited_history_t *h, int a, int b)
+{
+
+	if (a == -1)
+		return b;
+	if (b == -1)
+		return a;
+	return h->sugg[b].num > h->sugg[a].num ? b : a;
+}
+
+
+/* hist_stree():
+ *	Build the tree that holds, for every range of the sorted
+ *	lines, the one entered last
+ */
+static int
+hist_stree(Edited *el)
+{
+	edited_history_t *h = &el->edited_history;
+	int *t, i, n;
+
+	for (n = 1; n < h->nsugg; n <<= 1)
+		continue;
+	if (n != h->sleaves) {
+		t = edited_realloc(h->snewest, 2 * (size_t)n * sizeof(*t));
+		if (t == NULL)
+			return -1;
+		h->snewest = t;
+		h->sleaves = n;
+	}
+	t = h->snewest;
+	for (i = 0; i < n; i++)
+		t[n + i] = i < h->nsugg ? i : -1;
+	for (i = n - 1; i > 0; i--)
+		t[i] = hist_snewer(h, t[2 * i], t[2 * i + 1]);
 	return 0;
 }
 
 
+/* hist_snewest():
+ *	Return the line of [lo, hi) entered last
+ */
+static int
+hist_snewest(const edited_history_t *h, int lo, int hi)
+{
+	int best = -1;
+
+	for (lo += h->sleaves, hi += h->sleaves; lo < hi; lo >>= 1, hi >>= 1) {
+		if (lo & 1)
+			best = hist_snewer(h, best, h->snewest[lo++]);
+		if (hi & 1)
+			best = hist_snewer(h, best, h->snewest[--hi]);
+	}
+	return best;
+}
+
+
+/* hist_sdrop():
+ *	Forget the lines whose events are all older than event oldest
+ */
+static int
+hist_sdrop(Edited *el, int oldest)
+{
+	edited_history_t *h = &el->edited_history;
+	int i, k;
+
+	for (i = k = 0; i < h->nsugg; i++) {
+		if (h->sugg[i].num < oldest)
+			edited_free(h->sugg[i].str);
+		else
+			h->sugg[k++] = h->sugg[i];
+	}
+	h->sold = oldest;
+	if (k == h->nsugg)
+		return 0;
+	h->nsugg = k;
+	h->slo = 0;
+	h->shi = k;
+	h->slen = 0;
+	if (hist_stree(el) == -1) {
+		hist_sfree(el);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* hist_ssync():
+ *	Add the events entered since the last call to the suggestion
+ *	lines, merging them into the sorted ones, and drop the lines
+ *	whose events went. This costs a step per new event, so it can
+ *	run on every keystroke; an event deleted or changed other than
+ *	by dropping the oldest ones, as the history's H_GETGENERATION
+ *	tells, makes it start over. The history cursor is left where
+ *	it was.
+ */
+static int
+hist_ssync(Edited *el)
+{
+	edited_history_t *h = &el->edited_history;
+	edited_sugg_t *add = NULL, *all, *s;
+	const wchar_t *hp;
+	HistEventW ev;
+	int nadd = 0, szadd = 0, first, curr, gen, i, j, k;
+	size_t len;
+
+	curr = (*h->fun)(h->ref, &ev, H_CURR) == -1 ? -1 : ev.num;
+	gen = (*h->fun)(h->ref, &ev, H_GETGENERATION) == -1 ? -1 : ev.num;
+	if (gen != h->sgen) {
+		hist_sfree(el);
+		h->sgen = gen;
+	}
+	if ((*h->fun)(h->ref, &ev, H_LAST) == -1) {
+		hist_sfree(el);
+		goto out;
+	}
+	if (ev.num > h->sold && hist_sdrop(el, ev.num) == -1)
+		goto fail;
+	hp = HIST_FIRST(el);
+	first = h->ev.num;
+	if (first == h->snum)
+		goto out;
+	if (first < h->snum)
+		hist_sfree(el);		/* renumbered, start over */
+
+	for (; hp != NULL && h->ev.num > h->snum; hp = HIST_NEXT(el)) {
+		len = wcslen(hp);
+		if (len > 0 && hp[len - 1] == '\n')
+			len--;
+		if (len == 0)
+			continue;
+		if (nadd == szadd) {
+			szadd = szadd ? szadd * 2 : 16;
+			s = edited_realloc(add, (size_t)szadd * sizeof(*s));
+			if (s == NULL)
+				goto fail;
+			add = s;
+		}
+		s = &add[nadd];
+		if ((s->str = edited_calloc(len + 1, sizeof(*s->str))) == NULL)
+			goto fail;
+		(void)wmemcpy(s->str, hp, len);
+		s->len = len;
+		s->num = h->ev.num;
+		nadd++;
+	}
+	h->snum = first;
+	if (nadd == 0)
+		goto out;
+
+	qsort(add, (size_t)nadd, sizeof(*add), hist_scmp);
+	all = edited_calloc((size_t)(h->nsugg + nadd), sizeof(*all));
+	if (all == NULL)
+		goto fail;
+	for (i = j = k = 0; i < h->nsugg || j < nadd;) {
+		if (j == nadd || (i < h->nsugg &&
+		    hist_scmp(&h->sugg[i], &add[j]) <= 0))
+			s = &h->sugg[i++];
+		else
+			s = &add[j++];
+		if (k > 0 && wcscmp(all[k - 1].str, s->str) == 0)
+			edited_free(s->str);	/* older copy of a line */
+		else
+			all[k++] = *s;
+	}
+	edited_free(h->sugg);
+	edited_free(add);
+	h->sugg = all;
+	h->nsugg = k;
+	h->slo = 0;
+	h->shi = k;
+	h->slen = 0;
+	if (hist_stree(el) == -1) {
+		hist_sfree(el);
+		return -1;
+	}
+out:
+	if (curr != -1)
+		(void)(*h->fun)(h->ref, &ev, H_SET, curr);
+	return 0;
+fail:
+	while (nadd > 0)
+		edited_free(add[--nadd].str);
+	edited_free(add);
+	if (curr != -1)
+		(void)(*h->fun)(h->ref, &ev, H_SET, curr);
+	return -1;
+}
+
+
+/* hist_suggest():
+ *	Return the rest of the newest history line starting with the
+ *	edit buffer, up to the first character that is not printable,
+ *	and store its length in *lenp. There is none unless the cursor
+ *	is at the end of a new line being inserted into. The lines
+ *	found for the buffer are kept, so that typing one more
+ *	character only searches among them.
+ */
+libedited_private const wchar_t *
+hist_suggest(Edited *el, size_t *lenp)
+{
+	edited_history_t *h = &el->edited_history;
+	const wchar_t *buf = el->edited_line.buffer, *s;
+	size_t len = (size_t)(el->edited_line.lastchar - buf), off, n;
+	wchar_t *p;
+	int lo, hi, mid, end;
+
+	if (!(el->edited_flags & SUGGEST) || h->ref == NULL ||
+	    h->eventno != 0 || len == 0 ||
+	    el->edited_line.cursor != el->edited_line.lastchar ||
+	    el->edited_map.current == el->edited_map.alt)
+		return NULL;
+	if (hist_ssync(el) == -1 || h->nsugg == 0)
+		return NULL;
+
+	if (h->slen > len ||
+	    (h->slen > 0 && wmemcmp(h->spfx, buf, h->slen) != 0)) {
+		h->slo = 0;
+		h->shi = h->nsugg;
+		h->slen = 0;
+	}
+	/* the lines in [slo, shi) all start with the first slen chars */
+	off = h->slen;
+	n = len - off;
+	for (lo = h->slo, hi = h->shi; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (wcsncmp(h->sugg[mid].str + off, buf + off, n) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (end = lo, hi = h->shi; end < hi;) {
+		mid = end + (hi - end) / 2;
+		if (wcsncmp(h->sugg[mid].str + off, buf + off, n) == 0)
+			end = mid + 1;
+		else
+			hi = mid;
+	}
+	if (len > h->ssz) {
+		p = edited_realloc(h->spfx, len * sizeof(*p));
+		if (p == NULL)
+			return NULL;
+		h->spfx = p;
+		h->ssz = len;
+	}
+	(void)wmemcpy(h->spfx, buf, len);
+	h->slen = len;
+	h->slo = lo;
+	h->shi = hi;
+
+	if (lo < hi && h->sugg[lo].len == len)
+		lo++;			/* the buffer itself */
+	if (lo == hi)
+		return NULL;
+	s = h->sugg[hist_snewest(h, lo, hi)].str + len;
+	for (n = 0; s[n] != '\0' && edited_ct_chr_class(s[n]) == CHTYPE_PRINT; n++)
+		continue;
+	if (n == 0)
+		return NULL;
+	*lenp = n;
+	return s;
+}
+
+
+/* hist_raw():
+ *	Perform a history operation and return the string of the
+ *	event as the history keeps it, without converting it. The
+ *	string of a cold or multibyte event is decoded into a buffer
+ *	the next history operations reuse, so callers copy it.
+ */
+libedited_private const void *
+hist_raw(Edited *el, int fn)
+{
+	edited_history_t *h = &el->edited_history;
+
+	if ((*h->fun)(h->ref, &h->ev, fn, NULL) == -1)
+		return NULL;
+	return h->ev.str;
+}
+
+
 /* hist_get():
  *	Get a history line and update it in the buffer.
  *	eventno tells us the event to get.
@@ -101,7 +548,6 @@ libedited_private edited_action_t
 hist_get(Edited *el)
 {
 	const wchar_t *hp;
-	int h;
 	size_t blen, hlen;
 
 	if (el->edited_history.eventno == 0) {	/* if really the current line */
@@ -122,19 +568,15 @@ hist_get(Edited *el)
 	if (el->edited_history.ref == NULL)
 		return CC_ERROR;
 
-	hp = HIST_FIRST(el);
+	hp = hist_seek(el, &el->edited_history.eventno);
 
 	if (hp == NULL)
 		return CC_ERROR;
 
-	for (h = 1; h < el->edited_history.eventno; h++)
-		if ((hp = HIST_NEXT(el)) == NULL)
-			goto out;
-
 	hlen = wcslen(hp) + 1;
 	blen = (size_t)(el->edited_line.limit - el->edited_line.buffer);
 	if (hlen > blen && !ch_enlargebufs(el, hlen))
-		goto out;
+		return CC_ERROR;
 
 	memcpy(el->edited_line.buffer, hp, hlen * sizeof(*hp));
 	el->edited_line.lastchar = el->edited_line.buffer + hlen - 1;
@@ -153,10 +595,6 @@ hist_get(Edited *el)
 		el->edited_line.cursor = el->edited_line.lastchar;
 
 	return CC_REFRESH;
-out:
-	el->edited_history.eventno = h;
-	return CC_ERROR;
-
 }
 
 
@@ -179,6 +617,7 @@ hist_command(Edited *el, int argc, const wchar_t **argv)
 		int hno = 1;
 		 /* List history entries */
 
+		edited_term__drain(el);
 		for (str = HIST_LAST(el); str != NULL; str = HIST_PREV(el)) {
 			char *ptr =
 			    edited_ct_encode_string(str, &el->edited_scratch);
@@ -247,6 +686,7 @@ hist_convert(Edited *el, int fn, void *arg)
 	HistEventW ev;
 	if ((*(el)->edited_history.fun)((el)->edited_history.ref, &ev, fn, arg) == -1)
 		return NULL;
+	el->edited_history.ev.num = ev.num;
 	return edited_ct_decode_string((const char *)(const void *)ev.str,
 	    &el->edited_scratch);
 }
@@ -47,14 +47,27 @@ __RCSID("$NetBSD: history.c,v 1.64 2024/07/11 05:41:24 kre Exp $");
 /*
  * hist.c: TYPE(History) access functions
  */
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _REENTRANT
+#include <pthread.h>
+#endif
 #include "edited/vis.h"
 
 static const char hist_cookie[] = "_HiStOrY_V2_\n";
+static const char rank_cookie[] = "_HiStOrY_RaNkS_V1_";
+static const char bin_cookie[] = "_HiStOrY_B1_";
+static const char meta_cookie[] = "_HiStOrY_MeTa_V1_";
 
 #include "edited/edited.h"
 
@@ -73,6 +86,7 @@ static const char hist_cookie[] = "_HiStOrY_V2_\n";
 #define	Strncmp(d, s, n)	strncmp(d, s, n)
 #define	Strncpy(d, s, n)	strncpy(d, s, n)
 #define	Strncat(d, s, n)	strncat(d, s, n)
+#define	Strstr(s, t)		strstr(s, t)
 #define	edited_ct_decode_string(s, b)	(s)
 #define	edited_ct_encode_string(s, b)	(s)
 
@@ -91,6 +105,7 @@ static const char hist_cookie[] = "_HiStOrY_V2_\n";
 #define	Strncmp(d, s, n)	wcsncmp(d, s, n)
 #define	Strncpy(d, s, n)	wcsncpy(d, s, n)
 #define	Strncat(d, s, n)	wcsncat(d, s, n)
+#define	Strstr(s, t)		wcsstr(s, t)
 
 #endif
 
@@ -113,6 +128,18 @@ struct TYPE(history) {
 	history_vfun_t h_clear;	/* Clear the history list	 */
 	history_efun_t h_enter;	/* Add an element		 */
 	history_efun_t h_add;	/* Append to an element		 */
+	int h_jfd;		/* Journal of entered events, or -1 */
+	char *h_jname;		/* Name of the journal		 */
+	int h_jsync;		/* Records between syncs, 0 never */
+	int h_jdirty;		/* Records not synced yet	 */
+	int h_jlines;		/* Lines in the journal up to h_jend */
+	off_t h_jend;		/* Bytes of the journal counted	 */
+	int h_share;		/* Enter what others journal	 */
+	off_t h_soff;		/* Bytes of the journal entered	 */
+	dev_t h_sdev;		/* Device and inode of the file	 */
+	ino_t h_sino;		/* h_soff is about		 */
+	char *h_slast;		/* Last record, between newlines */
+	size_t h_slastlen;	/* Its length with them		 */
 };
 
 #define	HNEXT(h, ev)		(*(h)->h_next)((h)->h_ref, ev)
@@ -141,11 +168,66 @@ static int history_setsize(TYPE(History) *, TYPE(HistEvent) *, int);
 static int history_getsize(TYPE(History) *, TYPE(HistEvent) *);
 static int history_setunique(TYPE(History) *, TYPE(HistEvent) *, int);
 static int history_getunique(TYPE(History) *, TYPE(HistEvent) *);
+static int history_setarena(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_settrigrams(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_gettrigrams(TYPE(History) *, TYPE(HistEvent) *);
+static int history_substr(TYPE(History) *, TYPE(HistEvent) *, const Char *,
+    int, int *);
+static int history_setprefixes(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_getprefixes(TYPE(History) *, TYPE(HistEvent) *);
+static int history_seterasedups(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_geterasedups(TYPE(History) *, TYPE(HistEvent) *);
+static int history_getarena(TYPE(History) *, TYPE(HistEvent) *);
+static int history_setfrecency(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_getfrecency(TYPE(History) *, TYPE(HistEvent) *);
+static int history_frecent(TYPE(History) *, TYPE(HistEvent) *, const Char *,
+    const Char **, int);
 static int history_set_fun(TYPE(History) *, TYPE(History) *);
+static int history_setmaxbytes(TYPE(History) *, TYPE(HistEvent) *, size_t,
+    size_t);
+static int history_getmaxbytes(TYPE(History) *, TYPE(HistEvent) *, size_t *,
+    size_t *);
+static int history_getbytes(TYPE(History) *, TYPE(HistEvent) *, size_t *);
+static int history_setcold(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_getcold(TYPE(History) *, TYPE(HistEvent) *);
+static int history_setmultibyte(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_getmultibyte(TYPE(History) *, TYPE(HistEvent) *);
+static int history_getgeneration(TYPE(History) *, TYPE(HistEvent) *);
 static int history_load(TYPE(History) *, const char *);
 static int history_save(TYPE(History) *, const char *);
+static int history_import_zsh(const char *, time_t *, int *, const char **);
+static int history_import_stamp(const char *, time_t *);
+static int history_import_add(char **, size_t *, size_t *, const char *,
+    size_t, int);
+static int history_import_enter(TYPE(History) *, const char *, time_t, int);
+static int history_import(TYPE(History) *, const char *);
 static int history_save_fp(TYPE(History) *, size_t, FILE *);
+static int history_load_bin(TYPE(History) *, char *, size_t);
+static int history_save_bin(TYPE(History) *, const char *);
+static int history_setmeta(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_getmeta(TYPE(History) *, TYPE(HistEvent) *);
+static int history_setevmeta(TYPE(History) *, TYPE(HistEvent) *, int,
+    const HistMeta *);
+static int history_getevmeta(TYPE(History) *, TYPE(HistEvent) *, int,
+    HistMeta *);
+static int history_metaslot(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_setfilter(TYPE(History) *, TYPE(HistEvent) *,
+    const HistFilter *);
+static int history_setjournal(TYPE(History) *, TYPE(HistEvent) *,
+    const char *, int);
+static int history_getjournal(TYPE(History) *, TYPE(HistEvent) *);
+static void history_journal_close(TYPE(History) *);
+static int history_journal_count(int, off_t *);
+static int history_journal_lock(TYPE(History) *);
+static int history_journal_compact(TYPE(History) *);
+static int history_journal(TYPE(History) *, const Char *);
+static int history_setshare(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_getshare(TYPE(History) *, TYPE(HistEvent) *);
+static void history_share_seen(TYPE(History) *, const char *, size_t);
+static off_t history_share_find(TYPE(History) *, int, off_t);
+static int history_share_sync(TYPE(History) *);
 static int history_prev_event(TYPE(History) *, TYPE(HistEvent) *, int);
+static int history_nth(TYPE(History) *, TYPE(HistEvent) *, int);
 static int history_next_event(TYPE(History) *, TYPE(HistEvent) *, int);
 static int history_next_string(TYPE(History) *, TYPE(HistEvent) *,
     const Char *);
@@ -157,24 +239,302 @@ static int history_prev_string(TYPE(History) *, TYPE(HistEvent) *,
 
 /*
  * Builtin- history implementation
+ *
+ * The entries live in a ring of fixed size records, oldest first,
+ * so that an entry is found by its position in constant time. Event
+ * numbers only grow from the oldest entry to the newest, so an event
+ * is found by its number with a binary search, in constant time as
+ * long as no entry was deleted from the middle.
+ *
+ * With H_SETARENA the strings are packed in large chunks instead of
+ * being allocated one by one. A chunk is freed when its last string
+ * goes, and when too much of the arena is dead after deletions from
+ * the middle, the live strings are copied together when the next
+ * event is entered.
+ *
+ * With H_SETERASEDUPS a hash table maps the strings to the numbers
+ * of their events, so that entering a string already in the history
+ * removes the old event without searching for it.
+ *
+ * With H_SETTRIGRAMS every three character sequence of the strings
+ * maps to the ascending list of the events containing it, so that
+ * H_PREV_SUBSTR and H_NEXT_SUBSTR only look at the events holding
+ * the rarest sequence of the string searched for. Numbers of deleted
+ * events are left in the lists and skipped; the lists are rebuilt
+ * when there are too many of them, or when the string of an event
+ * changes.
+ *
+ * With H_SETPREFIXES the same table also maps the first 1, 2, 4, ...
+ * HPREFIX characters of the strings to their events, so that
+ * H_PREV_STR and H_NEXT_STR only look at the events sharing the
+ * longest indexed prefix of the string searched for.
+ *
+ * With H_SETFRECENCY every distinct string has a rank counting its
+ * events and weighing its uses, a use weighing twice as much as one
+ * a half-life earlier. Weights are relative to an epoch, so ranks
+ * keep their order as time passes. The ranks form a treap ordered
+ * by string and balanced by the hash of the string, each node
+ * knowing the best rank below it, so that the best k strings with
+ * a prefix are drawn from a heap after looking at O(k log n) nodes.
+ *
+ * With H_SETCOLD the strings of the events older than the newest
+ * ones are frozen into blocks of HCOLDBLOCK events, front coded in
+ * the multibyte encoding and packed with a small LZ77 coder. Their
+ * entries are marked with the HCOLD chunk. Reaching one unpacks its
+ * block into one of HCOLDCACHE buffers and points all the entries
+ * of the block into it, until the buffer is reused for another block.
+ *
+ * With H_SETMULTIBYTE the wide history keeps each new string once in
+ * the multibyte encoding, with its length, in a column next to the
+ * ring; its entry is marked with the HMB chunk. Reaching one decodes
+ * its string into the least recently used of HVIEWS buffers, taken
+ * from the entry it held. The indexes decode what they look at into
+ * a buffer of their own, so that events being returned keep theirs.
+ * Saving and freezing copy the multibyte strings as they are.
+ *
+ * The characters of the strings are counted as they come and go, so
+ * that H_GETBYTES costs nothing and H_SETMAXBYTES drops the oldest
+ * events while the strings take too much. Events not yet decoded
+ * from a binary file count the length of their record meanwhile.
+ *
+ * With H_SETMETA what is known of the events is kept in columns next
+ * to the ring, one array per field indexed like it, so that filtered
+ * searches only read the fields filtered on. Directories are kept
+ * once and referred to by their index.
+ *
+ * Loading a binary history file maps it and enters its events without
+ * their strings, which are decoded from the file when an event is
+ * first returned or searched. The file is unmapped once every string
+ * is decoded or its last such event is gone. The indexes need all the
+ * strings, so with any of them on the events are decoded as loaded.
  */
+typedef struct hchunk_t {
+	struct hchunk_t *next;	/* Older chunk			*/
+	struct hchunk_t *prev;	/* Newer chunk			*/
+	size_t size;		/* Characters allocated		*/
+	size_t used;		/* Characters handed out	*/
+	size_t dead;		/* Characters of freed strings	*/
+	int live;		/* Strings still in the chunk	*/
+	Char text[];
+} hchunk_t;
+
+#define	HCHUNK		16384	/* Characters in an arena chunk	*/
+
+/*
+ * A block of frozen events: for each event oldest first, the
+ * difference of its number with the previous one, the length of the
+ * prefix its string shares with the previous string and the rest of
+ * the string in the multibyte encoding, packed by history_lz_pack().
+ */
+typedef struct hcold_t {
+	int first;		/* Number of its first event	*/
+	int last;		/* Of its last			*/
+	int n;			/* Events frozen in it		*/
+	int live;		/* Of which not released	*/
+	size_t raw;		/* Bytes before packing		*/
+	size_t bytes;		/* Bytes of the strings		*/
+	size_t size;		/* Bytes packed			*/
+	unsigned char data[];
+} hcold_t;
+
+/* A block unpacked, its events pointing to its strings */
+typedef struct hccache_t {
+	hcold_t *b;		/* Block unpacked, or NULL	*/
+	int *nums;		/* Numbers of its events	*/
+	Char *text;		/* Their strings		*/
+	unsigned int tick;	/* When last used		*/
+} hccache_t;
+
+#define	HCOLDBLOCK	128	/* Events frozen together	*/
+#define	HCOLDCACHE	8	/* Blocks kept unpacked		*/
+#define	HLZMIN		4	/* Shortest match		*/
+#define	HLZHASH		12	/* Bits of the match finder	*/
+#define	HLZBOUND(n)	((n) + (n) / 255 + 16)
+
+/* A string kept in the multibyte encoding, with its length */
+typedef struct hmbstr_t {
+	size_t len;		/* Characters			*/
+	size_t bytes;		/* Bytes, without the NUL	*/
+	char s[];
+} hmbstr_t;
+
+/* A buffer the string of a multibyte event is decoded into */
+typedef struct hview_t {
+	int num;		/* Its event, 0 if none		*/
+	Char *buf;
+	size_t size;		/* Characters allocated		*/
+} hview_t;
+
+#define	HVIEWS		4	/* Multibyte events decoded at once	*/
+
+typedef struct hslot_t {
+	unsigned int hash;	/* Hash of the string		*/
+	int num;		/* Its event, 0 if the slot is free	*/
+} hslot_t;
+
+typedef struct htri_t {
+	unsigned long long key;	/* Trigram or prefix, 0 if the slot is free */
+	int *nums;		/* Events containing them	*/
+	int n;			/* Number of events		*/
+	int size;		/* Allocated			*/
+	int off;		/* First event not known evicted	*/
+} htri_t;
+
+#define	HTRI(a, b, c)	\
+    ((((unsigned long long)(a) & 0x1fffff) << 42) | \
+    (((unsigned long long)(b) & 0x1fffff) << 21) | \
+    ((unsigned long long)(c) & 0x1fffff))
+
+/* Prefixes are keyed by their hash, with the bit trigrams never set */
+#define	HPFX(hash)	(((hash) >> 1) | (1ULL << 63))
+#define	HPREFIX		32	/* Longest prefix indexed	*/
+
+typedef struct hrank_t {
+	struct hrank_t *left;	/* Lesser strings		*/
+	struct hrank_t *right;	/* Greater strings		*/
+	struct hrank_t *best;	/* Best rank of the subtree	*/
+	unsigned int prio;	/* Heap order keeping it balanced	*/
+	Char *str;
+	int count;		/* Events with the string	*/
+	time_t last;		/* Last use			*/
+	double weight;		/* Uses, relative to the epoch	*/
+} hrank_t;
+
+/* Candidates of history_def_top(), best first */
+typedef struct hpick_t {
+	hrank_t *r;
+	int whole;		/* The subtree of r rather than r	*/
+} hpick_t;
+
+typedef struct hheap_t {
+	hpick_t *v;
+	size_t n;
+	size_t size;
+} hheap_t;
+
+#define	HPICK(p)	((p).whole ? (p).r->best : (p).r)
+
 typedef struct hentry_t {
 	TYPE(HistEvent) ev;		/* What we return		 */
 	void *data;		/* data				 */
-	struct hentry_t *next;	/* Next entry			 */
-	struct hentry_t *prev;	/* Previous entry		 */
+	hchunk_t *chunk;	/* Chunk holding ev.str, NULL, HCOLD or HMB */
 } hentry_t;
 
+/* The chunk of frozen events, whose strings are in a block */
+static hchunk_t history_cold_mark;
+#define	HCOLD		(&history_cold_mark)
+
+/* The chunk of events whose strings are kept multibyte */
+static hchunk_t history_mb_mark;
+#define	HMB		(&history_mb_mark)
+
 typedef struct history_t {
-	hentry_t list;		/* Fake list header element	*/
-	hentry_t *cursor;	/* Current element in the list	*/
+	hentry_t *list;		/* Ring of entries, oldest first	*/
+	int size;		/* Entries allocated, a power of two	*/
+	int start;		/* Ring index of the oldest entry	*/
+	int cursor;		/* Current entry, -1 if none		*/
 	int max;		/* Maximum number of events	*/
 	int cur;		/* Current number of events	*/
 	int eventid;		/* For generation of unique event id	 */
+	int changes;		/* Events changed, or gone but the oldest */
 	int flags;		/* TYPE(History) flags		*/
 #define H_UNIQUE	1	/* Store only unique elements	*/
+#define H_ARENA		2	/* Store strings in chunks	*/
+#define H_ERASEDUPS	4	/* Remove older equal elements	*/
+	hchunk_t *chunks;	/* Arena chunks, newest first	*/
+	size_t used;		/* Characters used in the arena	*/
+	size_t dead;		/* Of which freed		*/
+	size_t bytes;		/* Characters of the strings	*/
+	size_t maxbytes;	/* Most bytes of them, 0 for any */
+	size_t maxentry;	/* Most bytes of one, 0 for any	*/
+	hslot_t *slots;		/* Hash of the strings, if erasing dups	*/
+	size_t nslots;		/* Slots allocated, a power of two	*/
+	size_t nhashed;		/* Slots in use			*/
+#define H_TRIGRAMS	8	/* Index substrings		*/
+#define H_PREFIXES	32	/* Index prefixes		*/
+#define H_LISTS		(H_TRIGRAMS | H_PREFIXES)
+	htri_t *tris;		/* Trigram lists, if indexing	*/
+	size_t ntris;		/* Slots allocated, a power of two	*/
+	size_t ntrisused;	/* Slots in use			*/
+	int tstale;		/* Deleted events in the lists	*/
+	int tdirty;		/* Lists must be rebuilt	*/
+#define H_RANKED	16	/* Rank strings by use		*/
+	hrank_t *ranks;		/* Treap of the strings, if ranking	*/
+	int nranks;		/* Distinct strings		*/
+	int halflife;		/* Seconds for a use to weigh half	*/
+	time_t epoch;		/* When a use weighed 1		*/
+	const char *map;	/* Binary file of lazy events, or NULL	*/
+	size_t mapsize;		/* Its size			*/
+	size_t mapindex;	/* Offset of its record offsets	*/
+	int mapfirst;		/* Event of its first record	*/
+	int lazy;		/* Events not decoded from it	*/
+	int coldkeep;		/* Newest events not frozen, 0 for all */
+	int coldnext;		/* First event not frozen yet	*/
+	hcold_t **cold;		/* Blocks of frozen events, in order */
+	int ncold;		/* Their number			*/
+	int acold;		/* Allocated			*/
+	hccache_t ccache[HCOLDCACHE];	/* Blocks unpacked	*/
+	unsigned int ctick;	/* Clock of their uses		*/
+#define H_META		64	/* Keep what is known of events	*/
+	time_t *mtime;		/* When the event of a slot was entered */
+	int *mdur;		/* Seconds it ran, -1 unknown	*/
+	int *mstatus;		/* Its exit status, -1 unknown	*/
+	int *mcwd;		/* Its directory in mdirs, -1 unknown */
+	char **mdirs;		/* Directories of the events	*/
+	int nmdirs;		/* Their number			*/
+	int mlastdir;		/* The one found last		*/
+	int fon;		/* Searches are filtered	*/
+	time_t fsince;		/* On events entered since	*/
+	int fstatus;		/* With this status, -1 any	*/
+	int fcwd;		/* In this directory, -1 any	*/
+#define H_MULTIBYTE	128	/* Keep the strings multibyte	*/
+	hmbstr_t **mbs;		/* Multibyte string of a slot, if keeping them */
+	hview_t views[HVIEWS];	/* Their strings decoded, reused in turn */
+	int nextview;		/* View to reuse next		*/
+	hview_t mbtmp;		/* Decoded only for a moment	*/
 } history_t;
 
+/*
+ * A binary history file is this header, the records of the events
+ * oldest first, each the length of the string in the multibyte
+ * encoding of the locale followed by the string, and the 64 bit
+ * offsets of the records, all in the byte order of the writer.
+ */
+typedef struct hbinhead_t {
+	char magic[12];		/* bin_cookie, unterminated	*/
+	uint32_t version;	/* HBINVERSION			*/
+	uint32_t order;		/* HBINORDER as written		*/
+	uint32_t count;		/* Records			*/
+	uint64_t index;		/* Offset of the record offsets	*/
+} hbinhead_t;
+
+typedef struct hbinrec_t {
+	uint32_t bytes;		/* Of the string, without a NUL	*/
+} hbinrec_t;
+
+#define	HBINVERSION	1
+#define	HBINORDER	0x01020304
+
+/* The i-th entry, 0 being the oldest and h->cur - 1 the newest */
+#define	HSLOT(h, i)	(((h)->start + (i)) & ((h)->size - 1))
+#define	HENTRY(h, i)	(&(h)->list[HSLOT(h, i)])
+
+/* The multibyte string of entry e */
+#define	HMBS(h, e)	((h)->mbs[(e) - (h)->list])
+
+/* Whether new strings are kept multibyte */
+#ifdef NARROWCHAR
+#define	HMBSTORE(h)	0	/* they are multibyte already */
+#else
+#define	HMBSTORE(h)	((h)->flags & H_MULTIBYTE)
+#endif
+
+/* The bytes the strings of the entries take */
+#define	HBYTES(h)	((h)->bytes * sizeof(Char))
+
+#define	HMETASKIP	64	/* Saved events a load may have dropped */
+#define	HZSHMETA	0x83	/* zsh quotes the next byte, xor 32	*/
+
 static int history_def_next(void *, TYPE(HistEvent) *);
 static int history_def_first(void *, TYPE(HistEvent) *);
 static int history_def_prev(void *, TYPE(HistEvent) *);
@@ -187,8 +547,92 @@ static int history_def_add(void *, TYPE(HistEvent) *, const Char *);
 static int history_def_del(void *, TYPE(HistEvent) *, const int);
 
 static int history_def_init(void **, TYPE(HistEvent) *, int);
-static int history_def_insert(history_t *, TYPE(HistEvent) *, const Char *);
-static void history_def_delete(history_t *, TYPE(HistEvent) *, hentry_t *);
+static int history_def_grow(history_t *, int);
+static hentry_t *history_def_entry(history_t *, int);
+static int history_def_event(history_t *, TYPE(HistEvent) *);
+static int history_def_thaw(history_t *, hentry_t *);
+static void history_def_unmap(history_t *);
+static const char *history_def_lazyrec(history_t *, hentry_t *, hbinrec_t *);
+static size_t history_lz_putv(unsigned char *, size_t);
+static int history_lz_getv(const unsigned char **, const unsigned char *,
+    size_t *);
+static size_t history_lz_pack(const unsigned char *, size_t, unsigned char *);
+static size_t history_lz_unpack(const unsigned char *, size_t,
+    unsigned char *, size_t);
+static int history_def_freeze(history_t *);
+static hcold_t *history_def_coldblock(history_t *, int, int *);
+static int history_def_coldthaw(history_t *, hentry_t *);
+static void history_def_coldevict(history_t *, hccache_t *);
+static void history_def_colddrop(history_t *, hentry_t *);
+static int history_def_melt(history_t *);
+static hmbstr_t *history_def_mbenc(const Char *, size_t);
+static hmbstr_t *history_def_mbraw(const char *, size_t, size_t);
+static void history_def_mbput(history_t *, hentry_t *, hmbstr_t *);
+static int history_def_mbgrow(hview_t *, size_t);
+static hview_t *history_def_mbview(history_t *, hentry_t *);
+static int history_def_mbdecode(const hmbstr_t *, hview_t *);
+static int history_def_view(history_t *, hentry_t *);
+static const Char *history_def_estr(history_t *, hentry_t *);
+static int history_def_setmb(history_t *, int);
+static size_t history_bin_decode(const char *, const hbinrec_t *, Char *);
+static int history_def_setmeta(history_t *, int);
+static void history_def_mreset(history_t *, int, time_t);
+static void history_def_mmove(history_t *, int, int);
+static int history_def_dir(history_t *, const char *, int);
+static int history_def_pass(history_t *, int);
+static unsigned int history_def_mhash(history_t *, hentry_t *);
+static int history_def_savemeta(history_t *, const char *);
+static int history_def_loadmeta(history_t *, const char *, int);
+static int history_def_insert(history_t *, TYPE(HistEvent) *, const Char *,
+    size_t);
+static int history_def_append(history_t *, TYPE(HistEvent) *, const Char *,
+    size_t);
+static void history_def_delete(history_t *, TYPE(HistEvent) *, int);
+static void history_def_trim(history_t *, TYPE(HistEvent) *);
+static int history_def_find(history_t *, int);
+static int history_def_store(history_t *, hentry_t *, const Char *, size_t);
+static void history_def_release(history_t *, hentry_t *);
+static void history_def_compact(history_t *);
+static unsigned int history_def_hash(const Char *);
+static int history_def_index(history_t *, hentry_t *);
+static void history_def_unindex(history_t *, hentry_t *);
+static int history_def_lookup(history_t *, const Char *);
+static int history_def_seterasedups(history_t *, int);
+static htri_t *history_def_trigram(history_t *, unsigned long long, int);
+static int history_def_trindex(history_t *, hentry_t *);
+static void history_def_trfree(history_t *);
+static int history_def_trbuild(history_t *);
+static int history_def_trappend(history_t *, unsigned long long, int);
+static unsigned long long history_def_pfxhash(unsigned long long, Char);
+static void history_def_trlive(history_t *, htri_t *);
+static int history_def_trwalk(history_t *, htri_t *, const Char *, size_t,
+    int, int);
+static int history_def_substr(history_t *, TYPE(HistEvent) *, const Char *,
+    int, int *);
+static int history_def_prefix(history_t *, TYPE(HistEvent) *, const Char *,
+    int);
+static double history_def_rkpow(int);
+static int history_def_rkbetter(const hrank_t *, const hrank_t *);
+static void history_def_rkfix(hrank_t *);
+static hrank_t *history_def_rkinsert(hrank_t *, hrank_t *);
+static hrank_t *history_def_rkmerge(hrank_t *, hrank_t *);
+static hrank_t *history_def_rkremove(hrank_t *, hrank_t *);
+static void history_def_rkrefix(hrank_t *, const hrank_t *);
+static hrank_t *history_def_rkfind(history_t *, const Char *);
+static void history_def_rkscale(hrank_t *, double);
+static void history_def_rkfree(hrank_t *);
+static double history_def_rkweight(history_t *, time_t);
+static int history_def_rank(history_t *, const Char *, int);
+static void history_def_unrank(history_t *, const Char *);
+static int history_def_setranks(history_t *, int);
+static int history_def_rkpush(hheap_t *, hrank_t *, int);
+static int history_def_rkrange(hheap_t *, hrank_t *, const Char *, size_t,
+    int);
+static int history_def_top(history_t *, TYPE(HistEvent) *, const Char *,
+    const Char **, int);
+static int history_def_rkwrite(FILE *, hrank_t *, char **, size_t *);
+static int history_def_loadranks(history_t *, const char *);
+static int history_def_saveranks(history_t *, const char *);
 
 static int history_deldata_nth(history_t *, TYPE(HistEvent) *, int, void **);
 static int history_set_nth(void *, TYPE(HistEvent) *, int);
@@ -201,6 +645,18 @@ static int history_set_nth(void *, TYPE(HistEvent) *, int);
 	(((history_t *)p)->flags) |= H_UNIQUE; \
     else \
 	(((history_t *)p)->flags) &= ~H_UNIQUE
+#define	history_def_geterasedups(p) \
+    (((((history_t *)p)->flags) & H_ERASEDUPS) != 0)
+#define	history_def_gettrigrams(p) \
+    (((((history_t *)p)->flags) & H_TRIGRAMS) != 0)
+#define	history_def_getprefixes(p) \
+    (((((history_t *)p)->flags) & H_PREFIXES) != 0)
+#define	history_def_getarena(p) (((((history_t *)p)->flags) & H_ARENA) != 0)
+#define	history_def_setarena(p, arena) \
+    if (arena) \
+	(((history_t *)p)->flags) |= H_ARENA; \
+    else \
+	(((history_t *)p)->flags) &= ~H_ARENA
 
 #define	he_strerror(code)	he_errlist[code]
 #define	he_seterrev(evp, code)	{\
@@ -245,665 +701,4939 @@ static const Char *const he_errlist[] = {
 #define	_HE_NOT_ALLOWED		14
 #define	_HE_BAD_PARAM		15
 
-/* history_def_first():
- *	Default function to return the first event in the history.
+/* history_def_store():
+ *	Make e hold a copy of the len characters of str, in the
+ *	arena if it is enabled
  */
 static int
-history_def_first(void *p, TYPE(HistEvent) *ev)
+history_def_store(history_t *h, hentry_t *e, const Char *str, size_t len)
 {
-	history_t *h = (history_t *) p;
-
-	h->cursor = h->list.next;
-	if (h->cursor != &h->list)
-		*ev = h->cursor->ev;
-	else {
-		he_seterrev(ev, _HE_FIRST_NOTFOUND);
-		return -1;
+	hchunk_t *c = h->chunks;
+	Char *s;
+	size_t n;
+
+	if ((h->flags & H_ARENA) == 0) {
+		if ((s = h_malloc((len + 1) * sizeof(*s))) == NULL)
+			return -1;
+		e->chunk = NULL;
+	} else {
+		if (c == NULL || c->size - c->used < len + 1) {
+			n = len + 1 > HCHUNK ? len + 1 : HCHUNK;
+			c = h_malloc(sizeof(*c) + n * sizeof(*c->text));
+			if (c == NULL)
+				return -1;
+			c->size = n;
+			c->used = c->dead = 0;
+			c->live = 0;
+			c->prev = NULL;
+			if ((c->next = h->chunks) != NULL)
+				c->next->prev = c;
+			h->chunks = c;
+		}
+		s = c->text + c->used;
+		c->used += len + 1;
+		c->live++;
+		h->used += len + 1;
+		e->chunk = c;
 	}
-
+	memcpy(s, str, len * sizeof(*s));
+	s[len] = '\0';
+	e->ev.str = s;
+	h->bytes += len;
 	return 0;
 }
 
 
-/* history_def_last():
- *	Default function to return the last event in the history.
+/* history_def_release():
+ *	Free the string of e
  */
-static int
-history_def_last(void *p, TYPE(HistEvent) *ev)
+static void
+history_def_release(history_t *h, hentry_t *e)
 {
-	history_t *h = (history_t *) p;
-
-	h->cursor = h->list.prev;
-	if (h->cursor != &h->list)
-		*ev = h->cursor->ev;
-	else {
-		he_seterrev(ev, _HE_LAST_NOTFOUND);
-		return -1;
+	HistEventPrivate *evp = (void *)&e->ev;
+	hchunk_t *c = e->chunk;
+	hbinrec_t rec;
+	size_t len;
+	int i;
+
+	if (c == HMB) {
+		for (i = 0; evp->str != NULL && i < HVIEWS; i++)
+			if (h->views[i].num == e->ev.num)
+				h->views[i].num = 0;
+		h->bytes -= HMBS(h, e)->len;
+		h_free(HMBS(h, e));
+		HMBS(h, e) = NULL;
+		return;
 	}
-
-	return 0;
+	if (c == HCOLD) {
+		if (evp->str != NULL || history_def_coldthaw(h, e) == 0)
+			h->bytes -= Strlen(evp->str);
+		history_def_colddrop(h, e);
+		return;
+	}
+	if (evp->str == NULL) {		/* never decoded */
+		(void)history_def_lazyrec(h, e, &rec);
+		h->bytes -= rec.bytes < h->bytes ? rec.bytes : h->bytes;
+		if (--h->lazy == 0)
+			history_def_unmap(h);
+		return;
+	}
+	len = Strlen(evp->str);
+	h->bytes -= len;
+	if (c == NULL) {
+		h_free(evp->str);
+		return;
+	}
+	len++;
+	c->dead += len;
+	h->dead += len;
+	if (--c->live > 0)
+		return;
+
+	h->used -= c->used;
+	h->dead -= c->dead;
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		h->chunks = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	h_free(c);
 }
 
 
-/* history_def_next():
- *	Default function to return the next event in the history.
+/* history_def_compact():
+ *	Copy the strings of the arena into a single chunk when more
+ *	than half of the arena is dead
  */
-static int
-history_def_next(void *p, TYPE(HistEvent) *ev)
+static void
+history_def_compact(history_t *h)
 {
-	history_t *h = (history_t *) p;
-
-	if (h->cursor == &h->list) {
-		he_seterrev(ev, _HE_EMPTY_LIST);
-		return -1;
+	hchunk_t *c, *nc;
+	hentry_t *e;
+	size_t len, n;
+	int i;
+
+	if (h->dead < HCHUNK || h->dead < h->used / 2)
+		return;
+
+	n = h->used - h->dead;
+	n = n > HCHUNK ? n : HCHUNK;
+	if ((nc = h_malloc(sizeof(*nc) + n * sizeof(*nc->text))) == NULL)
+		return;
+	nc->size = n;
+	nc->used = nc->dead = 0;
+	nc->live = 0;
+	nc->next = nc->prev = NULL;
+
+	for (i = 0; i < h->cur; i++) {
+		e = HENTRY(h, i);
+		if (e->chunk == NULL || e->chunk == HCOLD || e->chunk == HMB)
+			continue;
+		len = Strlen(e->ev.str) + 1;
+		memcpy(nc->text + nc->used, e->ev.str, len * sizeof(*nc->text));
+		e->ev.str = nc->text + nc->used;
+		e->chunk = nc;
+		nc->used += len;
+		nc->live++;
 	}
 
-	if (h->cursor->next == &h->list) {
-		he_seterrev(ev, _HE_END_REACHED);
-		return -1;
+	while ((c = h->chunks) != NULL) {
+		h->chunks = c->next;
+		h_free(c);
 	}
-
-        h->cursor = h->cursor->next;
-        *ev = h->cursor->ev;
-
-	return 0;
+	h->chunks = nc;
+	h->used = nc->used;
+	h->dead = 0;
 }
 
 
-/* history_def_prev():
- *	Default function to return the previous event in the history.
+/* history_def_grow():
+ *	Make room in the ring for n entries
  */
 static int
-history_def_prev(void *p, TYPE(HistEvent) *ev)
+history_def_grow(history_t *h, int n)
 {
-	history_t *h = (history_t *) p;
-
-	if (h->cursor == &h->list) {
-		he_seterrev(ev,
-		    (h->cur > 0) ? _HE_END_REACHED : _HE_EMPTY_LIST);
+	hentry_t *nl;
+	hmbstr_t **nm = NULL;
+	time_t *nt = NULL;
+	int *nd = NULL, *ns = NULL, *nc;
+	int i, size;
+
+	for (size = h->size ? h->size : 16; size < n; size *= 2)
+		continue;
+	if (size == h->size)
+		return 0;
+	if ((nl = h_malloc((size_t)size * sizeof(*nl))) == NULL)
 		return -1;
-	}
-
-	if (h->cursor->prev == &h->list) {
-		he_seterrev(ev, _HE_START_REACHED);
+	if (HMBSTORE(h) &&
+	    (nm = h_malloc((size_t)size * sizeof(*nm))) == NULL) {
+		h_free(nl);
 		return -1;
 	}
-
-        h->cursor = h->cursor->prev;
-        *ev = h->cursor->ev;
-
+	if ((h->flags & H_META) != 0) {
+		if ((nt = h_malloc((size_t)size * sizeof(*nt))) == NULL ||
+		    (nd = h_malloc((size_t)size * sizeof(*nd))) == NULL ||
+		    (ns = h_malloc((size_t)size * sizeof(*ns))) == NULL ||
+		    (nc = h_malloc((size_t)size * sizeof(*nc))) == NULL) {
+			h_free(nt);
+			h_free(nd);
+			h_free(ns);
+			h_free(nm);
+			h_free(nl);
+			return -1;
+		}
+		for (i = 0; i < h->cur; i++) {
+			nt[i] = h->mtime[HSLOT(h, i)];
+			nd[i] = h->mdur[HSLOT(h, i)];
+			ns[i] = h->mstatus[HSLOT(h, i)];
+			nc[i] = h->mcwd[HSLOT(h, i)];
+		}
+		h_free(h->mtime);
+		h_free(h->mdur);
+		h_free(h->mstatus);
+		h_free(h->mcwd);
+		h->mtime = nt;
+		h->mdur = nd;
+		h->mstatus = ns;
+		h->mcwd = nc;
+	}
+	if (nm != NULL) {
+		for (i = 0; i < h->cur; i++)
+			nm[i] = h->mbs[HSLOT(h, i)];
+		h_free(h->mbs);
+		h->mbs = nm;
+	}
+	for (i = 0; i < h->cur; i++)
+		nl[i] = *HENTRY(h, i);
+	h_free(h->list);
+	h->list = nl;
+	h->size = size;
+	h->start = 0;
 	return 0;
 }
 
 
-/* history_def_curr():
- *	Default function to return the current event in the history.
+/* history_def_entry():
+ *	Return the i-th entry, decoding its string first if it was
+ *	loaded lazily, frozen or kept multibyte, or NULL if out of memory
  */
-static int
-history_def_curr(void *p, TYPE(HistEvent) *ev)
+static hentry_t *
+history_def_entry(history_t *h, int i)
 {
-	history_t *h = (history_t *) p;
-
-	if (h->cursor != &h->list)
-		*ev = h->cursor->ev;
-	else {
-		he_seterrev(ev,
-		    (h->cur > 0) ? _HE_CURR_INVALID : _HE_EMPTY_LIST);
-		return -1;
-	}
-
-	return 0;
+	hentry_t *e = HENTRY(h, i);
+	int rv;
+
+	if (e->ev.str != NULL)
+		return e;
+	if (e->chunk == HCOLD)
+		rv = history_def_coldthaw(h, e);
+	else if (e->chunk == HMB)
+		rv = history_def_view(h, e);
+	else
+		rv = history_def_thaw(h, e);
+	return rv == -1 ? NULL : e;
 }
 
 
-/* history_def_set():
- *	Default function to set the current event in the history to the
- *	given one.
+/* history_def_event():
+ *	Return the current event in ev
  */
 static int
-history_def_set(void *p, TYPE(HistEvent) *ev, const int n)
+history_def_event(history_t *h, TYPE(HistEvent) *ev)
 {
-	history_t *h = (history_t *) p;
+	hentry_t *e;
 
-	if (h->cur == 0) {
-		he_seterrev(ev, _HE_EMPTY_LIST);
-		return -1;
-	}
-	if (h->cursor == &h->list || h->cursor->ev.num != n) {
-		for (h->cursor = h->list.next; h->cursor != &h->list;
-		    h->cursor = h->cursor->next)
-			if (h->cursor->ev.num == n)
-				break;
-	}
-	if (h->cursor == &h->list) {
-		he_seterrev(ev, _HE_NOT_FOUND);
+	if ((e = history_def_entry(h, h->cursor)) == NULL) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
 		return -1;
 	}
+	*ev = e->ev;
 	return 0;
 }
 
 
-/* history_set_nth():
- *	Default function to set the current event in the history to the
- *	n-th one.
+/* history_def_thaw():
+ *	Decode the string of lazy entry e from the mapped file; a
+ *	damaged record decodes to an empty string
  */
 static int
-history_set_nth(void *p, TYPE(HistEvent) *ev, int n)
+history_def_thaw(history_t *h, hentry_t *e)
 {
-	history_t *h = (history_t *) p;
-
-	if (h->cur == 0) {
-		he_seterrev(ev, _HE_EMPTY_LIST);
+	hbinrec_t rec;
+	hmbstr_t *m;
+	const char *src;
+	Char *buf;
+	size_t n = 0;
+
+	src = history_def_lazyrec(h, e, &rec);
+	if ((buf = h_malloc((rec.bytes + 1) * sizeof(*buf))) == NULL)
 		return -1;
-	}
-	for (h->cursor = h->list.prev; h->cursor != &h->list;
-	    h->cursor = h->cursor->prev)
-		if (n-- <= 0)
-			break;
-	if (h->cursor == &h->list) {
-		he_seterrev(ev, _HE_NOT_FOUND);
+	if (src != NULL && rec.bytes > 0 &&
+	    (n = history_bin_decode(src, &rec, buf)) == (size_t)-1)
+		n = 0;
+	/* kept as read when keeping the strings multibyte */
+	if (HMBSTORE(h) && (m = history_def_mbraw(n > 0 ? src : "",
+	    n > 0 ? rec.bytes : 0, n)) != NULL)
+		history_def_mbput(h, e, m);
+	else if (history_def_store(h, e, buf, n) == -1) {
+		h_free(buf);
 		return -1;
 	}
-	return 0;
+	h_free(buf);
+	/* the file length stood for it until now */
+	h->bytes -= rec.bytes < h->bytes - n ? rec.bytes : h->bytes - n;
+	if (--h->lazy == 0)
+		history_def_unmap(h);
+	return e->chunk == HMB ? history_def_view(h, e) : 0;
 }
 
 
-/* history_def_add():
- *	Append string to element
+/* history_def_unmap():
+ *	Forget the binary file of the lazy entries
  */
-static int
-history_def_add(void *p, TYPE(HistEvent) *ev, const Char *str)
+static void
+history_def_unmap(history_t *h)
 {
-	history_t *h = (history_t *) p;
-	size_t len, elen, slen;
-	Char *s;
-	HistEventPrivate *evp = (void *)&h->cursor->ev;
 
-	if (h->cursor == &h->list)
-		return history_def_enter(p, ev, str);
-	elen = Strlen(evp->str);
-	slen = Strlen(str);
-	len = elen + slen + 1;
-	s = h_malloc(len * sizeof(*s));
-	if (s == NULL) {
-		he_seterrev(ev, _HE_MALLOC_FAILED);
-		return -1;
-	}
-	memcpy(s, evp->str, elen * sizeof(*s));
-	memcpy(s + elen, str, slen * sizeof(*s)); 
-        s[len - 1] = '\0';
-	h_free(evp->str);
-	evp->str = s;
-	*ev = h->cursor->ev;
-	return 0;
+	if (h->map != NULL)
+		(void) munmap((void *)(uintptr_t)h->map, h->mapsize);
+	h->map = NULL;
+	h->mapsize = h->mapindex = 0;
+	h->lazy = 0;
 }
 
 
-static int
-history_deldata_nth(history_t *h, TYPE(HistEvent) *ev,
-    int num, void **data)
+/* history_def_lazyrec():
+ *	Read the record of lazy entry e into rec and return its string,
+ *	or NULL with rec->bytes 0 if the record is damaged
+ */
+static const char *
+history_def_lazyrec(history_t *h, hentry_t *e, hbinrec_t *rec)
 {
-	if (history_set_nth(h, ev, num) != 0)
-		return -1;
-	/* magic value to skip delete (just set to n-th history) */
-	if (data == (void **)-1)
-		return 0;
-	ev->str = Strdup(h->cursor->ev.str);
-	ev->num = h->cursor->ev.num;
-	if (data)
-		*data = h->cursor->data;
-	history_def_delete(h, ev, h->cursor);
-	return 0;
+	uint64_t off;
+
+	memcpy(&off, h->map + h->mapindex +
+	    (size_t)(e->ev.num - h->mapfirst) * sizeof(off), sizeof(off));
+	if (off <= h->mapsize && h->mapsize - off >= sizeof(*rec)) {
+		memcpy(rec, h->map + off, sizeof(*rec));
+		if (h->mapsize - off - sizeof(*rec) >= rec->bytes)
+			return h->map + off + sizeof(*rec);
+	}
+	rec->bytes = 0;
+	return NULL;
 }
 
 
-/* history_def_del():
- *	Delete element hp of the h list
+/* history_bin_decode():
+ *	Decode the string of binary record rec into buf, which holds
+ *	rec->bytes + 1 characters; return its length or -1
  */
-/* ARGSUSED */
-static int
-history_def_del(void *p, TYPE(HistEvent) *ev __attribute__((__unused__)),
-    const int num)
+static size_t
+history_bin_decode(const char *src, const hbinrec_t *rec, Char *buf)
 {
-	history_t *h = (history_t *) p;
-	if (history_def_set(h, ev, num) != 0)
-		return -1;
-	ev->str = Strdup(h->cursor->ev.str);
-	ev->num = h->cursor->ev.num;
-	history_def_delete(h, ev, h->cursor);
-	return 0;
+#ifdef NARROWCHAR
+	if (memchr(src, '\0', rec->bytes) != NULL)
+		return (size_t)-1;
+	memcpy(buf, src, rec->bytes);
+	buf[rec->bytes] = '\0';
+	return rec->bytes;
+#else
+	const char *end = src + rec->bytes;
+	mbstate_t mbs;
+	size_t n;
+
+	(void) memset(&mbs, 0, sizeof(mbs));
+	n = mbsnrtowcs(buf, &src, rec->bytes, rec->bytes, &mbs);
+	if (n == (size_t)-1 || src != end || !mbsinit(&mbs))
+		return (size_t)-1;
+	buf[n] = L'\0';
+	return n;
+#endif
 }
 
 
-/* history_def_delete():
- *	Delete element hp of the h list
+/* history_lz_putv():
+ *	Write v in d seven bits at a time, low bits first; return the
+ *	bytes written
  */
-/* ARGSUSED */
-static void
-history_def_delete(history_t *h,
-		   TYPE(HistEvent) *ev __attribute__((__unused__)), hentry_t *hp)
+static size_t
+history_lz_putv(unsigned char *d, size_t v)
 {
-	HistEventPrivate *evp = (void *)&hp->ev;
-	if (hp == &h->list)
-		abort();
-	if (h->cursor == hp) {
-		h->cursor = hp->prev;
-		if (h->cursor == &h->list)
-			h->cursor = hp->next;
-	}
-	hp->prev->next = hp->next;
-	hp->next->prev = hp->prev;
-	h_free(evp->str);
-	h_free(hp);
-	h->cur--;
+	size_t n = 0;
+
+	for (; v >= 0x80; v >>= 7)
+		d[n++] = (unsigned char)(v | 0x80);
+	d[n++] = (unsigned char)v;
+	return n;
 }
 
 
-/* history_def_insert():
- *	Insert element with string str in the h list
+/* history_lz_getv():
+ *	Read a number written by history_lz_putv() from *s, before end
  */
 static int
-history_def_insert(history_t *h, TYPE(HistEvent) *ev, const Char *str)
+history_lz_getv(const unsigned char **s, const unsigned char *end,
+    size_t *v)
 {
-	hentry_t *c;
+	unsigned int shift;
 
-	c = h_malloc(sizeof(*c));
-	if (c == NULL)
-		goto oomem;
-	if ((c->ev.str = h_strdup(str)) == NULL) {
-		h_free(c);
-		goto oomem;
+	*v = 0;
+	for (shift = 0; *s < end && shift < sizeof(*v) * 8; shift += 7) {
+		*v |= (size_t)(**s & 0x7f) << shift;
+		if ((*(*s)++ & 0x80) == 0)
+			return 0;
 	}
-	c->data = NULL;
-	c->ev.num = ++h->eventid;
-	c->next = h->list.next;
-	c->prev = &h->list;
-	h->list.next->prev = c;
-	h->list.next = c;
-	h->cur++;
-	h->cursor = c;
-
-	*ev = c->ev;
-	return 0;
-oomem:
-	he_seterrev(ev, _HE_MALLOC_FAILED);
 	return -1;
 }
 
 
-/* history_def_enter():
- *	Default function to enter an item in the history
+/* history_lz_pack():
+ *	Pack the n bytes of src into dst, which holds HLZBOUND(n) bytes,
+ *	and return the bytes packed. Each token byte holds the number of
+ *	literals that follow it and the length of the match copied after
+ *	them, from a 16 bit distance back; 15 is continued by bytes adding
+ *	up until one is not 255. The last token has only literals.
  */
-static int
-history_def_enter(void *p, TYPE(HistEvent) *ev, const Char *str)
+static size_t
+history_lz_pack(const unsigned char *src, size_t n, unsigned char *dst)
 {
-	history_t *h = (history_t *) p;
-
-	if ((h->flags & H_UNIQUE) != 0 && h->list.next != &h->list &&
-	    Strcmp(h->list.next->ev.str, str) == 0)
-	    return 0;
-
-	if (history_def_insert(h, ev, str) == -1)
-		return -1;	/* error, keep error message */
-
-	/*
-         * Always keep at least one entry.
-         * This way we don't have to check for the empty list.
-         */
-	while (h->cur > h->max && h->cur > 0)
-		history_def_delete(h, ev, h->list.prev);
+	uint32_t seen[1 << HLZHASH], w;
+	const unsigned char *anchor = src, *p = src, *end = src + n, *ref;
+	unsigned char *d = dst, *tok;
+	size_t lit, len, v;
+	unsigned int k;
+
+	(void) memset(seen, 0, sizeof(seen));
+	for (;;) {
+		len = 0;
+		ref = NULL;
+		for (; end - p >= HLZMIN; p++) {
+			memcpy(&w, p, sizeof(w));
+			k = (unsigned int)(w * 2654435761U) >> (32 - HLZHASH);
+			ref = seen[k] ? src + seen[k] - 1 : NULL;
+			seen[k] = (uint32_t)(p - src) + 1;
+			if (ref != NULL && p - ref <= 0xffff &&
+			    memcmp(ref, p, HLZMIN) == 0)
+				break;
+		}
+		if (end - p >= HLZMIN)
+			for (len = HLZMIN; p + len < end && ref[len] == p[len];)
+				len++;
+		else
+			p = end;
+
+		lit = (size_t)(p - anchor);
+		tok = d++;
+		*tok = (unsigned char)((lit < 15 ? lit : 15) << 4);
+		if (lit >= 15) {
+			for (v = lit - 15; v >= 255; v -= 255)
+				*d++ = 255;
+			*d++ = (unsigned char)v;
+		}
+		memcpy(d, anchor, lit);
+		d += lit;
+		if (len == 0)
+			break;
 
-	return 1;
+		*d++ = (unsigned char)((p - ref) & 0xff);
+		*d++ = (unsigned char)((p - ref) >> 8);
+		v = len - HLZMIN;
+		*tok |= (unsigned char)(v < 15 ? v : 15);
+		if (v >= 15) {
+			for (v -= 15; v >= 255; v -= 255)
+				*d++ = 255;
+			*d++ = (unsigned char)v;
+		}
+		p += len;
+		anchor = p;
+	}
+	return (size_t)(d - dst);
 }
 
 
-/* history_def_init():
- *	Default history initialization function
+/* history_lz_unpack():
+ *	Unpack the n bytes of src packed by history_lz_pack() into the
+ *	size bytes of dst; return the bytes unpacked or -1
  */
-/* ARGSUSED */
-static int
-history_def_init(void **p, TYPE(HistEvent) *ev __attribute__((__unused__)), int n)
+static size_t
+history_lz_unpack(const unsigned char *src, size_t n, unsigned char *dst,
+    size_t size)
 {
-	history_t *h = (history_t *) h_malloc(sizeof(*h));
-	if (h == NULL)
-		return -1;
+	const unsigned char *end = src + n;
+	unsigned char *d = dst, *dend = dst + size;
+	size_t lit, len, off;
+	unsigned int t;
+
+	while (src < end) {
+		t = *src++;
+		if ((lit = t >> 4) == 15)
+			do {
+				if (src == end)
+					return (size_t)-1;
+				lit += *src;
+			} while (*src++ == 255);
+		if ((size_t)(end - src) < lit || (size_t)(dend - d) < lit)
+			return (size_t)-1;
+		memcpy(d, src, lit);
+		d += lit;
+		src += lit;
+		if (src == end)
+			break;
 
-	if (n <= 0)
-		n = 0;
-	h->eventid = 0;
-	h->cur = 0;
-	h->max = n;
-	h->list.next = h->list.prev = &h->list;
-	h->list.ev.str = NULL;
-	h->list.ev.num = 0;
-	h->cursor = &h->list;
-	h->flags = 0;
-	*p = h;
-	return 0;
+		if (end - src < 2)
+			return (size_t)-1;
+		off = (size_t)src[0] | (size_t)src[1] << 8;
+		src += 2;
+		if ((len = t & 15) == 15)
+			do {
+				if (src == end)
+					return (size_t)-1;
+				len += *src;
+			} while (*src++ == 255);
+		len += HLZMIN;
+		if (off == 0 || off > (size_t)(d - dst) ||
+		    (size_t)(dend - d) < len)
+			return (size_t)-1;
+		for (; len > 0; len--, d++)
+			*d = *(d - off);
+	}
+	return (size_t)(d - dst);
 }
 
 
-/* history_def_clear():
- *	Default history cleanup function
+/* history_def_freeze():
+ *	Pack the strings of the events older than the newest coldkeep
+ *	ones into blocks, HCOLDBLOCK events at a time. Events still lazy
+ *	are left in their file.
  */
-static void
-history_def_clear(void *p, TYPE(HistEvent) *ev)
+static int
+history_def_freeze(history_t *h)
 {
-	history_t *h = (history_t *) p;
-
-	while (h->list.prev != &h->list)
-		history_def_delete(h, ev, h->list.prev);
-	h->cursor = &h->list;
-	h->eventid = 0;
-	h->cur = 0;
-}
-
-
-
+	hentry_t *e, *in[HCOLDBLOCK];
+	hcold_t *b, *nbk, **nb;
+	unsigned char *raw = NULL, *nraw;
+	char *prev = NULL, *nprev;
+	const char *s;
+	size_t rsz = 0, rlen, psz = 0, plen, len, shared, bytes;
+	int i, k, n, rv = -1;
+#ifndef NARROWCHAR
+	char *mb = NULL, *nmb;
+	size_t msz = 0;
+	const wchar_t *src;
+	mbstate_t mbs;
+#endif
+
+	while (h->coldkeep > 0 && (h->flags & (H_ERASEDUPS | H_RANKED)) == 0 &&
+	    h->cur - h->coldkeep - h->coldnext >= HCOLDBLOCK) {
+		rlen = plen = bytes = 0;
+		n = 0;
+		for (i = h->coldnext; i < h->coldnext + HCOLDBLOCK; i++) {
+			e = HENTRY(h, i);
+			if ((e->ev.str == NULL && e->chunk != HMB) ||
+			    e->chunk == HCOLD)
+				continue;
+			if (e->chunk == HMB) {
+				s = HMBS(h, e)->s;
+				len = HMBS(h, e)->bytes;
+			} else {
+#ifdef NARROWCHAR
+				s = e->ev.str;
+				len = strlen(s);
+#else
+				/* in one call, converting by character is slow */
+				len = wcslen(e->ev.str) * MB_CUR_MAX + 1;
+				if (len > msz) {
+					if ((nmb = h_realloc(mb, len)) == NULL)
+						goto done;
+					mb = nmb;
+					msz = len;
+				}
+				(void) memset(&mbs, 0, sizeof(mbs));
+				src = e->ev.str;
+				if ((len = wcsrtombs(mb, &src, msz, &mbs))
+				    == (size_t)-1)
+					continue;
+				s = mb;
+#endif
+			}
+			for (shared = 0; shared < plen && shared < len &&
+			    prev[shared] == s[shared]; shared++)
+				continue;
+			if (rsz - rlen < 30 + len - shared) {
+				rsz = (rlen + 30 + len - shared) * 2;
+				if ((nraw = h_realloc(raw, rsz)) == NULL)
+					goto done;
+				raw = nraw;
+			}
+			rlen += history_lz_putv(raw + rlen, n == 0 ? 0 :
+			    (size_t)(e->ev.num - in[n - 1]->ev.num));
+			rlen += history_lz_putv(raw + rlen, shared);
+			rlen += history_lz_putv(raw + rlen, len - shared);
+			memcpy(raw + rlen, s + shared, len - shared);
+			rlen += len - shared;
+			if (len > psz) {
+				psz = len * 2;
+				if ((nprev = h_realloc(prev, psz)) == NULL)
+					goto done;
+				prev = nprev;
+			}
+			memcpy(prev, s, len);
+			plen = len;
+			bytes += len;
+			in[n++] = e;
+		}
+		h->coldnext = i;
+		if (n == 0)
+			continue;
+
+		if (h->ncold == h->acold) {
+			k = h->acold ? h->acold * 2 : 16;
+			if ((nb = h_realloc(h->cold, (size_t)k * sizeof(*nb)))
+			    == NULL)
+				goto done;
+			h->cold = nb;
+			h->acold = k;
+		}
+		if ((b = h_malloc(sizeof(*b) + HLZBOUND(rlen))) == NULL)
+			goto done;
+		b->size = history_lz_pack(raw, rlen, b->data);
+		if ((nbk = h_realloc(b, sizeof(*b) + b->size)) != NULL)
+			b = nbk;
+		b->first = in[0]->ev.num;
+		b->last = in[n - 1]->ev.num;
+		b->n = b->live = n;
+		b->raw = rlen;
+		b->bytes = bytes;
+		h->cold[h->ncold++] = b;
+
+		/* the frozen strings still count */
+		for (k = 0; k < n; k++) {
+			len = in[k]->chunk == HMB ? HMBS(h, in[k])->len :
+			    Strlen(in[k]->ev.str);
+			history_def_release(h, in[k]);
+			h->bytes += len;
+			in[k]->ev.str = NULL;
+			in[k]->chunk = HCOLD;
+		}
+	}
+	rv = 0;
+done:
+#ifndef NARROWCHAR
+	h_free(mb);
+#endif
+	h_free(prev);
+	h_free(raw);
+	return rv;
+}
+
+
+/* history_def_coldblock():
+ *	Return the block of the frozen event num and its index in *k
+ */
+static hcold_t *
+history_def_coldblock(history_t *h, int num, int *k)
+{
+	int lo, hi, mid;
+
+	for (lo = 0, hi = h->ncold - 1; lo <= hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (num < h->cold[mid]->first)
+			hi = mid - 1;
+		else if (num > h->cold[mid]->last)
+			lo = mid + 1;
+		else {
+			*k = mid;
+			return h->cold[mid];
+		}
+	}
+	return NULL;
+}
+
+
+/* history_def_coldthaw():
+ *	Unpack the block of the frozen event e in place of the block
+ *	used least recently, and point its events to their strings
+ */
+static int
+history_def_coldthaw(history_t *h, hentry_t *e)
+{
+	hccache_t *c, *lru = h->ccache;
+	hcold_t *b;
+	hentry_t *x;
+	unsigned char *raw;
+	const unsigned char *p, *end;
+	char *mb, *q;
+	Char *t;
+	size_t d, shared, len, plen = 0, n;
+	int k, num, i;
+#ifndef NARROWCHAR
+	hbinrec_t rec;
+#endif
+
+	if ((b = history_def_coldblock(h, e->ev.num, &k)) == NULL)
+		return -1;
+	for (c = h->ccache; c < h->ccache + HCOLDCACHE; c++) {
+		if (c->b == b) {
+			c->tick = ++h->ctick;
+			return e->ev.str == NULL ? -1 : 0;
+		}
+		if (c->tick < lru->tick)
+			lru = c;
+	}
+	history_def_coldevict(h, lru);
+
+	if ((raw = h_malloc(b->raw)) == NULL)
+		return -1;
+	if (history_lz_unpack(b->data, b->size, raw, b->raw) != b->raw ||
+	    (lru->nums = h_malloc((size_t)b->n * sizeof(*lru->nums) +
+	    (b->bytes + (size_t)b->n) * sizeof(Char))) == NULL) {
+		h_free(raw);
+		return -1;
+	}
+	lru->text = (Char *)(void *)(lru->nums + b->n);
+#ifdef NARROWCHAR
+	mb = lru->text;
+#else
+	if ((mb = h_malloc(b->bytes + (size_t)b->n)) == NULL) {
+		h_free(raw);
+		h_free(lru->nums);
+		return -1;
+	}
+#endif
+
+	/* the strings end to end, each after the previous one */
+	p = raw;
+	end = raw + b->raw;
+	q = mb;
+	num = b->first;
+	for (k = 0; k < b->n; k++) {
+		if (history_lz_getv(&p, end, &d) == -1 ||
+		    history_lz_getv(&p, end, &shared) == -1 ||
+		    history_lz_getv(&p, end, &len) == -1 ||
+		    shared > plen || (size_t)(end - p) < len)
+			break;
+		num += (int)d;
+		lru->nums[k] = num;
+		if (shared > 0)
+			memmove(q, q - plen - 1, shared);
+		memcpy(q + shared, p, len);
+		p += len;
+		plen = shared + len;
+		q[plen] = '\0';
+		q += plen + 1;
+	}
+	for (n = (size_t)k; k < b->n; k++)
+		lru->nums[k] = 0;
+	h_free(raw);
+
+	for (k = 0, q = mb, t = lru->text; (size_t)k < n; k++) {
+		len = strlen(q);
+#ifdef NARROWCHAR
+		q += len + 1;
+#else
+		rec.bytes = (uint32_t)len;
+		if ((d = history_bin_decode(q, &rec, t)) == (size_t)-1) {
+			*t = '\0';
+			d = 0;
+		}
+		q += len + 1;
+		len = d;
+#endif
+		if ((i = history_def_find(h, lru->nums[k])) != -1 &&
+		    (x = HENTRY(h, i))->chunk == HCOLD)
+			x->ev.str = t;
+		t += len + 1;
+	}
+#ifndef NARROWCHAR
+	h_free(mb);
+#endif
+	lru->b = b;
+	lru->tick = ++h->ctick;
+	return e->ev.str == NULL ? -1 : 0;
+}
+
+
+/* history_def_coldevict():
+ *	Drop the block unpacked in c, its events no longer pointing to it
+ */
+static void
+history_def_coldevict(history_t *h, hccache_t *c)
+{
+	hentry_t *x;
+	int i, k;
+
+	if (c->b == NULL)
+		return;
+	for (k = 0; k < c->b->n; k++)
+		if ((i = history_def_find(h, c->nums[k])) != -1 &&
+		    (x = HENTRY(h, i))->chunk == HCOLD)
+			x->ev.str = NULL;
+	h_free(c->nums);
+	c->nums = NULL;
+	c->text = NULL;
+	c->b = NULL;
+	c->tick = 0;
+}
+
+
+/* history_def_colddrop():
+ *	Forget the frozen event e, and its block with its last event
+ */
+static void
+history_def_colddrop(history_t *h, hentry_t *e)
+{
+	hccache_t *c;
+	hcold_t *b;
+	int k;
+
+	if ((b = history_def_coldblock(h, e->ev.num, &k)) == NULL ||
+	    --b->live > 0)
+		return;
+	for (c = h->ccache; c < h->ccache + HCOLDCACHE; c++)
+		if (c->b == b) {
+			h_free(c->nums);
+			c->nums = NULL;
+			c->text = NULL;
+			c->b = NULL;
+			c->tick = 0;
+		}
+	memmove(h->cold + k, h->cold + k + 1,
+	    (size_t)(h->ncold - k - 1) * sizeof(*h->cold));
+	h->ncold--;
+	h_free(b);
+	if (h->ncold == 0) {
+		h_free(h->cold);
+		h->cold = NULL;
+		h->acold = 0;
+	}
+}
+
+
+/* history_def_melt():
+ *	Give the frozen events their strings back
+ */
+static int
+history_def_melt(history_t *h)
+{
+	hentry_t *e, he;
+	int i;
+
+	for (i = 0; h->ncold > 0 && i < h->cur; i++) {
+		e = HENTRY(h, i);
+		if (e->chunk != HCOLD)
+			continue;
+		if ((e->ev.str == NULL && history_def_coldthaw(h, e) == -1) ||
+		    history_def_store(h, &he, e->ev.str, Strlen(e->ev.str))
+		    == -1)
+			return -1;
+		history_def_release(h, e);
+		e->ev.str = he.ev.str;
+		e->chunk = he.chunk;
+	}
+	h->coldnext = 0;
+	return 0;
+}
+
+
+/* history_def_mbenc():
+ *	Return a copy of the len characters of str in the multibyte
+ *	encoding, or NULL if out of memory or it has no such encoding
+ */
+static hmbstr_t *
+history_def_mbenc(const Char *str, size_t len)
+{
+#ifdef NARROWCHAR
+	len = strnlen(str, len);
+	return history_def_mbraw(str, len, len);
+#else
+	hmbstr_t *m;
+	const wchar_t *src;
+	mbstate_t mbs;
+	size_t n;
+
+	for (n = 0; n < len && str[n]; n++)
+		continue;
+	len = n;
+	(void) memset(&mbs, 0, sizeof(mbs));
+	src = str;
+	if ((n = wcsnrtombs(NULL, &src, len, 0, &mbs)) == (size_t)-1 ||
+	    n > UINT32_MAX)
+		return NULL;
+	if ((m = h_malloc(sizeof(*m) + n + 1)) == NULL)
+		return NULL;
+	(void) memset(&mbs, 0, sizeof(mbs));
+	src = str;
+	(void) wcsnrtombs(m->s, &src, len, n, &mbs);
+	m->s[n] = '\0';
+	m->len = len;
+	m->bytes = n;
+	return m;
+#endif
+}
+
+
+/* history_def_mbraw():
+ *	Return a copy of the bytes of s, which decode to len characters
+ */
+static hmbstr_t *
+history_def_mbraw(const char *s, size_t bytes, size_t len)
+{
+	hmbstr_t *m;
+
+	if ((m = h_malloc(sizeof(*m) + bytes + 1)) == NULL)
+		return NULL;
+	memcpy(m->s, s, bytes);
+	m->s[bytes] = '\0';
+	m->len = len;
+	m->bytes = bytes;
+	return m;
+}
+
+
+/* history_def_mbput():
+ *	Make e hold the multibyte string m, decoded when reached
+ */
+static void
+history_def_mbput(history_t *h, hentry_t *e, hmbstr_t *m)
+{
+
+	HMBS(h, e) = m;
+	e->ev.str = NULL;
+	e->chunk = HMB;
+	h->bytes += m->len;
+}
+
+
+/* history_def_mbgrow():
+ *	Make the buffer of v hold len characters and a NUL
+ */
+static int
+history_def_mbgrow(hview_t *v, size_t len)
+{
+	Char *nb;
+
+	if (len + 1 <= v->size)
+		return 0;
+	if ((nb = h_realloc(v->buf, (len + 1) * sizeof(*nb))) == NULL)
+		return -1;
+	v->buf = nb;
+	v->size = len + 1;
+	return 0;
+}
+
+
+/* history_def_mbview():
+ *	Give the view used least recently to the multibyte entry e,
+ *	taking it from the entry it was decoded for, or return NULL if
+ *	out of memory
+ */
+static hview_t *
+history_def_mbview(history_t *h, hentry_t *e)
+{
+	hview_t *v = &h->views[h->nextview];
+	int i;
+
+	if (v->num != 0 && (i = history_def_find(h, v->num)) != -1 &&
+	    HENTRY(h, i)->ev.str == v->buf)
+		HENTRY(h, i)->ev.str = NULL;
+	v->num = 0;
+	if (history_def_mbgrow(v, HMBS(h, e)->len) == -1)
+		return NULL;
+	h->nextview = (h->nextview + 1) % HVIEWS;
+	v->num = e->ev.num;
+	e->ev.str = v->buf;
+	return v;
+}
+
+
+/* history_def_mbdecode():
+ *	Decode m into the buffer of v, growing it first if needed; a
+ *	string that does not decode becomes empty
+ */
+static int
+history_def_mbdecode(const hmbstr_t *m, hview_t *v)
+{
+	hbinrec_t rec;
+
+	if (history_def_mbgrow(v, m->len) == -1)
+		return -1;
+	/* encoded from m->len characters, it decodes to as many */
+	rec.bytes = (uint32_t)m->bytes;
+	if (history_bin_decode(m->s, &rec, v->buf) == (size_t)-1)
+		v->buf[0] = '\0';
+	return 0;
+}
+
+
+/* history_def_view():
+ *	Decode the string of the multibyte entry e into a view
+ */
+static int
+history_def_view(history_t *h, hentry_t *e)
+{
+	hview_t *v;
+
+	if ((v = history_def_mbview(h, e)) == NULL)
+		return -1;
+	return history_def_mbdecode(HMBS(h, e), v);
+}
+
+
+/* history_def_estr():
+ *	Return the string of e to look at in passing, decoding it into
+ *	h->mbtmp rather than a view if it is multibyte, so that no event
+ *	returned loses its string; NULL if out of memory
+ */
+static const Char *
+history_def_estr(history_t *h, hentry_t *e)
+{
+
+	if (e->ev.str != NULL)
+		return e->ev.str;
+	if (e->chunk != HMB)
+		return (e->chunk == HCOLD ? history_def_coldthaw(h, e) :
+		    history_def_thaw(h, e)) == -1 ? NULL : e->ev.str;
+	if (history_def_mbdecode(HMBS(h, e), &h->mbtmp) == -1)
+		return NULL;
+	return h->mbtmp.buf;
+}
+
+
+/* history_def_setmb():
+ *	Start or stop keeping the strings multibyte, converting those
+ *	already there; a string with no multibyte encoding stays wide
+ */
+static int
+history_def_setmb(history_t *h, int on)
+{
+	hentry_t *e, he;
+	hmbstr_t *m;
+	const Char *s;
+	int i;
+
+#ifdef NARROWCHAR
+	/* nothing to convert */
+	h->flags = on ? h->flags | H_MULTIBYTE : h->flags & ~H_MULTIBYTE;
+	return 0;
+#endif
+	if (on) {
+		if (h->mbs == NULL && h->size > 0) {
+			if ((h->mbs = h_malloc((size_t)h->size *
+			    sizeof(*h->mbs))) == NULL)
+				return -1;
+			(void) memset(h->mbs, 0,
+			    (size_t)h->size * sizeof(*h->mbs));
+		}
+		h->flags |= H_MULTIBYTE;
+		for (i = 0; i < h->cur; i++) {
+			e = HENTRY(h, i);
+			/* lazy and frozen strings are multibyte already */
+			if (e->ev.str == NULL || e->chunk == HCOLD ||
+			    e->chunk == HMB)
+				continue;
+			if ((m = history_def_mbenc(e->ev.str,
+			    Strlen(e->ev.str))) == NULL)
+				continue;
+			history_def_release(h, e);
+			history_def_mbput(h, e, m);
+		}
+		return 0;
+	}
+
+	for (i = 0; h->mbs != NULL && i < h->cur; i++) {
+		e = HENTRY(h, i);
+		if (e->chunk != HMB)
+			continue;
+		if ((s = history_def_estr(h, e)) == NULL ||
+		    history_def_store(h, &he, s, Strlen(s)) == -1)
+			return -1;
+		history_def_release(h, e);
+		e->ev.str = he.ev.str;
+		e->chunk = he.chunk;
+	}
+	h_free(h->mbs);
+	h->mbs = NULL;
+	for (i = 0; i < HVIEWS; i++) {
+		h_free(h->views[i].buf);
+		h->views[i].buf = NULL;
+		h->views[i].size = 0;
+		h->views[i].num = 0;
+	}
+	h_free(h->mbtmp.buf);
+	h->mbtmp.buf = NULL;
+	h->mbtmp.size = 0;
+	h->nextview = 0;
+	h->flags &= ~H_MULTIBYTE;
+	return 0;
+}
+
+
+/* history_def_setmeta():
+ *	Start or stop keeping what is known of the events; the events
+ *	already there are known nothing of
+ */
+static int
+history_def_setmeta(history_t *h, int on)
+{
+	size_t n;
+	int i;
+
+	h_free(h->mtime);
+	h_free(h->mdur);
+	h_free(h->mstatus);
+	h_free(h->mcwd);
+	h->mtime = NULL;
+	h->mdur = h->mstatus = h->mcwd = NULL;
+	for (i = 0; i < h->nmdirs; i++)
+		h_free(h->mdirs[i]);
+	h_free(h->mdirs);
+	h->mdirs = NULL;
+	h->nmdirs = 0;
+	h->mlastdir = -1;
+	h->fon = 0;
+	h->flags &= ~H_META;
+	if (!on || h->size == 0) {
+		if (on)
+			h->flags |= H_META;
+		return 0;
+	}
+
+	n = (size_t)h->size;
+	if ((h->mtime = h_malloc(n * sizeof(*h->mtime))) == NULL ||
+	    (h->mdur = h_malloc(n * sizeof(*h->mdur))) == NULL ||
+	    (h->mstatus = h_malloc(n * sizeof(*h->mstatus))) == NULL ||
+	    (h->mcwd = h_malloc(n * sizeof(*h->mcwd))) == NULL) {
+		(void)history_def_setmeta(h, 0);
+		return -1;
+	}
+	h->flags |= H_META;
+	for (i = 0; i < h->cur; i++)
+		history_def_mreset(h, i, 0);
+	return 0;
+}
+
+
+/* history_def_mreset():
+ *	Know of the i-th event only that it was entered at t
+ */
+static void
+history_def_mreset(history_t *h, int i, time_t t)
+{
+	int n = HSLOT(h, i);
+
+	h->mtime[n] = t;
+	h->mdur[n] = -1;
+	h->mstatus[n] = -1;
+	h->mcwd[n] = -1;
+}
+
+
+/* history_def_mmove():
+ *	Move what is known of the from-th event to the to-th
+ */
+static void
+history_def_mmove(history_t *h, int to, int from)
+{
+	int t = HSLOT(h, to), f = HSLOT(h, from);
+
+	h->mtime[t] = h->mtime[f];
+	h->mdur[t] = h->mdur[f];
+	h->mstatus[t] = h->mstatus[f];
+	h->mcwd[t] = h->mcwd[f];
+}
+
+
+/* history_def_dir():
+ *	Return the index of directory dir, adding it if add is set, or
+ *	-1. Events of a session mostly share one, so it is tried first.
+ */
+static int
+history_def_dir(history_t *h, const char *dir, int add)
+{
+	char **nd;
+	int i;
+
+	if (h->mlastdir != -1 && strcmp(h->mdirs[h->mlastdir], dir) == 0)
+		return h->mlastdir;
+	for (i = 0; i < h->nmdirs; i++)
+		if (strcmp(h->mdirs[i], dir) == 0)
+			return h->mlastdir = i;
+	if (!add)
+		return -1;
+	if ((h->nmdirs & (h->nmdirs - 1)) == 0) {
+		nd = h_realloc(h->mdirs, (size_t)(h->nmdirs ? h->nmdirs * 2 : 8)
+		    * sizeof(*nd));
+		if (nd == NULL)
+			return -1;
+		h->mdirs = nd;
+	}
+	if ((h->mdirs[h->nmdirs] = strdup(dir)) == NULL)
+		return -1;
+	return h->mlastdir = h->nmdirs++;
+}
+
+
+/* history_def_pass():
+ *	Return if the i-th event passes the search filter, reading only
+ *	the fields filtered on
+ */
+static int
+history_def_pass(history_t *h, int i)
+{
+	int n;
+
+	if (!h->fon)
+		return 1;
+	n = HSLOT(h, i);
+	if (h->fsince != 0 && h->mtime[n] < h->fsince)
+		return 0;
+	if (h->fstatus != -1 && h->mstatus[n] != h->fstatus)
+		return 0;
+	if (h->fcwd != -1 && h->mcwd[n] != h->fcwd)
+		return 0;
+	return 1;
+}
+
+
+/* history_def_mhash():
+ *	Hash the string of e as saved, to match the saved fields to the
+ *	events loaded, without decoding it if it is lazy
+ */
+static unsigned int
+history_def_mhash(history_t *h, hentry_t *e)
+{
+	unsigned int hash = 2166136261U;
+	const char *s, *end;
+	hbinrec_t rec;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	if (e->chunk == HMB) {
+		s = HMBS(h, e)->s;
+		end = s + HMBS(h, e)->bytes;
+	} else if (e->ev.str == NULL && e->chunk != HCOLD) {
+		if ((s = history_def_lazyrec(h, e, &rec)) == NULL)
+			return hash;
+		end = s + rec.bytes;
+	} else {
+		if ((e->ev.str == NULL && history_def_coldthaw(h, e) == -1) ||
+		    (s = edited_ct_encode_string(e->ev.str, &conv)) == NULL)
+			return hash;
+		end = s + strlen(s);
+	}
+	for (; s < end; s++)
+		hash = (hash ^ (unsigned char)*s) * 16777619U;
+	return hash;
+}
+
+
+/* history_def_hash():
+ *	Hash a string for the duplicate index
+ */
+static unsigned int
+history_def_hash(const Char *str)
+{
+	unsigned int hash = 2166136261U;
+
+	for (; *str; str++)
+		hash = (hash ^ (unsigned int)*str) * 16777619U;
+	return hash;
+}
+
+
+/* history_def_index():
+ *	Add the string of e to the duplicate index
+ */
+static int
+history_def_index(history_t *h, hentry_t *e)
+{
+	hslot_t *ns, *os = h->slots;
+	size_t i, j, n = h->nslots;
+	unsigned int hash;
+	const Char *str;
+
+	if ((str = history_def_estr(h, e)) == NULL)
+		return -1;
+	if (2 * (h->nhashed + 1) > n) {
+		n = n ? n * 2 : 64;
+		if ((ns = h_malloc(n * sizeof(*ns))) == NULL)
+			return -1;
+		memset(ns, 0, n * sizeof(*ns));
+		for (i = 0; i < h->nslots; i++) {
+			if (os[i].num == 0)
+				continue;
+			for (j = os[i].hash & (n - 1); ns[j].num != 0;
+			    j = (j + 1) & (n - 1))
+				continue;
+			ns[j] = os[i];
+		}
+		h_free(os);
+		h->slots = ns;
+		h->nslots = n;
+	}
+
+	hash = history_def_hash(str);
+	for (j = hash & (n - 1); h->slots[j].num != 0; j = (j + 1) & (n - 1))
+		continue;
+	h->slots[j].hash = hash;
+	h->slots[j].num = e->ev.num;
+	h->nhashed++;
+	return 0;
+}
+
+
+/* history_def_unindex():
+ *	Remove e from the duplicate index, if it is there
+ */
+static void
+history_def_unindex(history_t *h, hentry_t *e)
+{
+	hslot_t *sl = h->slots;
+	size_t i, j, k, mask = h->nslots - 1;
+	const Char *str;
+
+	/* without its string, its slot is left to lookups to skip */
+	if ((str = history_def_estr(h, e)) == NULL)
+		return;
+	for (i = history_def_hash(str) & mask; sl[i].num != e->ev.num;
+	    i = (i + 1) & mask)
+		if (sl[i].num == 0)
+			return;
+
+	/* shift back the slots that probed past the freed one */
+	for (j = i;;) {
+		sl[i].num = 0;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (sl[j].num == 0) {
+				h->nhashed--;
+				return;
+			}
+			k = sl[j].hash & mask;
+			if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
+				break;
+		}
+		sl[i] = sl[j];
+		i = j;
+	}
+}
+
+
+/* history_def_lookup():
+ *	Return the position of an event with string str, or -1
+ */
+static int
+history_def_lookup(history_t *h, const Char *str)
+{
+	hslot_t *sl = h->slots;
+	size_t i, mask = h->nslots - 1;
+	unsigned int hash;
+	const Char *s;
+	int n;
+
+	if (h->nhashed == 0)
+		return -1;
+	hash = history_def_hash(str);
+	for (i = hash & mask; sl[i].num != 0; i = (i + 1) & mask) {
+		if (sl[i].hash != hash)
+			continue;
+		n = history_def_find(h, sl[i].num);
+		if (n != -1 && (s = history_def_estr(h, HENTRY(h, n))) != NULL &&
+		    Strcmp(s, str) == 0)
+			return n;
+	}
+	return -1;
+}
+
+
+/* history_def_seterasedups():
+ *	Build or drop the duplicate index
+ */
+static int
+history_def_seterasedups(history_t *h, int erase)
+{
+	hentry_t *e;
+	int i;
+
+	h_free(h->slots);
+	h->slots = NULL;
+	h->nslots = h->nhashed = 0;
+	h->flags &= ~H_ERASEDUPS;
+	if (!erase)
+		return 0;
+	if (history_def_melt(h) == -1)
+		return -1;
+
+	for (i = 0; i < h->cur; i++)
+		if ((e = history_def_entry(h, i)) == NULL ||
+		    history_def_index(h, e) == -1) {
+			h_free(h->slots);
+			h->slots = NULL;
+			h->nslots = h->nhashed = 0;
+			return -1;
+		}
+	h->flags |= H_ERASEDUPS;
+	return 0;
+}
+
+
+/* history_def_trigram():
+ *	Return the list of the trigram key, creating it if add is set
+ */
+static htri_t *
+history_def_trigram(history_t *h, unsigned long long key, int add)
+{
+	htri_t *nt, *t;
+	size_t i, j, n = h->ntris;
+
+	if (add && 2 * (h->ntrisused + 1) > n) {
+		n = n ? n * 2 : 1024;
+		if ((nt = h_malloc(n * sizeof(*nt))) == NULL)
+			return NULL;
+		memset(nt, 0, n * sizeof(*nt));
+		for (i = 0; i < h->ntris; i++) {
+			if (h->tris[i].key == 0)
+				continue;
+			for (j = (size_t)((h->tris[i].key * 0x9e3779b97f4a7c15ULL)
+			    >> 32) & (n - 1); nt[j].key != 0; j = (j + 1) & (n - 1))
+				continue;
+			nt[j] = h->tris[i];
+		}
+		h_free(h->tris);
+		h->tris = nt;
+		h->ntris = n;
+	}
+	if (n == 0)
+		return NULL;
+
+	for (j = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (n - 1);
+	    h->tris[j].key != 0; j = (j + 1) & (n - 1))
+		if (h->tris[j].key == key)
+			return &h->tris[j];
+	if (!add)
+		return NULL;
+	t = &h->tris[j];
+	t->key = key;
+	t->nums = NULL;
+	t->n = t->size = t->off = 0;
+	h->ntrisused++;
+	return t;
+}
+
+
+/* history_def_trappend():
+ *	Add the event numbered num to the list of key
+ */
+static int
+history_def_trappend(history_t *h, unsigned long long key, int num)
+{
+	htri_t *t;
+	int *nn;
+	int n;
+
+	if ((t = history_def_trigram(h, key, 1)) == NULL)
+		return -1;
+	if (t->n > 0 && t->nums[t->n - 1] == num)
+		return 0;
+	if (t->n == t->size) {
+		n = t->size ? t->size * 2 : 4;
+		nn = h_realloc(t->nums, (size_t)n * sizeof(*nn));
+		if (nn == NULL)
+			return -1;
+		t->nums = nn;
+		t->size = n;
+	}
+	t->nums[t->n++] = num;
+	return 0;
+}
+
+
+/* history_def_pfxhash():
+ *	Hash the next character of a prefix
+ */
+static unsigned long long
+history_def_pfxhash(unsigned long long hash, Char c)
+{
+
+	return (hash ^ (unsigned long long)c) * 0x100000001b3ULL;
+}
+
+
+/* history_def_trindex():
+ *	Add the event of e to the lists of the trigrams and prefixes of
+ *	its string
+ */
+static int
+history_def_trindex(history_t *h, hentry_t *e)
+{
+	const Char *str = e->ev.str;
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	if (h->flags & H_TRIGRAMS)
+		for (; str[0] && str[1] && str[2]; str++)
+			if (history_def_trappend(h, HTRI(str[0], str[1], str[2]),
+			    e->ev.num) == -1)
+				return -1;
+
+	if (h->flags & H_PREFIXES)
+		for (str = e->ev.str, i = 0; i < HPREFIX && str[i]; i++) {
+			hash = history_def_pfxhash(hash, str[i]);
+			/* lengths 1, 2, 4, ... */
+			if ((i & (i + 1)) == 0 &&
+			    history_def_trappend(h, HPFX(hash), e->ev.num) == -1)
+				return -1;
+		}
+	return 0;
+}
+
+
+/* history_def_trlive():
+ *	Forget the evicted events at the start of the list t
+ */
+static void
+history_def_trlive(history_t *h, htri_t *t)
+{
+	int first = HENTRY(h, 0)->ev.num;
+
+	while (t->off < t->n && t->nums[t->off] < first)
+		t->off++;
+	if (t->off > t->n / 2) {
+		t->n -= t->off;
+		memmove(t->nums, t->nums + t->off,
+		    (size_t)t->n * sizeof(*t->nums));
+		t->off = 0;
+	}
+}
+
+
+/* history_def_trwalk():
+ *	Return the position of the closest event of the list t from
+ *	the current event, towards older ones if older is set, whose
+ *	string starts with the len characters of str if prefix is set
+ *	or contains str otherwise, or -1
+ */
+static int
+history_def_trwalk(history_t *h, htri_t *t, const Char *str, size_t len,
+    int prefix, int older)
+{
+	hentry_t *e;
+	int i, k, lo, hi, num;
+
+	num = HENTRY(h, h->cursor)->ev.num;
+	for (lo = t->off, hi = t->n; lo < hi;) {
+		k = lo + (hi - lo) / 2;
+		if (t->nums[k] < num)
+			lo = k + 1;
+		else
+			hi = k;
+	}
+	if (older && (lo == t->n || t->nums[lo] != num))
+		lo--;
+	for (k = lo; k >= t->off && k < t->n; k += older ? -1 : 1) {
+		if ((i = history_def_find(h, t->nums[k])) == -1 ||
+		    !history_def_pass(h, i) ||
+		    (e = history_def_entry(h, i)) == NULL)
+			continue;
+		if (prefix ? Strncmp(e->ev.str, str, len) == 0 :
+		    Strstr(e->ev.str, str) != NULL)
+			return i;
+	}
+	return -1;
+}
+
+
+/* history_def_trfree():
+ *	Drop the trigram lists
+ */
+static void
+history_def_trfree(history_t *h)
+{
+	size_t i;
+
+	for (i = 0; i < h->ntris; i++)
+		h_free(h->tris[i].nums);
+	h_free(h->tris);
+	h->tris = NULL;
+	h->ntris = h->ntrisused = 0;
+	h->tstale = 0;
+	h->tdirty = 0;
+}
+
+
+/* history_def_trbuild():
+ *	Build the trigram lists of all the events
+ */
+static int
+history_def_trbuild(history_t *h)
+{
+	hentry_t *e;
+	int i;
+
+	history_def_trfree(h);
+	for (i = 0; i < h->cur; i++)
+		if ((e = history_def_entry(h, i)) == NULL ||
+		    history_def_trindex(h, e) == -1) {
+			history_def_trfree(h);
+			h->tdirty = 1;
+			return -1;
+		}
+	return 0;
+}
+
+
+/* history_def_substr():
+ *	Make current the closest event containing str, from the current
+ *	event towards older ones if older is set or newer ones otherwise,
+ *	and store how many events the cursor moved in *moved
+ */
+static int
+history_def_substr(history_t *h, TYPE(HistEvent) *ev, const Char *str,
+    int older, int *moved)
+{
+	htri_t *t, *best = NULL;
+	hentry_t *e;
+	const Char *s;
+	int i;
+
+	if (history_def_curr(h, ev) == -1)
+		return -1;
+
+	if ((h->flags & H_TRIGRAMS) == 0 || Strlen(str) < 3 ||
+	    (h->tdirty && history_def_trbuild(h) == -1)) {
+		/* no index, look at every event */
+		for (i = h->cursor; i >= 0 && i < h->cur; i += older ? -1 : 1)
+			if (history_def_pass(h, i) &&
+			    (e = history_def_entry(h, i)) != NULL &&
+			    Strstr(e->ev.str, str) != NULL)
+				goto found;
+		goto notfound;
+	}
+
+	for (s = str; s[0] && s[1] && s[2]; s++) {
+		t = history_def_trigram(h, HTRI(s[0], s[1], s[2]), 0);
+		if (t == NULL)
+			goto notfound;
+		history_def_trlive(h, t);
+		if (best == NULL || t->n - t->off < best->n - best->off)
+			best = t;
+	}
+	if ((i = history_def_trwalk(h, best, str, 0, 0, older)) != -1)
+		goto found;
+
+notfound:
+	he_seterrev(ev, _HE_NOT_FOUND);
+	return -1;
+found:
+	if (moved)
+		*moved = older ? h->cursor - i : i - h->cursor;
+	h->cursor = i;
+	*ev = HENTRY(h, i)->ev;
+	return 0;
+}
+
+
+/* history_def_prefix():
+ *	Make current the closest event starting with str, from the
+ *	current event towards older ones if older is set or newer ones
+ *	otherwise, ending where the equivalent walk with H_NEXT or
+ *	H_PREV does.
+ */
+static int
+history_def_prefix(history_t *h, TYPE(HistEvent) *ev, const Char *str,
+    int older)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL, key = 0;
+	size_t j, len = Strlen(str);
+	hentry_t *e;
+	htri_t *t;
+	int i;
+
+	if (h->cursor == -1)
+		goto notfound;
+
+	if ((h->flags & H_PREFIXES) == 0 || len == 0 ||
+	    (h->tdirty && history_def_trbuild(h) == -1)) {
+		/* no index, look at every event */
+		for (i = h->cursor; i >= 0 && i < h->cur; i += older ? -1 : 1)
+			if (history_def_pass(h, i) &&
+			    (e = history_def_entry(h, i)) != NULL &&
+			    Strncmp(e->ev.str, str, len) == 0)
+				goto found;
+		goto notfound;
+	}
+
+	/* the list of the longest indexed prefix of str */
+	for (j = 0; j < len && j < HPREFIX; j++) {
+		hash = history_def_pfxhash(hash, str[j]);
+		if ((j & (j + 1)) == 0)
+			key = HPFX(hash);
+	}
+	if ((t = history_def_trigram(h, key, 0)) == NULL)
+		goto notfound;
+	history_def_trlive(h, t);
+	if ((i = history_def_trwalk(h, t, str, len, 1, older)) != -1)
+		goto found;
+
+notfound:
+	if (h->cursor != -1)
+		h->cursor = older ? 0 : h->cur - 1;
+	he_seterrev(ev, _HE_NOT_FOUND);
+	return -1;
+found:
+	h->cursor = i;
+	*ev = HENTRY(h, i)->ev;
+	return 0;
+}
+
+
+/* history_def_rkpow():
+ *	Return 2 to the power p
+ */
+static double
+history_def_rkpow(int p)
+{
+	double v = 1, b = p < 0 ? 0.5 : 2;
+	unsigned int n = p < 0 ? (unsigned int)-p : (unsigned int)p;
+
+	for (; n != 0; n >>= 1, b *= b)
+		if (n & 1)
+			v *= b;
+	return v;
+}
+
+
+/* history_def_rkbetter():
+ *	Return if a ranks above b; ties go to the last used string,
+ *	then to the lesser one
+ */
+static int
+history_def_rkbetter(const hrank_t *a, const hrank_t *b)
+{
+
+	if (a->weight != b->weight)
+		return a->weight > b->weight;
+	if (a->last != b->last)
+		return a->last > b->last;
+	return Strcmp(a->str, b->str) < 0;
+}
+
+
+/* history_def_rkfix():
+ *	Recompute the best string of the subtree of t
+ */
+static void
+history_def_rkfix(hrank_t *t)
+{
+
+	t->best = t;
+	if (t->left != NULL && history_def_rkbetter(t->left->best, t->best))
+		t->best = t->left->best;
+	if (t->right != NULL && history_def_rkbetter(t->right->best, t->best))
+		t->best = t->right->best;
+}
+
+
+/* history_def_rkinsert():
+ *	Insert r in the tree t, returning the new root
+ */
+static hrank_t *
+history_def_rkinsert(hrank_t *t, hrank_t *r)
+{
+	hrank_t *c;
+
+	if (t == NULL) {
+		r->left = r->right = NULL;
+		history_def_rkfix(r);
+		return r;
+	}
+	if (Strcmp(r->str, t->str) < 0) {
+		t->left = history_def_rkinsert(t->left, r);
+		if (t->left->prio > t->prio) {
+			c = t->left;
+			t->left = c->right;
+			c->right = t;
+			history_def_rkfix(t);
+			t = c;
+		}
+	} else {
+		t->right = history_def_rkinsert(t->right, r);
+		if (t->right->prio > t->prio) {
+			c = t->right;
+			t->right = c->left;
+			c->left = t;
+			history_def_rkfix(t);
+			t = c;
+		}
+	}
+	history_def_rkfix(t);
+	return t;
+}
+
+
+/* history_def_rkmerge():
+ *	Join the trees a and b, all of whose strings follow those of a
+ */
+static hrank_t *
+history_def_rkmerge(hrank_t *a, hrank_t *b)
+{
+
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (a->prio > b->prio) {
+		a->right = history_def_rkmerge(a->right, b);
+		history_def_rkfix(a);
+		return a;
+	}
+	b->left = history_def_rkmerge(a, b->left);
+	history_def_rkfix(b);
+	return b;
+}
+
+
+/* history_def_rkremove():
+ *	Remove r from the tree t, returning the new root
+ */
+static hrank_t *
+history_def_rkremove(hrank_t *t, hrank_t *r)
+{
+	int c;
+
+	if (t == r)
+		return history_def_rkmerge(r->left, r->right);
+	if ((c = Strcmp(r->str, t->str)) < 0)
+		t->left = history_def_rkremove(t->left, r);
+	else
+		t->right = history_def_rkremove(t->right, r);
+	history_def_rkfix(t);
+	return t;
+}
+
+
+/* history_def_rkrefix():
+ *	Recompute the best strings on the way to r after its weight
+ *	changed
+ */
+static void
+history_def_rkrefix(hrank_t *t, const hrank_t *r)
+{
+
+	if (t != r)
+		history_def_rkrefix(Strcmp(r->str, t->str) < 0 ?
+		    t->left : t->right, r);
+	history_def_rkfix(t);
+}
+
+
+/* history_def_rkfind():
+ *	Return the rank of str, or NULL
+ */
+static hrank_t *
+history_def_rkfind(history_t *h, const Char *str)
+{
+	hrank_t *t;
+	int c;
+
+	for (t = h->ranks; t != NULL; t = c < 0 ? t->left : t->right)
+		if ((c = Strcmp(str, t->str)) == 0)
+			break;
+	return t;
+}
+
+
+/* history_def_rkscale():
+ *	Multiply the weights of the subtree of t by f
+ */
+static void
+history_def_rkscale(hrank_t *t, double f)
+{
+
+	for (; t != NULL; t = t->right) {
+		t->weight *= f;
+		history_def_rkscale(t->left, f);
+	}
+}
+
+
+/* history_def_rkfree():
+ *	Free the subtree of t
+ */
+static void
+history_def_rkfree(hrank_t *t)
+{
+	hrank_t *r;
+
+	for (; t != NULL; t = r) {
+		history_def_rkfree(t->left);
+		r = t->right;
+		h_free(t->str);
+		h_free(t);
+	}
+}
+
+
+/* history_def_rkweight():
+ *	Return the weight of a use at time t, moving the epoch forward
+ *	first if the weights would grow too large
+ */
+static double
+history_def_rkweight(history_t *h, time_t t)
+{
+	time_t p;
+
+	if (h->epoch == 0)
+		h->epoch = t - t % h->halflife;
+	p = (t - h->epoch) / h->halflife;
+	if (p > 960) {
+		history_def_rkscale(h->ranks, history_def_rkpow(-512));
+		h->epoch += (time_t)512 * h->halflife;
+		p -= 512;
+	}
+	return history_def_rkpow(p < -1100 ? -1100 : (int)p);
+}
+
+
+/* history_def_rank():
+ *	Count an event with string str, and a use of it now if use is
+ *	set or it is new
+ */
+static int
+history_def_rank(history_t *h, const Char *str, int use)
+{
+	hrank_t *r;
+	time_t now = time(NULL);
+
+	if ((r = history_def_rkfind(h, str)) != NULL) {
+		r->count++;
+		if (!use)
+			return 0;
+		r->weight += history_def_rkweight(h, now);
+		r->last = now;
+		history_def_rkrefix(h->ranks, r);
+		return 0;
+	}
+	if ((r = h_malloc(sizeof(*r))) == NULL)
+		return -1;
+	if ((r->str = h_strdup(str)) == NULL) {
+		h_free(r);
+		return -1;
+	}
+	r->prio = history_def_hash(str);
+	r->count = 1;
+	r->last = now;
+	r->weight = history_def_rkweight(h, now);
+	h->ranks = history_def_rkinsert(h->ranks, r);
+	h->nranks++;
+	return 0;
+}
+
+
+/* history_def_unrank():
+ *	Forget an event with string str, and the string with the last
+ *	of them
+ */
+static void
+history_def_unrank(history_t *h, const Char *str)
+{
+	hrank_t *r;
+
+	if ((r = history_def_rkfind(h, str)) == NULL || --r->count > 0)
+		return;
+	h->ranks = history_def_rkremove(h->ranks, r);
+	h->nranks--;
+	h_free(r->str);
+	h_free(r);
+}
+
+
+/* history_def_setranks():
+ *	Rank the strings of the events by use, with uses counting half
+ *	as much every halflife seconds, or stop if halflife is 0
+ */
+static int
+history_def_setranks(history_t *h, int halflife)
+{
+	hentry_t *e;
+	int i;
+
+	history_def_rkfree(h->ranks);
+	h->ranks = NULL;
+	h->nranks = 0;
+	h->epoch = 0;
+	h->halflife = 0;
+	h->flags &= ~H_RANKED;
+	if (halflife == 0)
+		return 0;
+	if (history_def_melt(h) == -1)
+		return -1;
+
+	h->halflife = halflife;
+	h->flags |= H_RANKED;
+	for (i = 0; i < h->cur; i++)
+		if ((e = history_def_entry(h, i)) == NULL ||
+		    history_def_rank(h, e->ev.str, 1) == -1) {
+			(void)history_def_setranks(h, 0);
+			return -1;
+		}
+	return 0;
+}
+
+
+/* history_def_rkpush():
+ *	Add a string, or a whole subtree if whole is set, to the heap
+ *	of candidates of history_def_top()
+ */
+static int
+history_def_rkpush(hheap_t *hp, hrank_t *r, int whole)
+{
+	hpick_t p, *v;
+	size_t i;
+
+	if (r == NULL)
+		return 0;
+	if (hp->n == hp->size) {
+		hp->size = hp->size ? hp->size * 2 : 64;
+		if ((v = h_realloc(hp->v, hp->size * sizeof(*v))) == NULL)
+			return -1;
+		hp->v = v;
+	}
+	p.r = r;
+	p.whole = whole;
+	for (i = hp->n++; i > 0 &&
+	    history_def_rkbetter(HPICK(p), HPICK(hp->v[(i - 1) / 2]));
+	    i = (i - 1) / 2)
+		hp->v[i] = hp->v[(i - 1) / 2];
+	hp->v[i] = p;
+	return 0;
+}
+
+
+/* history_def_rkrange():
+ *	Add to the heap the strings and whole subtrees of t that start
+ *	with the len characters of pre; below an in range string, only
+ *	the bound on side still needs checking
+ */
+static int
+history_def_rkrange(hheap_t *hp, hrank_t *t, const Char *pre, size_t len,
+    int side)
+{
+	int c;
+
+	while (t != NULL) {
+		if ((c = Strncmp(t->str, pre, len)) != 0) {
+			t = c < 0 ? t->right : t->left;
+			continue;
+		}
+		if (history_def_rkpush(hp, t, 0) == -1)
+			return -1;
+		if (side == 0)
+			return history_def_rkrange(hp, t->left, pre, len, -1) |
+			    history_def_rkrange(hp, t->right, pre, len, 1);
+		if (history_def_rkpush(hp, side < 0 ? t->right : t->left,
+		    1) == -1)
+			return -1;
+		t = side < 0 ? t->left : t->right;
+	}
+	return 0;
+}
+
+
+/* history_def_top():
+ *	Store in lines the n best ranked strings starting with pre,
+ *	best first, and their number in ev->num
+ */
+static int
+history_def_top(history_t *h, TYPE(HistEvent) *ev, const Char *pre,
+    const Char **lines, int n)
+{
+	hheap_t hp;
+	hpick_t p;
+	size_t i, c;
+	int found = 0;
+
+	hp.v = NULL;
+	hp.n = hp.size = 0;
+	if (history_def_rkrange(&hp, h->ranks, pre, Strlen(pre), 0) == -1)
+		goto oomem;
+	while (found < n && hp.n > 0) {
+		p = hp.v[0];
+		/* sift the last candidate down from the top */
+		for (i = 0, hp.n--; (c = 2 * i + 1) < hp.n; i = c) {
+			if (c + 1 < hp.n && history_def_rkbetter(
+			    HPICK(hp.v[c + 1]), HPICK(hp.v[c])))
+				c++;
+			if (!history_def_rkbetter(HPICK(hp.v[c]),
+			    HPICK(hp.v[hp.n])))
+				break;
+			hp.v[i] = hp.v[c];
+		}
+		hp.v[i] = hp.v[hp.n];
+		if (!p.whole) {
+			lines[found++] = p.r->str;
+			continue;
+		}
+		if (history_def_rkpush(&hp, p.r, 0) == -1 ||
+		    history_def_rkpush(&hp, p.r->left, 1) == -1 ||
+		    history_def_rkpush(&hp, p.r->right, 1) == -1)
+			goto oomem;
+	}
+	h_free(hp.v);
+	ev->num = found;
+	return 0;
+oomem:
+	h_free(hp.v);
+	he_seterrev(ev, _HE_MALLOC_FAILED);
+	return -1;
+}
+
+
+/* history_def_find():
+ *	Return the position of the event numbered num, or -1
+ */
+static int
+history_def_find(history_t *h, int num)
+{
+	int lo, hi, mid, n;
+
+	if (h->cur == 0)
+		return -1;
+	n = num - HENTRY(h, 0)->ev.num;
+	if (n >= 0 && n < h->cur && HENTRY(h, n)->ev.num == num)
+		return n;
+
+	for (lo = 0, hi = h->cur - 1; lo <= hi;) {
+		mid = lo + (hi - lo) / 2;
+		n = HENTRY(h, mid)->ev.num;
+		if (n == num)
+			return mid;
+		if (n < num)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+
+/* history_def_first():
+ *	Default function to return the first event in the history.
+ */
+static int
+history_def_first(void *p, TYPE(HistEvent) *ev)
+{
+	history_t *h = (history_t *) p;
+
+	h->cursor = h->cur - 1;
+	if (h->cursor != -1)
+		return history_def_event(h, ev);
+	else {
+		he_seterrev(ev, _HE_FIRST_NOTFOUND);
+		return -1;
+	}
+}
+
+
+/* history_def_last():
+ *	Default function to return the last event in the history.
+ */
+static int
+history_def_last(void *p, TYPE(HistEvent) *ev)
+{
+	history_t *h = (history_t *) p;
+
+	h->cursor = h->cur > 0 ? 0 : -1;
+	if (h->cursor != -1)
+		return history_def_event(h, ev);
+	else {
+		he_seterrev(ev, _HE_LAST_NOTFOUND);
+		return -1;
+	}
+}
+
+
+/* history_def_next():
+ *	Default function to return the next event in the history.
+ */
+static int
+history_def_next(void *p, TYPE(HistEvent) *ev)
+{
+	history_t *h = (history_t *) p;
+
+	if (h->cursor == -1) {
+		he_seterrev(ev, _HE_EMPTY_LIST);
+		return -1;
+	}
+
+	if (h->cursor == 0) {
+		he_seterrev(ev, _HE_END_REACHED);
+		return -1;
+	}
+
+	h->cursor--;
+	return history_def_event(h, ev);
+}
+
+
+/* history_def_prev():
+ *	Default function to return the previous event in the history.
+ */
+static int
+history_def_prev(void *p, TYPE(HistEvent) *ev)
+{
+	history_t *h = (history_t *) p;
+
+	if (h->cursor == -1) {
+		he_seterrev(ev,
+		    (h->cur > 0) ? _HE_END_REACHED : _HE_EMPTY_LIST);
+		return -1;
+	}
+
+	if (h->cursor == h->cur - 1) {
+		he_seterrev(ev, _HE_START_REACHED);
+		return -1;
+	}
+
+	h->cursor++;
+	return history_def_event(h, ev);
+}
+
+
+/* history_def_curr():
+ *	Default function to return the current event in the history.
+ */
+static int
+history_def_curr(void *p, TYPE(HistEvent) *ev)
+{
+	history_t *h = (history_t *) p;
+
+	if (h->cursor != -1)
+		return history_def_event(h, ev);
+	else {
+		he_seterrev(ev,
+		    (h->cur > 0) ? _HE_CURR_INVALID : _HE_EMPTY_LIST);
+		return -1;
+	}
+}
+
+
+/* history_def_set():
+ *	Default function to set the current event in the history to the
+ *	given one.
+ */
+static int
+history_def_set(void *p, TYPE(HistEvent) *ev, const int n)
+{
+	history_t *h = (history_t *) p;
+
+	if (h->cur == 0) {
+		he_seterrev(ev, _HE_EMPTY_LIST);
+		return -1;
+	}
+	if (h->cursor == -1 || HENTRY(h, h->cursor)->ev.num != n)
+		h->cursor = history_def_find(h, n);
+	if (h->cursor == -1) {
+		he_seterrev(ev, _HE_NOT_FOUND);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_set_nth():
+ *	Default function to set the current event in the history to the
+ *	n-th one.
+ */
+static int
+history_set_nth(void *p, TYPE(HistEvent) *ev, int n)
+{
+	history_t *h = (history_t *) p;
+
+	if (h->cur == 0) {
+		he_seterrev(ev, _HE_EMPTY_LIST);
+		return -1;
+	}
+	if (n < 0)
+		n = 0;
+	h->cursor = n < h->cur ? n : -1;
+	if (h->cursor == -1) {
+		he_seterrev(ev, _HE_NOT_FOUND);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_def_add():
+ *	Append string to element
+ */
+static int
+history_def_add(void *p, TYPE(HistEvent) *ev, const Char *str)
+{
+	history_t *h = (history_t *) p;
+	size_t len, elen, slen;
+	Char *s;
+	HistEventPrivate *evp;
+
+	if (h->cursor == -1)
+		return history_def_enter(p, ev, str);
+	if (history_def_event(h, ev) == -1)
+		return -1;
+	evp = (void *)&HENTRY(h, h->cursor)->ev;
+	elen = Strlen(evp->str);
+	slen = Strlen(str);
+	len = elen + slen + 1;
+	s = h_malloc(len * sizeof(*s));
+	if (s == NULL) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	memcpy(s, evp->str, elen * sizeof(*s));
+	memcpy(s + elen, str, slen * sizeof(*s)); 
+        s[len - 1] = '\0';
+	if (h->flags & H_ERASEDUPS)
+		history_def_unindex(h, HENTRY(h, h->cursor));
+	if (h->flags & H_RANKED)
+		history_def_unrank(h, evp->str);
+	history_def_release(h, HENTRY(h, h->cursor));
+	HENTRY(h, h->cursor)->chunk = NULL;
+	evp->str = s;
+	h->bytes += len - 1;
+	h->changes++;
+	if (h->flags & H_ERASEDUPS)
+		(void)history_def_index(h, HENTRY(h, h->cursor));
+	if (h->flags & H_RANKED)
+		(void)history_def_rank(h, s, 0);
+	if (h->flags & H_LISTS)
+		h->tdirty = 1;
+	*ev = HENTRY(h, h->cursor)->ev;
+	return 0;
+}
+
+
+static int
+history_deldata_nth(history_t *h, TYPE(HistEvent) *ev,
+    int num, void **data)
+{
+	hentry_t *hp;
+
+	if (history_set_nth(h, ev, num) != 0)
+		return -1;
+	/* magic value to skip delete (just set to n-th history) */
+	if (data == (void **)-1)
+		return 0;
+	if ((hp = history_def_entry(h, h->cursor)) == NULL) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	ev->str = Strdup(hp->ev.str);
+	ev->num = hp->ev.num;
+	if (data)
+		*data = hp->data;
+	history_def_delete(h, ev, h->cursor);
+	return 0;
+}
+
+
+/* history_def_del():
+ *	Delete element hp of the h list
+ */
+/* ARGSUSED */
+static int
+history_def_del(void *p, TYPE(HistEvent) *ev __attribute__((__unused__)),
+    const int num)
+{
+	history_t *h = (history_t *) p;
+	hentry_t *hp;
+
+	if (history_def_set(h, ev, num) != 0)
+		return -1;
+	if ((hp = history_def_entry(h, h->cursor)) == NULL) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	ev->str = Strdup(hp->ev.str);
+	ev->num = hp->ev.num;
+	history_def_delete(h, ev, h->cursor);
+	return 0;
+}
+
+
+/* history_def_delete():
+ *	Delete the i-th element of the h list, closing the gap
+ *	from whichever end is nearer
+ */
+/* ARGSUSED */
+static void
+history_def_delete(history_t *h,
+		   TYPE(HistEvent) *ev __attribute__((__unused__)), int i)
+{
+	const Char *s;
+	int j;
+
+	if (i < 0 || i >= h->cur)
+		abort();
+	if (h->flags & H_ERASEDUPS)
+		history_def_unindex(h, HENTRY(h, i));
+	if ((h->flags & H_RANKED) &&
+	    (s = history_def_estr(h, HENTRY(h, i))) != NULL)
+		history_def_unrank(h, s);
+	/* evicted events are dropped from the lists as they are met */
+	if ((h->flags & H_LISTS) && i > 0 && ++h->tstale > h->cur)
+		h->tdirty = 1;
+	history_def_release(h, HENTRY(h, i));
+	if (i < h->coldnext)
+		h->coldnext--;
+	if (i > 0)
+		h->changes++;
+
+	if (i < h->cur - 1 - i) {
+		for (j = i; j > 0; j--) {
+			*HENTRY(h, j) = *HENTRY(h, j - 1);
+			if (h->mbs != NULL)
+				h->mbs[HSLOT(h, j)] = h->mbs[HSLOT(h, j - 1)];
+			if (h->flags & H_META)
+				history_def_mmove(h, j, j - 1);
+		}
+		h->start = (h->start + 1) & (h->size - 1);
+	} else {
+		for (j = i; j < h->cur - 1; j++) {
+			*HENTRY(h, j) = *HENTRY(h, j + 1);
+			if (h->mbs != NULL)
+				h->mbs[HSLOT(h, j)] = h->mbs[HSLOT(h, j + 1)];
+			if (h->flags & H_META)
+				history_def_mmove(h, j, j + 1);
+		}
+	}
+	h->cur--;
+
+	/* the cursor moves to the newer neighbour, else the older one */
+	if (h->cursor > i || (h->cursor == i && i == h->cur))
+		h->cursor--;
+	if (h->cur == 0)
+		h->cursor = -1;
+}
+
+
+/* history_def_insert():
+ *	Insert element with string str in the h list
+ */
+static int
+history_def_insert(history_t *h, TYPE(HistEvent) *ev, const Char *str,
+    size_t len)
+{
+	hentry_t *c;
+	hmbstr_t *m;
+	hview_t *v;
+
+	if (h->cur == h->size && history_def_grow(h, h->cur + 1) == -1)
+		goto oomem;
+	c = HENTRY(h, h->cur);
+	if (HMBSTORE(h) && (m = history_def_mbenc(str, len)) != NULL)
+		history_def_mbput(h, c, m);
+	else if (history_def_store(h, c, str, len) == -1)
+		goto oomem;
+	c->data = NULL;
+	c->ev.num = ++h->eventid;
+	/* its view is str, no need to decode it */
+	if (c->chunk == HMB) {
+		if ((v = history_def_mbview(h, c)) == NULL) {
+			history_def_release(h, c);
+			h->eventid--;
+			goto oomem;
+		}
+		memcpy(v->buf, str, HMBS(h, c)->len * sizeof(*str));
+		v->buf[HMBS(h, c)->len] = '\0';
+	}
+	if (h->flags & H_META)
+		history_def_mreset(h, h->cur, time(NULL));
+	if ((h->flags & H_ERASEDUPS) && history_def_index(h, c) == -1) {
+		history_def_release(h, c);
+		h->eventid--;
+		goto oomem;
+	}
+	if ((h->flags & H_RANKED) && history_def_rank(h, c->ev.str, 1) == -1) {
+		if (h->flags & H_ERASEDUPS)
+			history_def_unindex(h, c);
+		history_def_release(h, c);
+		h->eventid--;
+		goto oomem;
+	}
+	if ((h->flags & H_LISTS) && !h->tdirty &&
+	    history_def_trindex(h, c) == -1)
+		h->tdirty = 1;
+	h->cursor = h->cur++;
+
+	*ev = c->ev;
+	return 0;
+oomem:
+	he_seterrev(ev, _HE_MALLOC_FAILED);
+	return -1;
+}
+
+
+/* history_def_trim():
+ *	Drop the oldest events while there are more than the maximum,
+ *	or while their strings take more bytes than allowed
+ */
+static void
+history_def_trim(history_t *h, TYPE(HistEvent) *ev)
+{
+
+	/*
+         * Always keep at least one entry.
+         * This way we don't have to check for the empty list.
+         */
+	while (h->cur > h->max && h->cur > 0)
+		history_def_delete(h, ev, 0);
+	while (h->maxbytes != 0 && HBYTES(h) > h->maxbytes && h->cur > 1)
+		history_def_delete(h, ev, 0);
+}
+
+
+/* history_def_enter():
+ *	Default function to enter an item in the history
+ */
+static int
+history_def_enter(void *p, TYPE(HistEvent) *ev, const Char *str)
+{
+
+	return history_def_append(p, ev, str, Strlen(str));
+}
+
+
+/* history_def_append():
+ *	Enter the len characters of str in the history; this is where
+ *	history_load() adds each line
+ */
+static int
+history_def_append(history_t *h, TYPE(HistEvent) *ev, const Char *str,
+    size_t len)
+{
+	hrank_t *r = NULL;
+	const Char *s;
+	int i;
+
+	if (h->maxentry != 0 && len * sizeof(*str) > h->maxentry)
+		return 0;
+
+	if ((h->flags & H_UNIQUE) != 0 && h->cur > 0 &&
+	    (s = history_def_estr(h, HENTRY(h, h->cur - 1))) != NULL &&
+	    Strcmp(s, str) == 0)
+	    return 0;
+
+	if ((h->flags & H_ERASEDUPS) != 0) {
+		/* keep the rank of the string while its events go */
+		if ((h->flags & H_RANKED) != 0 &&
+		    (r = history_def_rkfind(h, str)) != NULL)
+			r->count++;
+		while ((i = history_def_lookup(h, str)) != -1)
+			history_def_delete(h, ev, i);
+	}
+
+	i = history_def_insert(h, ev, str, len);
+	if (r != NULL)
+		history_def_unrank(h, str);
+	if (i == -1)
+		return -1;	/* error, keep error message */
+
+	history_def_trim(h, ev);
+	(void)history_def_freeze(h);
+
+	if (h->dead > 0) {
+		history_def_compact(h);
+		if (h->cur > 0)
+			*ev = HENTRY(h, h->cur - 1)->ev;
+	}
+
+	return 1;
+}
+
+
+/* history_def_init():
+ *	Default history initialization function
+ */
+/* ARGSUSED */
+static int
+history_def_init(void **p, TYPE(HistEvent) *ev __attribute__((__unused__)), int n)
+{
+	history_t *h = (history_t *) h_malloc(sizeof(*h));
+	if (h == NULL)
+		return -1;
+
+	if (n <= 0)
+		n = 0;
+	h->eventid = 0;
+	h->changes = 0;
+	h->cur = 0;
+	h->max = n;
+	h->list = NULL;
+	h->size = 0;
+	h->start = 0;
+	h->cursor = -1;
+	h->flags = 0;
+	h->chunks = NULL;
+	h->used = h->dead = 0;
+	h->bytes = h->maxbytes = h->maxentry = 0;
+	h->slots = NULL;
+	h->nslots = h->nhashed = 0;
+	h->tris = NULL;
+	h->ntris = h->ntrisused = 0;
+	h->tstale = h->tdirty = 0;
+	h->ranks = NULL;
+	h->nranks = 0;
+	h->halflife = 0;
+	h->epoch = 0;
+	h->map = NULL;
+	h->mapsize = h->mapindex = 0;
+	h->mapfirst = 0;
+	h->lazy = 0;
+	h->coldkeep = h->coldnext = 0;
+	h->cold = NULL;
+	h->ncold = h->acold = 0;
+	(void) memset(h->ccache, 0, sizeof(h->ccache));
+	h->ctick = 0;
+	h->mtime = NULL;
+	h->mdur = h->mstatus = h->mcwd = NULL;
+	h->mdirs = NULL;
+	h->nmdirs = 0;
+	h->mlastdir = -1;
+	h->fon = 0;
+	h->mbs = NULL;
+	(void) memset(h->views, 0, sizeof(h->views));
+	h->nextview = 0;
+	(void) memset(&h->mbtmp, 0, sizeof(h->mbtmp));
+	*p = h;
+	return 0;
+}
+
+
+/* history_def_clear():
+ *	Default history cleanup function
+ */
+/* ARGSUSED */
+static void
+history_def_clear(void *p, TYPE(HistEvent) *ev __attribute__((__unused__)))
+{
+	history_t *h = (history_t *) p;
+	HistEventPrivate *evp;
+	hchunk_t *c;
+	int i;
+
+	for (i = 0; i < h->cur; i++) {
+		evp = (void *)&HENTRY(h, i)->ev;
+		if (HENTRY(h, i)->chunk == NULL)
+			h_free(evp->str);
+		else if (HENTRY(h, i)->chunk == HMB) {
+			h_free(HMBS(h, HENTRY(h, i)));
+			HMBS(h, HENTRY(h, i)) = NULL;
+		}
+	}
+	for (i = 0; i < HVIEWS; i++)
+		h->views[i].num = 0;
+	while ((c = h->chunks) != NULL) {
+		h->chunks = c->next;
+		h_free(c);
+	}
+	h->used = h->dead = 0;
+	h->bytes = 0;
+	for (i = 0; i < HCOLDCACHE; i++) {
+		h_free(h->ccache[i].nums);
+		h->ccache[i].nums = NULL;
+		h->ccache[i].text = NULL;
+		h->ccache[i].b = NULL;
+		h->ccache[i].tick = 0;
+	}
+	for (i = 0; i < h->ncold; i++)
+		h_free(h->cold[i]);
+	h_free(h->cold);
+	h->cold = NULL;
+	h->ncold = h->acold = 0;
+	h->coldnext = 0;
+	if (h->slots != NULL)
+		memset(h->slots, 0, h->nslots * sizeof(*h->slots));
+	h->nhashed = 0;
+	if (h->flags & H_LISTS)
+		history_def_trfree(h);
+	history_def_rkfree(h->ranks);
+	h->ranks = NULL;
+	h->nranks = 0;
+	h_free(h->list);
+	h->list = NULL;
+	h->size = 0;
+	h->start = 0;
+	h->cursor = -1;
+	h->eventid = 0;
+	h->changes++;
+	h->cur = 0;
+	history_def_unmap(h);
+}
+
+
+
 
 /************************************************************************/
 
-/* history_init():
- *	Initialization function.
+/* history_init():
+ *	Initialization function.
+ */
+TYPE(History) *
+FUN(history,init)(void)
+{
+	TYPE(HistEvent) ev;
+	TYPE(History) *h = (TYPE(History) *) h_malloc(sizeof(*h));
+	if (h == NULL)
+		return NULL;
+
+	if (history_def_init(&h->h_ref, &ev, 0) == -1) {
+		h_free(h);
+		return NULL;
+	}
+	h->h_ent = -1;
+	h->h_next = history_def_next;
+	h->h_first = history_def_first;
+	h->h_last = history_def_last;
+	h->h_prev = history_def_prev;
+	h->h_curr = history_def_curr;
+	h->h_set = history_def_set;
+	h->h_clear = history_def_clear;
+	h->h_enter = history_def_enter;
+	h->h_add = history_def_add;
+	h->h_del = history_def_del;
+	h->h_jfd = -1;
+	h->h_jname = NULL;
+	h->h_share = 0;
+	h->h_slast = NULL;
+
+	return h;
+}
+
+
+/* history_end():
+ *	clean up history;
+ */
+void
+FUN(history,end)(TYPE(History) *h)
+{
+	TYPE(HistEvent) ev;
+
+	history_journal_close(h);
+	if (h->h_next == history_def_next) {
+		history_def_clear(h->h_ref, &ev);
+		(void)history_def_seterasedups(h->h_ref, 0);
+		history_def_trfree(h->h_ref);
+		(void)history_def_setranks(h->h_ref, 0);
+		(void)history_def_setmeta(h->h_ref, 0);
+		(void)history_def_setmb(h->h_ref, 0);
+	}
+	h_free(h->h_ref);
+	h_free(h);
+}
+
+
+
+/* history_setsize():
+ *	Set history number of events
+ */
+static int
+history_setsize(TYPE(History) *h, TYPE(HistEvent) *ev, int num)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (num < 0) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
+	}
+	history_def_setsize(h->h_ref, num);
+	return 0;
+}
+
+
+/* history_getsize():
+ *      Get number of events currently in history
+ */
+static int
+history_getsize(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = history_def_getsize(h->h_ref);
+	if (ev->num < -1) {
+		he_seterrev(ev, _HE_SIZE_NEGATIVE);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_setmaxbytes():
+ *	Set the most bytes the strings of the events may take, and the
+ *	most the string of one event may, 0 for no limit.
+ */
+static int
+history_setmaxbytes(TYPE(History) *h, TYPE(HistEvent) *ev, size_t max,
+    size_t entry)
+{
+	history_t *hp = h->h_ref;
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	hp->maxbytes = max;
+	hp->maxentry = entry;
+	return 0;
+}
+
+
+/* history_getmaxbytes():
+ *	Get the most bytes the strings of the events may take, and the
+ *	most the string of one event may.
+ */
+static int
+history_getmaxbytes(TYPE(History) *h, TYPE(HistEvent) *ev, size_t *max,
+    size_t *entry)
+{
+	history_t *hp = h->h_ref;
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (max == NULL || entry == NULL) {
+		he_seterrev(ev, _HE_PARAM_MISSING);
+		return -1;
+	}
+	*max = hp->maxbytes;
+	*entry = hp->maxentry;
+	return 0;
+}
+
+
+/* history_getbytes():
+ *	Get the bytes the strings of the events take.
+ */
+static int
+history_getbytes(TYPE(History) *h, TYPE(HistEvent) *ev, size_t *bytes)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (bytes == NULL) {
+		he_seterrev(ev, _HE_PARAM_MISSING);
+		return -1;
+	}
+	*bytes = HBYTES((history_t *)h->h_ref);
+	return 0;
+}
+
+
+/* history_setcold():
+ *	Set how many of the newest events keep their strings as they
+ *	are, the strings of older ones being packed, or 0 for all.
+ */
+static int
+history_setcold(TYPE(History) *h, TYPE(HistEvent) *ev, int keep)
+{
+	history_t *hp = h->h_ref;
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (keep < 0) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
+	}
+	hp->coldkeep = keep;
+	if ((keep == 0 ? history_def_melt(hp) : history_def_freeze(hp)) == -1) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_getcold():
+ *	Get how many of the newest events are not packed, or 0.
+ */
+static int
+history_getcold(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = ((history_t *)h->h_ref)->coldkeep;
+	return 0;
+}
+
+
+/* history_setmultibyte():
+ *	Set if the strings are kept in the multibyte encoding
+ */
+static int
+history_setmultibyte(TYPE(History) *h, TYPE(HistEvent) *ev, int on)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (history_def_setmb(h->h_ref, on != 0) == -1) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_getmultibyte():
+ *	Get if the strings are kept in the multibyte encoding
+ */
+static int
+history_getmultibyte(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = (((history_t *)h->h_ref)->flags & H_MULTIBYTE) != 0;
+	return 0;
+}
+
+
+/* history_getgeneration():
+ *	Get the number of times an event changed or went, other than
+ *	the oldest one going
+ */
+static int
+history_getgeneration(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = ((history_t *)h->h_ref)->changes;
+	return 0;
+}
+
+
+/* history_setunique():
+ *	Set if adjacent equal events should not be entered in history.
+ */
+static int
+history_setunique(TYPE(History) *h, TYPE(HistEvent) *ev, int uni)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	history_def_setunique(h->h_ref, uni);
+	return 0;
+}
+
+
+/* history_getunique():
+ *	Get if adjacent equal events should not be entered in history.
+ */
+static int
+history_getunique(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = history_def_getunique(h->h_ref);
+	return 0;
+}
+
+
+/* history_seterasedups():
+ *	Set if entering an event should remove older equal events.
+ */
+static int
+history_seterasedups(TYPE(History) *h, TYPE(HistEvent) *ev, int erase)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (history_def_seterasedups(h->h_ref, erase) == -1) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_geterasedups():
+ *	Get if entering an event removes older equal events.
+ */
+static int
+history_geterasedups(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = history_def_geterasedups(h->h_ref);
+	return 0;
+}
+
+
+/* history_settrigrams():
+ *	Set if substrings of the events should be indexed.
+ */
+static int
+history_settrigrams(TYPE(History) *h, TYPE(HistEvent) *ev, int index)
+{
+	history_t *hp = h->h_ref;
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	history_def_trfree(hp);
+	if (index)
+		hp->flags |= H_TRIGRAMS;
+	else
+		hp->flags &= ~H_TRIGRAMS;
+	hp->tdirty = (hp->flags & H_LISTS) != 0;
+	return 0;
+}
+
+
+/* history_gettrigrams():
+ *	Get if substrings of the events are indexed.
+ */
+static int
+history_gettrigrams(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = history_def_gettrigrams(h->h_ref);
+	return 0;
+}
+
+
+/* history_setprefixes():
+ *	Set if prefixes of the events should be indexed.
+ */
+static int
+history_setprefixes(TYPE(History) *h, TYPE(HistEvent) *ev, int index)
+{
+	history_t *hp = h->h_ref;
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	history_def_trfree(hp);
+	if (index)
+		hp->flags |= H_PREFIXES;
+	else
+		hp->flags &= ~H_PREFIXES;
+	hp->tdirty = (hp->flags & H_LISTS) != 0;
+	return 0;
+}
+
+
+/* history_getprefixes():
+ *	Get if prefixes of the events are indexed.
+ */
+static int
+history_getprefixes(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = history_def_getprefixes(h->h_ref);
+	return 0;
+}
+
+
+/* history_substr():
+ *	Find the closest event containing str, starting from the current
+ *	one and going towards older events if older is set
+ */
+static int
+history_substr(TYPE(History) *h, TYPE(HistEvent) *ev, const Char *str,
+    int older, int *moved)
+{
+	int retval, n;
+
+	if (str == NULL) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
+	}
+	if (h->h_next == history_def_next)
+		return history_def_substr(h->h_ref, ev, str, older, moved);
+
+	for (n = 0, retval = HCURR(h, ev); retval != -1;
+	    n++, retval = older ? HNEXT(h, ev) : HPREV(h, ev))
+		if (Strstr(ev->str, str) != NULL) {
+			if (moved)
+				*moved = n;
+			return 0;
+		}
+
+	he_seterrev(ev, _HE_NOT_FOUND);
+	return -1;
+}
+
+
+/* history_setarena():
+ *	Set if the strings of new events should be stored in chunks.
+ */
+static int
+history_setarena(TYPE(History) *h, TYPE(HistEvent) *ev, int arena)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	history_def_setarena(h->h_ref, arena);
+	return 0;
+}
+
+
+/* history_getarena():
+ *	Get if the strings of new events are stored in chunks.
+ */
+static int
+history_getarena(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = history_def_getarena(h->h_ref);
+	return 0;
+}
+
+
+/* history_setfrecency():
+ *	Set the half-life in seconds of the uses of the strings ranked
+ *	by history_frecent(), 0 to stop ranking them.
+ */
+static int
+history_setfrecency(TYPE(History) *h, TYPE(HistEvent) *ev, int halflife)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (halflife < 0) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
+	}
+	if (history_def_setranks(h->h_ref, halflife) == -1) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_getfrecency():
+ *	Get the half-life of the uses of the ranked strings, or 0.
+ */
+static int
+history_getfrecency(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = ((history_t *)h->h_ref)->halflife;
+	return 0;
+}
+
+
+/* history_setmeta():
+ *	Start or stop keeping the time, duration, status and directory
+ *	of the events entered.
+ */
+static int
+history_setmeta(TYPE(History) *h, TYPE(HistEvent) *ev, int on)
+{
+
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (history_def_setmeta(h->h_ref, on != 0) == -1) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* history_getmeta():
+ *	Get if what is known of the events is kept
+ */
+static int
+history_getmeta(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+	if (h->h_next != history_def_next) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	ev->num = (((history_t *)h->h_ref)->flags & H_META) != 0;
+	return 0;
+}
+
+
+/* history_metaslot():
+ *	Return the slot of what is known of event num, or -1
+ */
+static int
+history_metaslot(TYPE(History) *h, TYPE(HistEvent) *ev, int num)
+{
+	history_t *hp = h->h_ref;
+	int i;
+
+	if (h->h_next != history_def_next || (hp->flags & H_META) == 0) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if ((i = history_def_find(hp, num)) == -1) {
+		he_seterrev(ev, _HE_NOT_FOUND);
+		return -1;
+	}
+	return HSLOT(hp, i);
+}
+
+
+/* history_setevmeta():
+ *	Set what is known of event num
+ */
+static int
+history_setevmeta(TYPE(History) *h, TYPE(HistEvent) *ev, int num,
+    const HistMeta *meta)
+{
+	history_t *hp = h->h_ref;
+	int n, cwd = -1;
+
+	if (meta == NULL) {
+		he_seterrev(ev, _HE_PARAM_MISSING);
+		return -1;
+	}
+	if ((n = history_metaslot(h, ev, num)) == -1)
+		return -1;
+	if (meta->cwd != NULL &&
+	    (cwd = history_def_dir(hp, meta->cwd, 1)) == -1) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	hp->mtime[n] = meta->time;
+	hp->mdur[n] = meta->duration;
+	hp->mstatus[n] = meta->status;
+	hp->mcwd[n] = cwd;
+	return 0;
+}
+
+
+/* history_getevmeta():
+ *	Get what is known of event num; the directory stays valid until
+ *	the fields stop being kept
+ */
+static int
+history_getevmeta(TYPE(History) *h, TYPE(HistEvent) *ev, int num,
+    HistMeta *meta)
+{
+	history_t *hp = h->h_ref;
+	int n;
+
+	if (meta == NULL) {
+		he_seterrev(ev, _HE_PARAM_MISSING);
+		return -1;
+	}
+	if ((n = history_metaslot(h, ev, num)) == -1)
+		return -1;
+	meta->time = hp->mtime[n];
+	meta->duration = hp->mdur[n];
+	meta->status = hp->mstatus[n];
+	meta->cwd = hp->mcwd[n] == -1 ? NULL : hp->mdirs[hp->mcwd[n]];
+	return 0;
+}
+
+
+/* history_setfilter():
+ *	Make the searches skip the events not matching f, or none if
+ *	f is NULL. A directory never seen matches no event.
+ */
+static int
+history_setfilter(TYPE(History) *h, TYPE(HistEvent) *ev,
+    const HistFilter *f)
+{
+	history_t *hp = h->h_ref;
+
+	if (h->h_next != history_def_next || (hp->flags & H_META) == 0) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (f == NULL) {
+		hp->fon = 0;
+		return 0;
+	}
+	hp->fsince = f->since;
+	hp->fstatus = f->status;
+	hp->fcwd = -1;
+	if (f->cwd != NULL && (hp->fcwd = history_def_dir(hp, f->cwd, 0)) == -1)
+		hp->fcwd = -2;
+	hp->fon = 1;
+	return 0;
+}
+
+
+/* history_frecent():
+ *	Get the n distinct strings starting with str used most often
+ *	and most recently, best first.
+ */
+static int
+history_frecent(TYPE(History) *h, TYPE(HistEvent) *ev, const Char *str,
+    const Char **lines, int n)
+{
+
+	if (h->h_next != history_def_next ||
+	    (((history_t *)h->h_ref)->flags & H_RANKED) == 0) {
+		he_seterrev(ev, _HE_NOT_ALLOWED);
+		return -1;
+	}
+	if (str == NULL || (lines == NULL && n > 0)) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
+	}
+	return history_def_top(h->h_ref, ev, str, lines, n);
+}
+
+
+/* history_set_fun():
+ *	Set history functions
+ */
+static int
+history_set_fun(TYPE(History) *h, TYPE(History) *nh)
+{
+	TYPE(HistEvent) ev;
+
+	if (nh->h_first == NULL || nh->h_next == NULL || nh->h_last == NULL ||
+	    nh->h_prev == NULL || nh->h_curr == NULL || nh->h_set == NULL ||
+	    nh->h_enter == NULL || nh->h_add == NULL || nh->h_clear == NULL ||
+	    nh->h_del == NULL || nh->h_ref == NULL) {
+		if (h->h_next != history_def_next) {
+			if (history_def_init(&h->h_ref, &ev, 0) == -1)
+				return -1;
+			h->h_first = history_def_first;
+			h->h_next = history_def_next;
+			h->h_last = history_def_last;
+			h->h_prev = history_def_prev;
+			h->h_curr = history_def_curr;
+			h->h_set = history_def_set;
+			h->h_clear = history_def_clear;
+			h->h_enter = history_def_enter;
+			h->h_add = history_def_add;
+			h->h_del = history_def_del;
+		}
+		return -1;
+	}
+	if (h->h_next == history_def_next)
+		history_def_clear(h->h_ref, &ev);
+
+	h->h_ent = -1;
+	h->h_first = nh->h_first;
+	h->h_next = nh->h_next;
+	h->h_last = nh->h_last;
+	h->h_prev = nh->h_prev;
+	h->h_curr = nh->h_curr;
+	h->h_set = nh->h_set;
+	h->h_clear = nh->h_clear;
+	h->h_enter = nh->h_enter;
+	h->h_add = nh->h_add;
+	h->h_del = nh->h_del;
+
+	return 0;
+}
+
+
+#define	HLOADMIN	(1 << 20)	/* Fewest bytes worth more threads */
+#define	HLOADTHREADS	8		/* Most threads decoding a file	*/
+
+typedef struct hload_t {
+	const char *lo, *hi;	/* Whole lines to decode		*/
+	Char *buf;		/* Decoded lines, NUL terminated	*/
+	size_t used;		/* Characters used in buf		*/
+	size_t size;		/* Characters allocated			*/
+	int lines;		/* Lines read				*/
+	int err;		/* Out of memory			*/
+} hload_t;
+
+
+/* history_load_fp():
+ *	Enter the lines of a history file that cannot be mapped
+ */
+static int
+history_load_fp(TYPE(History) *h, FILE *fp)
+{
+	char *line;
+	size_t llen;
+	ssize_t sz;
+	size_t max_size;
+	char *ptr;
+	int i = -1;
+	TYPE(HistEvent) ev;
+	Char *decode_result;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	line = NULL;
+	llen = 0;
+	if ((sz = getline(&line, &llen, fp)) == -1)
+		goto done;
+
+	if (strncmp(line, hist_cookie, (size_t)sz) != 0)
+		goto done;
+
+	ptr = h_malloc((max_size = 1024) * sizeof(*ptr));
+	if (ptr == NULL)
+		goto done;
+	for (i = 0; (sz = getline(&line, &llen, fp)) != -1; i++) {
+		if (sz > 0 && line[sz - 1] == '\n')
+			line[--sz] = '\0';
+		if (max_size < (size_t)sz) {
+			char *nptr;
+			max_size = ((size_t)sz + 1024) & (size_t)~1023;
+			nptr = h_realloc(ptr, max_size * sizeof(*ptr));
+			if (nptr == NULL) {
+				i = -1;
+				goto oomem;
+			}
+			ptr = nptr;
+		}
+		(void) strunvis(ptr, line);
+		decode_result = edited_ct_decode_string(ptr, &conv);
+		if (decode_result == NULL)
+			continue;
+		if ((h->h_next == history_def_next ?
+		    history_def_append(h->h_ref, &ev, decode_result,
+			Strlen(decode_result)) :
+		    HENTER(h, &ev, decode_result)) == -1) {
+			i = -1;
+			goto oomem;
+		}
+	}
+oomem:
+	h_free(ptr);
+done:
+	free(line);
+	return i;
+}
+
+
+/* history_load_slice():
+ *	Unvis and decode the lines of a slice of a mapped history
+ *	file into its buffer. Lines without a backslash need no
+ *	unvis and are decoded straight from the map. Runs on its
+ *	own thread, so it only touches the slice.
+ */
+static void *
+history_load_slice(void *arg)
+{
+	hload_t *c = arg;
+	const char *p, *e, *src;
+	char *line = NULL, *nptr;
+	size_t len, max_size = 0;
+	Char *nbuf;
+#ifndef NARROWCHAR
+	mbstate_t mbs;
+	size_t n;
+#endif
+
+	for (p = c->lo; p < c->hi; p = e + 1, c->lines++) {
+		if ((e = memchr(p, '\n', (size_t)(c->hi - p))) == NULL)
+			e = c->hi;
+		len = (size_t)(e - p);
+		if (c->used + len + 1 > c->size) {
+			c->size = (c->used + len + 1) * 2;
+			nbuf = h_realloc(c->buf, c->size * sizeof(*nbuf));
+			if (nbuf == NULL)
+				goto oomem;
+			c->buf = nbuf;
+		}
+		src = p;
+		if (memchr(p, '\\', len) != NULL) {
+			if (max_size <= len) {
+				max_size = (len + 1024) & (size_t)~1023;
+				if ((nptr = h_realloc(line, max_size)) == NULL)
+					goto oomem;
+				line = nptr;
+			}
+			(void) memcpy(line, p, len);
+			line[len] = '\0';
+#ifdef NARROWCHAR
+			(void) strunvis(c->buf + c->used, line);
+			c->used += strlen(c->buf + c->used) + 1;
+			continue;
+#else
+			(void) strunvis(line, line);	/* never grows */
+			src = line;
+			len = strlen(line);
+#endif
+		}
+#ifdef NARROWCHAR
+		(void) memcpy(c->buf + c->used, src, len);
+		c->buf[c->used + len] = '\0';
+		c->used += strlen(c->buf + c->used) + 1;
+#else
+		(void) memset(&mbs, 0, sizeof(mbs));
+		n = mbsnrtowcs(c->buf + c->used, &src, len, len + 1, &mbs);
+		if (n == (size_t)-1 || !mbsinit(&mbs))
+			continue;	/* not in this locale, skip it */
+		c->buf[c->used + n] = '\0';
+		c->used += n + 1;
+#endif
+	}
+	goto done;
+oomem:
+	c->err = 1;
+done:
+	h_free(line);
+	return NULL;
+}
+
+
+/* history_load():
+ *	TYPE(History) load function. A regular file is mapped and its
+ *	lines decoded in slices, in parallel when there are several
+ *	processors, then entered in order. When the events dropped
+ *	once the size is reached are known in advance, their lines are
+ *	only counted. Binary files are left to history_load_bin().
+ */
+static int
+history_load(TYPE(History) *h, const char *fname)
+{
+	hload_t c[HLOADTHREADS];
+	TYPE(HistEvent) ev;
+	struct stat st;
+	const char *base, *p, *q, *start, *end;
+	void *map;
+	FILE *fp;
+	Char *s;
+	size_t len;
+	int fd, i = 0, t, nt = 1, keep = -1, k, id0 = 0;
+#ifdef _REENTRANT
+	pthread_t tid[HLOADTHREADS];
+	int started[HLOADTHREADS];
+	long ncpu;
+#endif
+
+	if ((fd = open(fname, O_RDONLY)) == -1)
+		return -1;
+	if (h->h_next == history_def_next)
+		id0 = ((history_t *)h->h_ref)->eventid;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	    (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+	    fd, 0)) == MAP_FAILED) {
+		if ((fp = fdopen(fd, "r")) == NULL) {
+			(void) close(fd);
+			return -1;
+		}
+		i = history_load_fp(h, fp);
+		(void) fclose(fp);
+		goto ranks;
+	}
+	(void) close(fd);
+	if ((size_t)st.st_size >= sizeof(hbinhead_t) &&
+	    memcmp(map, bin_cookie, sizeof(bin_cookie) - 1) == 0) {
+		i = history_load_bin(h, map, (size_t)st.st_size);
+		goto ranks;
+	}
+	base = map;
+	end = base + st.st_size;
+
+	if ((p = memchr(base, '\n', (size_t)(end - base))) != NULL)
+		p++;
+	else
+		p = end;
+	if (strncmp(base, hist_cookie, (size_t)(p - base)) != 0) {
+		(void) munmap(map, (size_t)st.st_size);
+		return -1;
+	}
+
+	/*
+	 * without merging duplicates or dropping long lines, only the
+	 * last max lines stay
+	 */
+	if (h->h_next == history_def_next &&
+	    (((history_t *)h->h_ref)->flags & (H_UNIQUE | H_ERASEDUPS)) == 0 &&
+	    ((history_t *)h->h_ref)->maxentry == 0)
+		keep = ((history_t *)h->h_ref)->max;
+	start = p;
+	if (keep == 0)
+		start = end;
+	else if (keep > 0) {
+		q = end;
+		if (q > p && q[-1] == '\n')
+			q--;
+		for (k = 0; k < keep && q > p; k++)
+			while (--q > p && *q != '\n')
+				continue;
+		if (q > p)
+			start = q + 1;
+	}
+	for (q = p; q < start; q++, i++)
+		if ((q = memchr(q, '\n', (size_t)(start - q))) == NULL)
+			break;
+	/* the lines skipped still number their events */
+	if (i > 0)
+		((history_t *)h->h_ref)->eventid += i;
+
+#ifdef _REENTRANT
+	if (end - start >= HLOADMIN &&
+	    (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 1)
+		nt = ncpu < HLOADTHREADS ? (int)ncpu : HLOADTHREADS;
+#endif
+	for (t = 0, q = start; t < nt; t++) {
+		(void) memset(&c[t], 0, sizeof(c[t]));
+		c[t].lo = q;
+		q = t == nt - 1 ? end : start + (end - start) * (t + 1) / nt;
+		if (q < c[t].lo)
+			q = c[t].lo;
+		while (q < end && q > c[t].lo && q[-1] != '\n')
+			q++;
+		c[t].hi = q;
+	}
+#ifdef _REENTRANT
+	for (t = 1; t < nt; t++)
+		started[t] = pthread_create(&tid[t], NULL, history_load_slice,
+		    &c[t]) == 0;
+	(void) history_load_slice(&c[0]);
+	for (t = 1; t < nt; t++) {
+		if (started[t])
+			(void) pthread_join(tid[t], NULL);
+		else
+			(void) history_load_slice(&c[t]);
+	}
+#else
+	(void) history_load_slice(&c[0]);
+#endif
+
+	for (t = 0; t < nt; t++) {
+		i = i == -1 || c[t].err ? -1 : i + c[t].lines;
+		for (s = c[t].buf; i != -1 && s < c[t].buf + c[t].used;
+		    s += len + 1) {
+			len = Strlen(s);
+			if ((h->h_next == history_def_next ?
+			    history_def_append(h->h_ref, &ev, s, len) :
+			    HENTER(h, &ev, s)) == -1)
+				i = -1;
+		}
+		h_free(c[t].buf);
+	}
+	(void) munmap(map, (size_t)st.st_size);
+ranks:
+	if (i != -1 && h->h_next == history_def_next &&
+	    (((history_t *)h->h_ref)->flags & H_RANKED) != 0)
+		(void)history_def_loadranks(h->h_ref, fname);
+	if (i != -1 && h->h_next == history_def_next &&
+	    (((history_t *)h->h_ref)->flags & H_META) != 0)
+		(void)history_def_loadmeta(h->h_ref, fname, id0);
+	return i;
+}
+
+/* history_import_zsh():
+ *	Parse the ": start:elapsed;" head of a zsh extended history line
+ */
+static int
+history_import_zsh(const char *line, time_t *t, int *dur, const char **cmd)
+{
+	const char *p = line + 2;
+	char *end;
+	long long start;
+	long elapsed;
+
+	if (line[0] != ':' || line[1] != ' ' || !isdigit((unsigned char)*p))
+		return 0;
+	start = strtoll(p, &end, 10);
+	if (*end++ != ':' || !isdigit((unsigned char)*end))
+		return 0;
+	elapsed = strtol(end, &end, 10);
+	if (*end != ';')
+		return 0;
+	*t = (time_t)start;
+	*dur = elapsed > INT_MAX ? INT_MAX : (int)elapsed;
+	*cmd = end + 1;
+	return 1;
+}
+
+
+/* history_import_stamp():
+ *	Parse a "#seconds" bash timestamp line
+ */
+static int
+history_import_stamp(const char *line, time_t *t)
+{
+	char *end;
+	long long stamp;
+
+	if (line[0] != '#' || !isdigit((unsigned char)line[1]))
+		return 0;
+	stamp = strtoll(line + 1, &end, 10);
+	if (*end != '\0')
+		return 0;
+	*t = (time_t)stamp;
+	return 1;
+}
+
+
+/* history_import_add():
+ *	Append the len bytes of s to the event being read, undoing the
+ *	zsh quoting of bytes if zsh is set
+ */
+static int
+history_import_add(char **buf, size_t *bsz, size_t *blen, const char *s,
+    size_t len, int zsh)
+{
+	const char *end = s + len;
+	char *nbuf, *d;
+	size_t need = *blen + len + 1;
+
+	if (need > *bsz) {
+		need = (need + 1024) & ~(size_t)1023;
+		if ((nbuf = h_realloc(*buf, need)) == NULL)
+			return -1;
+		*buf = nbuf;
+		*bsz = need;
+	}
+	for (d = *buf + *blen; s < end; s++)
+		if (zsh && (unsigned char)*s == HZSHMETA && s + 1 < end)
+			*d++ = (char)(*++s ^ 32);
+		else
+			*d++ = *s;
+	*d = '\0';
+	*blen = (size_t)(d - *buf);
+	return 0;
+}
+
+
+/* history_import_enter():
+ *	Enter the event read, keeping the time and duration it ran
+ *	for if known
+ */
+static int
+history_import_enter(TYPE(History) *h, const char *str, time_t t,
+    int dur)
+{
+	history_t *hp = h->h_ref;
+	TYPE(HistEvent) ev;
+	const Char *s;
+	int n, r;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	if ((s = edited_ct_decode_string(str, &conv)) == NULL || *s == '\0')
+		return 0;
+	if (h->h_next != history_def_next)
+		return HENTER(h, &ev, s) == -1 ? -1 : 1;
+	if ((r = history_def_append(hp, &ev, s, Strlen(s))) != 1)
+		return r;
+	if ((hp->flags & H_META) != 0 && hp->cur > 0) {
+		n = HSLOT(hp, hp->cur - 1);
+		hp->mtime[n] = t;
+		hp->mdur[n] = dur;
+	}
+	return 1;
+}
+
+
+/* history_import():
+ *	Enter the events of the history file of a shell, one line at a
+ *	time: bash, whose "#seconds" lines start timed events of one or
+ *	more lines, zsh, whose ": start:elapsed;" lines start events
+ *	continued by a trailing backslash, or one event per line.
+ *	Return the number of events entered.
+ */
+static int
+history_import(TYPE(History) *h, const char *fname)
+{
+	FILE *fp;
+	char *line = NULL, *buf = NULL;
+	const char *p;
+	size_t llen = 0, bsz = 0, blen = 0, len;
+	ssize_t sz;
+	time_t t = 0, nt;
+	int i = 0, r, dur = -1, ndur, lines = 0, join = 0, more = 0, zsh = 0;
+	int start, stamp;
+
+	if ((fp = fopen(fname, "r")) == NULL)
+		return -1;
+
+	while (i != -1 && (sz = getline(&line, &llen, fp)) != -1) {
+		if (sz > 0 && line[sz - 1] == '\n')
+			line[--sz] = '\0';
+		p = line;
+		start = 1;
+		stamp = 0;
+		if (more)
+			start = 0;	/* the zsh event goes on */
+		else if (history_import_zsh(line, &nt, &ndur, &p))
+			zsh = 1;
+		else if ((stamp = history_import_stamp(line, &nt)) != 0)
+			ndur = -1;
+		else if (join)
+			start = 0;	/* the timed bash event goes on */
+		else {
+			nt = 0;
+			ndur = -1;
+		}
+		if (start) {
+			if (lines > 0 &&
+			    (r = history_import_enter(h, buf, t, dur)) != 0)
+				i = r == -1 ? -1 : i + 1;
+			lines = 0;
+			blen = 0;
+			t = nt;
+			dur = ndur;
+			join = stamp;
+			if (stamp)
+				continue;
+		}
+
+		len = strlen(p);
+		more = zsh && len > 0 && p[len - 1] == '\\' &&
+		    (len < 2 || p[len - 2] != '\\');
+		if ((lines++ > 0 &&
+		    history_import_add(&buf, &bsz, &blen, "\n", 1, 0) == -1) ||
+		    history_import_add(&buf, &bsz, &blen, p, len - (size_t)more,
+		    zsh) == -1)
+			i = -1;
+	}
+	if (i != -1 && lines > 0 &&
+	    (r = history_import_enter(h, buf, t, dur)) != 0)
+		i = r == -1 ? -1 : i + 1;
+
+	free(line);
+	h_free(buf);
+	(void) fclose(fp);
+	return i;
+}
+
+
+/* history_load_bin():
+ *	Load the binary history file mapped at map, which it owns. The
+ *	builtin list keeps the map and enters the events it keeps
+ *	without decoding them when no index needs their strings.
+ */
+static int
+history_load_bin(TYPE(History) *h, char *map, size_t size)
+{
+	history_t *hp = h->h_ref;
+	TYPE(HistEvent) ev;
+	hbinhead_t hd;
+	hbinrec_t rec;
+	hentry_t *c;
+	uint64_t off;
+	Char *buf = NULL, *nbuf;
+	size_t len, bsz = 0;
+	uint32_t r, keep;
+
+	memcpy(&hd, map, sizeof(hd));
+	if (hd.version != HBINVERSION || hd.order != HBINORDER ||
+	    hd.index > size || (size - hd.index) / sizeof(off) < hd.count ||
+	    hd.count > INT_MAX)
+		goto bad;
+
+	if (h->h_next != history_def_next ||
+	    (hp->flags & (H_UNIQUE | H_ERASEDUPS | H_LISTS | H_RANKED)) != 0 ||
+	    hp->maxentry != 0) {
+		for (r = 0; r < hd.count; r++) {
+			memcpy(&off, map + hd.index + r * sizeof(off),
+			    sizeof(off));
+			if (off > size || size - off < sizeof(rec))
+				continue;
+			memcpy(&rec, map + off, sizeof(rec));
+			if (size - off - sizeof(rec) < rec.bytes)
+				continue;
+			if (rec.bytes + 1 > bsz) {
+				bsz = rec.bytes + 1;
+				if ((nbuf = h_realloc(buf, bsz * sizeof(*buf)))
+				    == NULL)
+					goto oomem;
+				buf = nbuf;
+			}
+			len = history_bin_decode(map + off + sizeof(rec), &rec,
+			    buf);
+			if (len == (size_t)-1)
+				continue;
+			if ((h->h_next == history_def_next ?
+			    history_def_append(hp, &ev, buf, len) :
+			    HENTER(h, &ev, buf)) == -1)
+				goto oomem;
+		}
+		h_free(buf);
+		(void) munmap(map, size);
+		return (int)hd.count;
+	}
+
+	keep = hd.count < (uint32_t)hp->max ? hd.count : (uint32_t)hp->max;
+	if (keep == 0) {
+		(void) munmap(map, size);
+		return (int)hd.count;
+	}
+	/* the events still lazy from an earlier file are decoded */
+	for (r = 0; hp->lazy > 0 && r < (uint32_t)hp->cur; r++)
+		if (history_def_entry(hp, (int)r) == NULL)
+			goto oomem;
+	while (hp->cur > 0 && (uint32_t)hp->cur > (uint32_t)hp->max - keep)
+		history_def_delete(hp, &ev, 0);
+	if (history_def_grow(hp, hp->cur + (int)keep) == -1)
+		goto oomem;
+	for (r = 0; r < keep; r++) {
+		if (hp->flags & H_META)
+			history_def_mreset(hp, hp->cur, 0);
+		c = HENTRY(hp, hp->cur++);
+		c->ev.str = NULL;
+		c->ev.num = ++hp->eventid;
+		c->data = NULL;
+		c->chunk = NULL;
+	}
+	hp->cursor = hp->cur - 1;
+	hp->map = map;
+	hp->mapsize = size;
+	hp->mapindex = (size_t)hd.index;
+	hp->mapfirst = hp->eventid - (int)hd.count + 1;
+	hp->lazy = (int)keep;
+	/* their records are contiguous, up to the offsets */
+	memcpy(&off, map + hd.index + (hd.count - keep) * sizeof(off),
+	    sizeof(off));
+	if (off <= hd.index && hd.index - off >= keep * sizeof(hbinrec_t))
+		hp->bytes += (size_t)(hd.index - off) - keep * sizeof(hbinrec_t);
+	history_def_trim(hp, &ev);
+	return (int)hd.count;
+oomem:
+	h_free(buf);
+bad:
+	(void) munmap(map, size);
+	return -1;
+}
+
+
+/* history_save_bin():
+ *	Save the history in fname as a binary file. The file is written
+ *	aside and renamed, as the old one may be mapped. Events still
+ *	lazy are copied without decoding them.
+ */
+static int
+history_save_bin(TYPE(History) *h, const char *fname)
+{
+	history_t *hp = h->h_ref;
+	TYPE(HistEvent) ev;
+	hbinhead_t hd;
+	hbinrec_t rec;
+	hentry_t *e;
+	FILE *fp;
+	uint64_t *idx = NULL, *nidx;
+	const char *str;
+	char *tmp;
+	size_t len, n = 0, nsz = 0;
+	int fd, i = 0, retval;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	len = strlen(fname) + sizeof(".XXXXXX");
+	if ((tmp = h_malloc(len)) == NULL)
+		return -1;
+	(void) snprintf(tmp, len, "%s.XXXXXX", fname);
+	if ((fd = mkstemp(tmp)) == -1) {
+		h_free(tmp);
+		return -1;
+	}
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void) close(fd);
+		goto fail;
+	}
+
+	(void) memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, bin_cookie, sizeof(hd.magic));
+	hd.version = HBINVERSION;
+	hd.order = HBINORDER;
+	if (fwrite(&hd, sizeof(hd), 1, fp) != 1)
+		goto close;
+
+	if (h->h_next == history_def_next)
+		retval = hp->cur > 0 ? 0 : -1;
+	else
+		retval = HLAST(h, &ev);
+	for (; retval != -1; i++) {
+		if (h->h_next == history_def_next &&
+		    (e = HENTRY(hp, i))->chunk == HMB) {
+			str = HMBS(hp, e)->s;
+			rec.bytes = (uint32_t)HMBS(hp, e)->bytes;
+		} else if (h->h_next == history_def_next &&
+		    e->ev.str == NULL && e->chunk != HCOLD) {
+			if ((str = history_def_lazyrec(hp, e, &rec)) == NULL)
+				goto next;
+		} else {
+			if (h->h_next == history_def_next) {
+				if ((e = history_def_entry(hp, i)) == NULL)
+					goto close;
+				ev = e->ev;
+			}
+			if ((str = edited_ct_encode_string(ev.str, &conv))
+			    == NULL)
+				goto next;
+			rec.bytes = (uint32_t)strlen(str);
+		}
+		if (n == nsz) {
+			nsz = nsz ? nsz * 2 : 1024;
+			if ((nidx = h_realloc(idx, nsz * sizeof(*idx))) == NULL)
+				goto close;
+			idx = nidx;
+		}
+		idx[n++] = (uint64_t)ftello(fp);
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+		    fwrite(str, 1, rec.bytes, fp) != rec.bytes)
+			goto close;
+next:
+		if (h->h_next == history_def_next)
+			retval = i + 1 < hp->cur ? 0 : -1;
+		else
+			retval = HPREV(h, &ev);
+	}
+
+	hd.count = (uint32_t)n;
+	hd.index = (uint64_t)ftello(fp);
+	if ((n > 0 && fwrite(idx, sizeof(*idx), n, fp) != n) ||
+	    fseeko(fp, 0, SEEK_SET) == -1 ||
+	    fwrite(&hd, sizeof(hd), 1, fp) != 1 ||
+	    fflush(fp) == EOF || fsync(fd) == -1)
+		goto close;
+	if (fclose(fp) == EOF || rename(tmp, fname) == -1)
+		goto fail;
+	h_free(idx);
+	h_free(tmp);
+	if (h->h_next == history_def_next && (hp->flags & H_RANKED) != 0 &&
+	    history_def_saveranks(hp, fname) == -1)
+		return -1;
+	if (h->h_next == history_def_next && (hp->flags & H_META) != 0 &&
+	    history_def_savemeta(hp, fname) == -1)
+		return -1;
+	return (int)n;
+close:
+	(void) fclose(fp);
+fail:
+	(void) unlink(tmp);
+	h_free(idx);
+	h_free(tmp);
+	return -1;
+}
+
+
+/* history_save_fp():
+ *	TYPE(History) save function
+ */
+static int
+history_save_fp(TYPE(History) *h, size_t nelem, FILE *fp)
+{
+	TYPE(HistEvent) ev;
+	int i = -1, retval;
+	size_t len, max_size;
+	char *ptr;
+	const char *str;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	if (ftell(fp) == 0 && fputs(hist_cookie, fp) == EOF)
+		goto done;
+	ptr = h_malloc((max_size = 1024) * sizeof(*ptr));
+	if (ptr == NULL)
+		goto done;
+	if (nelem != (size_t)-1) {
+		for (retval = HFIRST(h, &ev); retval != -1 && nelem-- > 0;
+		    retval = HNEXT(h, &ev))
+			continue;
+	} else
+		retval = -1;
+
+	if (retval == -1)
+		retval = HLAST(h, &ev);
+
+	for (i = 0; retval != -1; retval = HPREV(h, &ev), i++) {
+		str = edited_ct_encode_string(ev.str, &conv);
+		len = strlen(str) * 4 + 1;
+		if (len > max_size) {
+			char *nptr;
+			max_size = (len + 1024) & (size_t)~1023;
+			nptr = h_realloc(ptr, max_size * sizeof(*ptr));
+			if (nptr == NULL) {
+				i = -1;
+				goto oomem;
+			}
+			ptr = nptr;
+		}
+		(void) strvis(ptr, str, VIS_WHITE);
+		(void) fprintf(fp, "%s\n", ptr);
+	}
+oomem:
+	h_free(ptr);
+done:
+	return i;
+}
+
+
+/* history_save():
+ *    History save function
  */
-TYPE(History) *
-FUN(history,init)(void)
+static int
+history_save(TYPE(History) *h, const char *fname)
 {
-	TYPE(HistEvent) ev;
-	TYPE(History) *h = (TYPE(History) *) h_malloc(sizeof(*h));
-	if (h == NULL)
-		return NULL;
+    FILE *fp;
+    int i;
 
-	if (history_def_init(&h->h_ref, &ev, 0) == -1) {
-		h_free(h);
-		return NULL;
+    if ((i = open(fname, O_WRONLY|O_CREAT|O_TRUNC,
+		S_IRUSR|S_IWUSR)) == -1)
+	return -1;
+
+    if ((fp = fdopen(i, "w")) == NULL)
+	return -1;
+
+    i = history_save_fp(h, (size_t)-1, fp);
+
+    (void) fclose(fp);
+    if (i != -1 && h->h_next == history_def_next &&
+	(((history_t *)h->h_ref)->flags & H_RANKED) != 0 &&
+	history_def_saveranks(h->h_ref, fname) == -1)
+	i = -1;
+    if (i != -1 && h->h_next == history_def_next &&
+	(((history_t *)h->h_ref)->flags & H_META) != 0 &&
+	history_def_savemeta(h->h_ref, fname) == -1)
+	i = -1;
+    return i;
+}
+
+
+#define	HJOURNALOPEN	(O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC)
+
+/* history_setjournal():
+ *	Append every event entered to the history file fname from now
+ *	on, syncing it to disk every sync events, or stop if fname is
+ *	NULL
+ */
+static int
+history_setjournal(TYPE(History) *h, TYPE(HistEvent) *ev, const char *fname,
+    int sync)
+{
+	char *name;
+	int fd;
+
+	if (sync < 0) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
 	}
-	h->h_ent = -1;
-	h->h_next = history_def_next;
-	h->h_first = history_def_first;
-	h->h_last = history_def_last;
-	h->h_prev = history_def_prev;
-	h->h_curr = history_def_curr;
-	h->h_set = history_def_set;
-	h->h_clear = history_def_clear;
-	h->h_enter = history_def_enter;
-	h->h_add = history_def_add;
-	h->h_del = history_def_del;
+	history_journal_close(h);
+	if (fname == NULL)
+		return 0;
+	if ((name = strdup(fname)) == NULL) {
+		he_seterrev(ev, _HE_MALLOC_FAILED);
+		return -1;
+	}
+	if ((fd = open(name, HJOURNALOPEN, S_IRUSR|S_IWUSR)) == -1) {
+		free(name);
+		he_seterrev(ev, _HE_HIST_WRITE);
+		return -1;
+	}
+	h->h_jfd = fd;
+	h->h_jname = name;
+	h->h_jsync = sync;
+	h->h_jdirty = 0;
+	h->h_jlines = 0;
+	h->h_jend = 0;
+	return 0;
+}
 
-	return h;
+
+/* history_getjournal():
+ *	Get the events between syncs of the journal, -1 if none
+ */
+static int
+history_getjournal(TYPE(History) *h, TYPE(HistEvent) *ev)
+{
+
+	ev->num = h->h_jfd == -1 ? -1 : h->h_jsync;
+	return 0;
 }
 
 
-/* history_end():
- *	clean up history;
+/* history_journal_close():
+ *	Sync and close the journal
  */
-void
-FUN(history,end)(TYPE(History) *h)
+static void
+history_journal_close(TYPE(History) *h)
 {
-	TYPE(HistEvent) ev;
 
-	if (h->h_next == history_def_next)
-		history_def_clear(h->h_ref, &ev);
-	h_free(h->h_ref);
-	h_free(h);
+	if (h->h_jfd == -1)
+		return;
+	if (h->h_jdirty > 0)
+		(void) fsync(h->h_jfd);
+	(void) close(h->h_jfd);
+	free(h->h_jname);
+	h->h_jfd = -1;
+	h->h_jname = NULL;
+	h->h_share = 0;
+	h_free(h->h_slast);
+	h->h_slast = NULL;
+}
+
+
+/* history_journal_count():
+ *	Count the lines of the journal open on fd from *off to its end,
+ *	which becomes the new *off
+ */
+static int
+history_journal_count(int fd, off_t *off)
+{
+	char buf[8192];
+	const char *p, *e;
+	ssize_t n;
+	int lines = 0;
+
+	while ((n = pread(fd, buf, sizeof(buf), *off)) > 0) {
+		for (p = buf, e = buf + n;
+		    (p = memchr(p, '\n', (size_t)(e - p))) != NULL; p++)
+			lines++;
+		*off += n;
+	}
+	return lines;
 }
 
 
+/* history_journal_lock():
+ *	Lock the journal against the other processes appending to it.
+ *	When one of them compacted it meanwhile, the name is now that
+ *	of a new file, so follow it. Only the lines the others added
+ *	since the last lock are counted.
+ */
+static int
+history_journal_lock(TYPE(History) *h)
+{
+	struct stat st, fst;
+	int fd;
+
+	for (;;) {
+		if (flock(h->h_jfd, LOCK_EX) == -1)
+			return -1;
+		if (fstat(h->h_jfd, &fst) == -1)
+			goto fail;
+		if (stat(h->h_jname, &st) == 0 && st.st_dev == fst.st_dev &&
+		    st.st_ino == fst.st_ino)
+			break;
+		if ((fd = open(h->h_jname, HJOURNALOPEN, S_IRUSR|S_IWUSR))
+		    == -1)
+			goto fail;
+		(void) close(h->h_jfd);
+		h->h_jfd = fd;
+		h->h_jlines = 0;
+		h->h_jend = 0;
+	}
+	if (fst.st_size < h->h_jend) {		/* truncated */
+		h->h_jlines = 0;
+		h->h_jend = 0;
+	}
+	if (fst.st_size == 0 && write(h->h_jfd, hist_cookie,
+	    sizeof(hist_cookie) - 1) != (ssize_t)sizeof(hist_cookie) - 1)
+		goto fail;
+	h->h_jlines += history_journal_count(h->h_jfd, &h->h_jend);
+	return 0;
+fail:
+	(void) flock(h->h_jfd, LOCK_UN);
+	return -1;
+}
+
 
-/* history_setsize():
- *	Set history number of events
+/* history_journal_compact():
+ *	With the journal locked, write the events a load of it keeps
+ *	to a new file and rename that over it
  */
 static int
-history_setsize(TYPE(History) *h, TYPE(HistEvent) *ev, int num)
+history_journal_compact(TYPE(History) *h)
 {
+	history_t *o = h->h_ref;
+	TYPE(History) *t;
+	struct stat st;
+	FILE *fp;
+	char *tmp = NULL;
+	size_t len;
+	int fd, n = -1;
 
-	if (h->h_next != history_def_next) {
-		he_seterrev(ev, _HE_NOT_ALLOWED);
+	if ((t = FUN(history,init)()) == NULL)
 		return -1;
+	history_def_setsize(t->h_ref, o->max);
+	((history_t *)t->h_ref)->flags |= o->flags & H_UNIQUE;
+	if ((o->flags & H_ERASEDUPS) != 0 &&
+	    history_def_seterasedups(t->h_ref, 1) == -1)
+		goto done;
+	if (history_load(t, h->h_jname) == -1)
+		goto done;
+
+	len = strlen(h->h_jname) + sizeof(".XXXXXX");
+	if ((tmp = h_malloc(len)) == NULL)
+		goto done;
+	(void) snprintf(tmp, len, "%s.XXXXXX", h->h_jname);
+	if ((fd = mkstemp(tmp)) == -1)
+		goto done;
+	if (fstat(h->h_jfd, &st) == 0)
+		(void) fchmod(fd, st.st_mode & 0777);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void) close(fd);
+		(void) unlink(tmp);
+		goto done;
 	}
-	if (num < 0) {
-		he_seterrev(ev, _HE_BAD_PARAM);
+	n = history_save_fp(t, (size_t)-1, fp);
+	if (fflush(fp) == EOF || fsync(fd) == -1)
+		n = -1;
+	if (fclose(fp) == EOF)
+		n = -1;
+	if (n == -1 || rename(tmp, h->h_jname) == -1) {
+		(void) unlink(tmp);
+		n = -1;
+		goto done;
+	}
+	/*
+	 * closing the old file unlocks it for the waiting processes, so
+	 * the new one is locked and measured first
+	 */
+	if ((fd = open(h->h_jname, HJOURNALOPEN, S_IRUSR|S_IWUSR)) != -1) {
+		if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
+			(void) close(fd);
+			fd = -1;
+		} else {
+			(void) close(h->h_jfd);
+			h->h_jfd = fd;
+		}
+	}
+	h->h_jlines = n + 1;		/* and the cookie */
+	h->h_jend = fd != -1 ? st.st_size : 0;
+	if (h->h_jend == 0)
+		h->h_jlines = 0;
+	else if (h->h_share) {
+		/* it holds nothing not entered yet */
+		h->h_soff = h->h_jend;
+		h->h_sdev = st.st_dev;
+		h->h_sino = st.st_ino;
+	}
+	h->h_jdirty = 0;
+done:
+	h_free(tmp);
+	FUN(history,end)(t);
+	return n;
+}
+
+
+/* history_journal():
+ *	Append str to the journal as one record with a single write,
+ *	and compact the journal once it holds twice the events kept;
+ *	the caller holds the lock
+ */
+static int
+history_journal(TYPE(History) *h, const Char *str)
+{
+	const char *s;
+	char *buf;
+	size_t len, off;
+	ssize_t n;
+	int max, rv = -1;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	if ((s = edited_ct_encode_string(str, &conv)) == NULL)
 		return -1;
+	if ((buf = h_malloc(strlen(s) * 4 + 2)) == NULL)
+		return -1;
+	len = (size_t)strvis(buf, s, VIS_WHITE);
+	buf[len++] = '\n';
+	for (off = 0; off < len; off += (size_t)n)
+		if ((n = write(h->h_jfd, buf + off, len - off)) == -1)
+			goto done;
+	if (h->h_jsync > 0 && ++h->h_jdirty >= h->h_jsync) {
+		if (fsync(h->h_jfd) == -1)
+			goto done;
+		h->h_jdirty = 0;
 	}
-	history_def_setsize(h->h_ref, num);
-	return 0;
+	rv = 0;
+	h->h_jlines++;
+	h->h_jend += (off_t)len;
+	if (h->h_share) {
+		h->h_soff = h->h_jend;
+		history_share_seen(h, buf, len - 1);
+	}
+	max = h->h_next == history_def_next ?
+	    ((history_t *)h->h_ref)->max : 0;
+	if (h->h_jlines > 2 * max && max > 0)
+		(void) history_journal_compact(h);
+done:
+	h_free(buf);
+	return rv;
 }
 
 
-/* history_getsize():
- *      Get number of events currently in history
+/* history_setshare():
+ *	Start or stop entering the events other processes append to
+ *	the journal
  */
 static int
-history_getsize(TYPE(History) *h, TYPE(HistEvent) *ev)
+history_setshare(TYPE(History) *h, TYPE(HistEvent) *ev, int share)
 {
-	if (h->h_next != history_def_next) {
+	struct stat st;
+
+	if (h->h_jfd == -1) {
 		he_seterrev(ev, _HE_NOT_ALLOWED);
 		return -1;
 	}
-	ev->num = history_def_getsize(h->h_ref);
-	if (ev->num < -1) {
-		he_seterrev(ev, _HE_SIZE_NEGATIVE);
+	h->h_share = 0;
+	h_free(h->h_slast);
+	h->h_slast = NULL;
+	if (!share)
+		return 0;
+	if (stat(h->h_jname, &st) == -1) {
+		he_seterrev(ev, _HE_HIST_READ);
 		return -1;
 	}
+	h->h_soff = st.st_size;
+	h->h_sdev = st.st_dev;
+	h->h_sino = st.st_ino;
+	h->h_share = 1;
 	return 0;
 }
 
 
-/* history_setunique():
- *	Set if adjacent equal events should not be entered in history.
+/* history_getshare():
+ *	Get if the events others journal are entered
  */
 static int
-history_setunique(TYPE(History) *h, TYPE(HistEvent) *ev, int uni)
+history_getshare(TYPE(History) *h, TYPE(HistEvent) *ev)
 {
 
-	if (h->h_next != history_def_next) {
-		he_seterrev(ev, _HE_NOT_ALLOWED);
-		return -1;
-	}
-	history_def_setunique(h->h_ref, uni);
+	ev->num = h->h_share;
 	return 0;
 }
 
 
-/* history_getunique():
- *	Get if adjacent equal events should not be entered in history.
+/* history_share_seen():
+ *	Remember the len bytes of rec as the last record entered
+ */
+static void
+history_share_seen(TYPE(History) *h, const char *rec, size_t len)
+{
+	char *nl;
+
+	if ((nl = h_realloc(h->h_slast, len + 2)) == NULL) {
+		h_free(h->h_slast);
+		h->h_slast = NULL;
+		return;
+	}
+	nl[0] = '\n';
+	memcpy(nl + 1, rec, len);
+	nl[len + 1] = '\n';
+	h->h_slast = nl;
+	h->h_slastlen = len + 2;
+}
+
+
+/* history_share_find():
+ *	Find where to go on in the journal open on fd once it was
+ *	replaced, by a compaction or truncation: after the last copy of
+ *	the last record entered, looking back from the end in windows
+ *	growing twice larger. Without one, skip to the end.
+ */
+static off_t
+history_share_find(TYPE(History) *h, int fd, off_t size)
+{
+	char *buf, *nbuf, *p, *e, *found;
+	off_t from, at = size;
+	size_t len, got, w;
+	ssize_t n;
+
+	if (h->h_slast == NULL)
+		return size;
+	for (buf = NULL, w = 65536;; w *= 2) {
+		from = (off_t)w < size ? size - (off_t)w : 0;
+		len = (size_t)(size - from);
+		if ((nbuf = h_realloc(buf, len)) == NULL)
+			break;
+		buf = nbuf;
+		for (got = 0; got < len; got += (size_t)n)
+			if ((n = pread(fd, buf + got, len - got,
+			    from + (off_t)got)) <= 0)
+				break;
+		found = NULL;
+		for (p = buf, e = buf + got;
+		    (p = memchr(p, '\n', (size_t)(e - p))) != NULL; p++)
+			if ((size_t)(e - p) >= h->h_slastlen &&
+			    memcmp(p, h->h_slast, h->h_slastlen) == 0)
+				found = p;
+		if (found != NULL) {
+			at = from + (found - buf) + (off_t)h->h_slastlen;
+			break;
+		}
+		if (from == 0 || got < len)
+			break;
+	}
+	h_free(buf);
+	return at;
+}
+
+
+/* history_share_sync():
+ *	Enter the records appended to the journal since the last look,
+ *	without journaling them again; only a stat(2) when there are
+ *	none. Return how many were entered.
  */
 static int
-history_getunique(TYPE(History) *h, TYPE(HistEvent) *ev)
+history_share_sync(TYPE(History) *h)
 {
-	if (h->h_next != history_def_next) {
-		he_seterrev(ev, _HE_NOT_ALLOWED);
+	TYPE(HistEvent) ev;
+	struct stat st;
+	char *buf = NULL, *line = NULL, *nline, *p, *e, *nl, *last = NULL;
+	Char *str;
+	size_t len, got, lastlen = 0, max_size = 0;
+	ssize_t n;
+	int fd, i = 0;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
+
+	if (stat(h->h_jname, &st) == -1)
+		return -1;
+	if (st.st_dev == h->h_sdev && st.st_ino == h->h_sino &&
+	    st.st_size == h->h_soff)
+		return 0;
+	if ((fd = open(h->h_jname, O_RDONLY | O_CLOEXEC)) == -1)
 		return -1;
+	if (fstat(fd, &st) == -1)
+		goto fail;
+	if (st.st_dev != h->h_sdev || st.st_ino != h->h_sino ||
+	    st.st_size < h->h_soff) {
+		h->h_soff = history_share_find(h, fd, st.st_size);
+		h->h_sdev = st.st_dev;
+		h->h_sino = st.st_ino;
 	}
-	ev->num = history_def_getunique(h->h_ref);
-	return 0;
+	if (st.st_size <= h->h_soff)
+		goto done;
+
+	len = (size_t)(st.st_size - h->h_soff);
+	if ((buf = h_malloc(len)) == NULL)
+		goto fail;
+	for (got = 0; got < len; got += (size_t)n)
+		if ((n = pread(fd, buf + got, len - got,
+		    h->h_soff + (off_t)got)) <= 0)
+			break;
+	/* only whole records, the last one may be being written */
+	for (p = buf, e = buf + got;
+	    (nl = memchr(p, '\n', (size_t)(e - p))) != NULL; p = nl + 1) {
+		len = (size_t)(nl - p);
+		if (h->h_soff == 0 && p == buf)
+			continue;	/* the cookie */
+		if (max_size <= len) {
+			max_size = (len + 1024) & (size_t)~1023;
+			if ((nline = h_realloc(line, max_size)) == NULL)
+				break;
+			line = nline;
+		}
+		memcpy(line, p, len);
+		line[len] = '\0';
+		(void) strunvis(line, line);	/* never grows */
+		if ((str = edited_ct_decode_string(line, &conv)) != NULL) {
+			if ((h->h_next == history_def_next ?
+			    history_def_append(h->h_ref, &ev, str,
+				Strlen(str)) :
+			    HENTER(h, &ev, str)) == -1)
+				break;
+			i++;
+		}
+		last = p;
+		lastlen = len;
+	}
+	if (last != NULL)
+		history_share_seen(h, last, lastlen);
+	h->h_soff += p - buf;
+	goto done;
+fail:
+	i = -1;
+done:
+	h_free(line);
+	h_free(buf);
+	(void) close(fd);
+	return i;
 }
 
 
-/* history_set_fun():
- *	Set history functions
+/* history_def_rkwrite():
+ *	Write the ranks of the subtree of t, one per line
  */
 static int
-history_set_fun(TYPE(History) *h, TYPE(History) *nh)
+history_def_rkwrite(FILE *fp, hrank_t *t, char **buf, size_t *bsz)
 {
-	TYPE(HistEvent) ev;
+	const char *str;
+	char *nbuf;
+	size_t len;
+#ifndef NARROWCHAR
+	static edited_ct_buffer_t conv;
+#endif
 
-	if (nh->h_first == NULL || nh->h_next == NULL || nh->h_last == NULL ||
-	    nh->h_prev == NULL || nh->h_curr == NULL || nh->h_set == NULL ||
-	    nh->h_enter == NULL || nh->h_add == NULL || nh->h_clear == NULL ||
-	    nh->h_del == NULL || nh->h_ref == NULL) {
-		if (h->h_next != history_def_next) {
-			if (history_def_init(&h->h_ref, &ev, 0) == -1)
+	for (; t != NULL; t = t->right) {
+		if (history_def_rkwrite(fp, t->left, buf, bsz) == -1)
+			return -1;
+		if ((str = edited_ct_encode_string(t->str, &conv)) == NULL)
+			continue;
+		len = strlen(str) * 4 + 1;
+		if (len > *bsz) {
+			if ((nbuf = h_realloc(*buf, len)) == NULL)
 				return -1;
-			h->h_first = history_def_first;
-			h->h_next = history_def_next;
-			h->h_last = history_def_last;
-			h->h_prev = history_def_prev;
-			h->h_curr = history_def_curr;
-			h->h_set = history_def_set;
-			h->h_clear = history_def_clear;
-			h->h_enter = history_def_enter;
-			h->h_add = history_def_add;
-			h->h_del = history_def_del;
+			*buf = nbuf;
+			*bsz = len;
 		}
-		return -1;
+		(void) strvis(*buf, str, VIS_WHITE);
+		if (fprintf(fp, "%lld %.17g %s\n", (long long)t->last,
+		    t->weight, *buf) < 0)
+			return -1;
 	}
-	if (h->h_next == history_def_next)
-		history_def_clear(h->h_ref, &ev);
+	return 0;
+}
 
-	h->h_ent = -1;
-	h->h_first = nh->h_first;
-	h->h_next = nh->h_next;
-	h->h_last = nh->h_last;
-	h->h_prev = nh->h_prev;
-	h->h_curr = nh->h_curr;
-	h->h_set = nh->h_set;
-	h->h_clear = nh->h_clear;
-	h->h_enter = nh->h_enter;
-	h->h_add = nh->h_add;
-	h->h_del = nh->h_del;
 
-	return 0;
+/* history_def_saveranks():
+ *	Save the ranks of the strings in fname.rank, next to the
+ *	history file fname
+ */
+static int
+history_def_saveranks(history_t *h, const char *fname)
+{
+	FILE *fp;
+	char *name, *buf = NULL;
+	size_t bsz = 0, len = strlen(fname) + sizeof(".rank");
+	int fd, rv = -1;
+
+	if ((name = h_malloc(len)) == NULL)
+		return -1;
+	(void) snprintf(name, len, "%s.rank", fname);
+	if ((fd = open(name, O_WRONLY|O_CREAT|O_TRUNC,
+	    S_IRUSR|S_IWUSR)) == -1)
+		goto done;
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void) close(fd);
+		goto done;
+	}
+	if (fprintf(fp, "%s %lld %d\n", rank_cookie, (long long)h->epoch,
+	    h->halflife) >= 0 &&
+	    history_def_rkwrite(fp, h->ranks, &buf, &bsz) == 0)
+		rv = 0;
+	if (fclose(fp) == EOF)
+		rv = -1;
+done:
+	h_free(buf);
+	h_free(name);
+	return rv;
 }
 
 
-/* history_load():
- *	TYPE(History) load function
+/* history_def_loadranks():
+ *	Restore the weights and last uses of the strings from
+ *	fname.rank; strings no longer in the history are skipped
  */
 static int
-history_load(TYPE(History) *h, const char *fname)
+history_def_loadranks(history_t *h, const char *fname)
 {
 	FILE *fp;
-	char *line;
-	size_t llen;
+	hrank_t *r;
+	char *name, *line = NULL, *ptr = NULL, *end;
+	size_t llen = 0, max_size = 0, len = strlen(fname) + sizeof(".rank");
 	ssize_t sz;
-	size_t max_size;
-	char *ptr;
-	int i = -1;
-	TYPE(HistEvent) ev;
+	long long epoch, last;
+	double weight;
+	long halflife, p;
 	Char *decode_result;
 #ifndef NARROWCHAR
 	static edited_ct_buffer_t conv;
 #endif
 
-	if ((fp = fopen(fname, "r")) == NULL)
-		return i;
-
-	line = NULL;
-	llen = 0;
-	if ((sz = getline(&line, &llen, fp)) == -1)
-		goto done;
+	if ((name = h_malloc(len)) == NULL)
+		return -1;
+	(void) snprintf(name, len, "%s.rank", fname);
+	fp = fopen(name, "r");
+	h_free(name);
+	if (fp == NULL)
+		return 0;
 
-	if (strncmp(line, hist_cookie, (size_t)sz) != 0)
+	if ((sz = getline(&line, &llen, fp)) == -1 ||
+	    strncmp(line, rank_cookie, sizeof(rank_cookie) - 1) != 0)
 		goto done;
+	epoch = strtoll(line + sizeof(rank_cookie) - 1, &end, 10);
+	halflife = strtol(end, &end, 10);
 
-	ptr = h_malloc((max_size = 1024) * sizeof(*ptr));
-	if (ptr == NULL)
-		goto done;
-	for (i = 0; (sz = getline(&line, &llen, fp)) != -1; i++) {
+	while ((sz = getline(&line, &llen, fp)) != -1) {
 		if (sz > 0 && line[sz - 1] == '\n')
 			line[--sz] = '\0';
+		last = strtoll(line, &end, 10);
+		if (*end != ' ')
+			continue;
+		weight = strtod(end + 1, &end);
+		if (*end++ != ' ')
+			continue;
 		if (max_size < (size_t)sz) {
 			char *nptr;
 			max_size = ((size_t)sz + 1024) & (size_t)~1023;
 			nptr = h_realloc(ptr, max_size * sizeof(*ptr));
-			if (nptr == NULL) {
-				i = -1;
-				goto oomem;
-			}
+			if (nptr == NULL)
+				break;
 			ptr = nptr;
 		}
-		(void) strunvis(ptr, line);
+		(void) strunvis(ptr, end);
 		decode_result = edited_ct_decode_string(ptr, &conv);
-		if (decode_result == NULL)
+		if (decode_result == NULL ||
+		    (r = history_def_rkfind(h, decode_result)) == NULL)
 			continue;
-		if (HENTER(h, &ev, decode_result) == -1) {
-			i = -1;
-			goto oomem;
-		}
+		r->last = (time_t)last;
+		/* move the weight to our epoch, or start over */
+		if (halflife == h->halflife && h->epoch != 0 &&
+		    (epoch - h->epoch) % halflife == 0) {
+			p = (long)((epoch - h->epoch) / halflife);
+			r->weight = weight * history_def_rkpow(
+			    p < -1100 ? -1100 : p > 960 ? 960 : (int)p);
+		} else
+			r->weight = history_def_rkweight(h, r->last);
+		history_def_rkrefix(h->ranks, r);
 	}
-oomem:
-	h_free(ptr);
 done:
+	h_free(ptr);
 	free(line);
 	(void) fclose(fp);
-	return i;
+	return 0;
 }
 
 
-/* history_save_fp():
- *	TYPE(History) save function
+/* history_def_savemeta():
+ *	Save what is known of the events, oldest first as in the history
+ *	file fname, to fname.meta with a hash of each string
  */
 static int
-history_save_fp(TYPE(History) *h, size_t nelem, FILE *fp)
+history_def_savemeta(history_t *h, const char *fname)
 {
-	TYPE(HistEvent) ev;
-	int i = -1, retval;
-	size_t len, max_size;
-	char *ptr;
-	const char *str;
-#ifndef NARROWCHAR
-	static edited_ct_buffer_t conv;
-#endif
+	FILE *fp;
+	char *name, *buf = NULL, *nbuf;
+	size_t bsz = 0, len = strlen(fname) + sizeof(".meta");
+	int fd, i, n, rv = -1;
 
-	if (ftell(fp) == 0 && fputs(hist_cookie, fp) == EOF)
+	if ((name = h_malloc(len)) == NULL)
+		return -1;
+	(void) snprintf(name, len, "%s.meta", fname);
+	if ((fd = open(name, O_WRONLY|O_CREAT|O_TRUNC,
+	    S_IRUSR|S_IWUSR)) == -1)
 		goto done;
-	ptr = h_malloc((max_size = 1024) * sizeof(*ptr));
-	if (ptr == NULL)
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void) close(fd);
 		goto done;
-	if (nelem != (size_t)-1) {
-		for (retval = HFIRST(h, &ev); retval != -1 && nelem-- > 0;
-		    retval = HNEXT(h, &ev))
-			continue;
-	} else
-		retval = -1;
+	}
+	if (fprintf(fp, "%s %d\n", meta_cookie, h->nmdirs) < 0)
+		goto close;
+	for (i = 0; i < h->nmdirs; i++) {
+		len = strlen(h->mdirs[i]) * 4 + 1;
+		if (len > bsz) {
+			if ((nbuf = h_realloc(buf, len)) == NULL)
+				goto close;
+			buf = nbuf;
+			bsz = len;
+		}
+		(void) strvis(buf, h->mdirs[i], VIS_WHITE);
+		if (fprintf(fp, "%s\n", buf) < 0)
+			goto close;
+	}
+	for (i = 0; i < h->cur; i++) {
+		n = HSLOT(h, i);
+		if (fprintf(fp, "%u %lld %d %d %d\n",
+		    history_def_mhash(h, HENTRY(h, i)),
+		    (long long)h->mtime[n], h->mdur[n], h->mstatus[n],
+		    h->mcwd[n]) < 0)
+			goto close;
+	}
+	rv = 0;
+close:
+	if (fclose(fp) == EOF)
+		rv = -1;
+done:
+	h_free(buf);
+	h_free(name);
+	return rv;
+}
 
-	if (retval == -1)
-		retval = HLAST(h, &ev);
 
-	for (i = 0; retval != -1; retval = HPREV(h, &ev), i++) {
-		str = edited_ct_encode_string(ev.str, &conv);
-		len = strlen(str) * 4 + 1;
-		if (len > max_size) {
-			char *nptr;
-			max_size = (len + 1024) & (size_t)~1023;
-			nptr = h_realloc(ptr, max_size * sizeof(*ptr));
-			if (nptr == NULL) {
-				i = -1;
-				goto oomem;
-			}
-			ptr = nptr;
+/* history_def_loadmeta():
+ *	Load fname.meta into the events loaded from fname, those numbered
+ *	after id0. They are matched by hash from the newest backwards,
+ *	so that events dropped on either side only lose their fields.
+ */
+static int
+history_def_loadmeta(history_t *h, const char *fname, int id0)
+{
+	typedef struct {
+		unsigned int hash;
+		long long time;
+		int dur, status, cwd;
+	} hmeta_t;
+	FILE *fp;
+	hmeta_t *rec = NULL, *nrec;
+	char *name, *line = NULL, *end;
+	size_t llen = 0, nrecs = 0, arecs = 0, len = strlen(fname) +
+	    sizeof(".meta");
+	ssize_t sz;
+	int *dirs = NULL, ndirs, i, j, k, n;
+
+	if ((name = h_malloc(len)) == NULL)
+		return -1;
+	(void) snprintf(name, len, "%s.meta", fname);
+	fp = fopen(name, "r");
+	h_free(name);
+	if (fp == NULL)
+		return 0;
+
+	if ((sz = getline(&line, &llen, fp)) == -1 ||
+	    strncmp(line, meta_cookie, sizeof(meta_cookie) - 1) != 0)
+		goto done;
+	ndirs = (int)strtol(line + sizeof(meta_cookie) - 1, &end, 10);
+	if (ndirs < 0 || (ndirs > 0 &&
+	    (dirs = h_malloc((size_t)ndirs * sizeof(*dirs))) == NULL))
+		goto done;
+	for (i = 0; i < ndirs; i++) {
+		if ((sz = getline(&line, &llen, fp)) == -1)
+			goto done;
+		if (sz > 0 && line[sz - 1] == '\n')
+			line[--sz] = '\0';
+		(void) strunvis(line, line);
+		dirs[i] = history_def_dir(h, line, 1);
+	}
+
+	while ((sz = getline(&line, &llen, fp)) != -1) {
+		if (nrecs == arecs) {
+			arecs = arecs ? arecs * 2 : 1024;
+			nrec = h_realloc(rec, arecs * sizeof(*rec));
+			if (nrec == NULL)
+				goto done;
+			rec = nrec;
 		}
-		(void) strvis(ptr, str, VIS_WHITE);
-		(void) fprintf(fp, "%s\n", ptr);
+		rec[nrecs].hash = (unsigned int)strtoul(line, &end, 10);
+		rec[nrecs].time = strtoll(end, &end, 10);
+		rec[nrecs].dur = (int)strtol(end, &end, 10);
+		rec[nrecs].status = (int)strtol(end, &end, 10);
+		rec[nrecs].cwd = (int)strtol(end, &end, 10);
+		if (*end == '\n' || *end == '\0')
+			nrecs++;
+	}
+
+	j = (int)nrecs - 1;
+	for (i = h->cur - 1; i >= 0 && j >= 0 &&
+	    HENTRY(h, i)->ev.num > id0; i--) {
+		unsigned int hash = history_def_mhash(h, HENTRY(h, i));
+
+		for (k = j; k >= 0 && k > j - HMETASKIP &&
+		    rec[k].hash != hash; k--)
+			continue;
+		if (k < 0 || k <= j - HMETASKIP)
+			continue;
+		n = HSLOT(h, i);
+		h->mtime[n] = (time_t)rec[k].time;
+		h->mdur[n] = rec[k].dur;
+		h->mstatus[n] = rec[k].status;
+		h->mcwd[n] = rec[k].cwd >= 0 && rec[k].cwd < ndirs ?
+		    dirs[rec[k].cwd] : -1;
+		j = k - 1;
 	}
-oomem:
-	h_free(ptr);
 done:
-	return i;
+	h_free(dirs);
+	h_free(rec);
+	free(line);
+	(void) fclose(fp);
+	return 0;
 }
 
 
-/* history_save():
- *    History save function
+/* history_def_seek():
+ *	Search the builtin history from the current event for the
+ *	event numbered num, towards newer events if newer is set,
+ *	ending where the equivalent walk with H_PREV or H_NEXT does.
  */
 static int
-history_save(TYPE(History) *h, const char *fname)
+history_def_seek(history_t *h, TYPE(HistEvent) *ev, int num, int newer,
+    void **d)
 {
-    FILE *fp;
-    int i;
-
-    if ((i = open(fname, O_WRONLY|O_CREAT|O_TRUNC,
-		S_IRUSR|S_IWUSR)) == -1)
+	int i;
+
+	if (history_def_curr(h, ev) == -1)
+		goto out;
+	i = history_def_find(h, num);
+	if (i != -1 && (newer ? i >= h->cursor : i <= h->cursor)) {
+		h->cursor = i;
+		if (history_def_event(h, ev) == -1)
+			return -1;
+		if (d)
+			*d = HENTRY(h, i)->data;
+		return 0;
+	}
+	h->cursor = newer ? h->cur - 1 : 0;
+out:
+	he_seterrev(ev, _HE_NOT_FOUND);
 	return -1;
+}
 
-    if ((fp = fdopen(i, "w")) == NULL)
-	return -1;
 
-    i = history_save_fp(h, (size_t)-1, fp);
+/* history_nth():
+ *	Make the n-th newest event current, 0 being the newest
+ */
+static int
+history_nth(TYPE(History) *h, TYPE(HistEvent) *ev, int n)
+{
+	history_t *hp = h->h_ref;
+	int retval;
 
-    (void) fclose(fp);
-    return i;
+	if (n < 0) {
+		he_seterrev(ev, _HE_BAD_PARAM);
+		return -1;
+	}
+	if (h->h_next == history_def_next) {
+		if (n >= hp->cur) {
+			he_seterrev(ev, hp->cur ? _HE_NOT_FOUND :
+			    _HE_EMPTY_LIST);
+			return -1;
+		}
+		hp->cursor = hp->cur - 1 - n;
+		return history_def_event(hp, ev);
+	}
+
+	for (retval = HFIRST(h, ev); retval != -1 && n > 0; n--)
+		retval = HNEXT(h, ev);
+	return retval;
 }
 
 
@@ -915,6 +5645,9 @@ history_prev_event(TYPE(History) *h, TYPE(HistEvent) *ev, int num)
 {
 	int retval;
 
+	if (h->h_next == history_def_next)
+		return history_def_seek(h->h_ref, ev, num, 1, NULL);
+
 	for (retval = HCURR(h, ev); retval != -1; retval = HPREV(h, ev))
 		if (ev->num == num)
 			return 0;
@@ -929,10 +5662,14 @@ history_next_evdata(TYPE(History) *h, TYPE(HistEvent) *ev, int num, void **d)
 {
 	int retval;
 
+	if (h->h_next == history_def_next)
+		return history_def_seek(h->h_ref, ev, num, 1, d);
+
+	/* XXX: there is no way to get the data from other backends */
 	for (retval = HCURR(h, ev); retval != -1; retval = HPREV(h, ev))
 		if (ev->num == num) {
 			if (d)
-				*d = ((history_t *)h->h_ref)->cursor->data;
+				*d = NULL;
 			return 0;
 		}
 
@@ -949,6 +5686,9 @@ history_next_event(TYPE(History) *h, TYPE(HistEvent) *ev, int num)
 {
 	int retval;
 
+	if (h->h_next == history_def_next)
+		return history_def_seek(h->h_ref, ev, num, 0, NULL);
+
 	for (retval = HCURR(h, ev); retval != -1; retval = HNEXT(h, ev))
 		if (ev->num == num)
 			return 0;
@@ -967,6 +5707,9 @@ history_prev_string(TYPE(History) *h, TYPE(HistEvent) *ev, const Char *str)
 	size_t len = Strlen(str);
 	int retval;
 
+	if (h->h_next == history_def_next)
+		return history_def_prefix(h->h_ref, ev, str, 1);
+
 	for (retval = HCURR(h, ev); retval != -1; retval = HNEXT(h, ev))
 		if (Strncmp(str, ev->str, len) == 0)
 			return 0;
@@ -985,6 +5728,9 @@ history_next_string(TYPE(History) *h, TYPE(HistEvent) *ev, const Char *str)
 	size_t len = Strlen(str);
 	int retval;
 
+	if (h->h_next == history_def_next)
+		return history_def_prefix(h->h_ref, ev, str, 0);
+
 	for (retval = HCURR(h, ev); retval != -1; retval = HPREV(h, ev))
 		if (Strncmp(str, ev->str, len) == 0)
 			return 0;
@@ -1017,6 +5763,44 @@ FUNW(history)(TYPE(History) *h, TYPE(HistEvent) *ev, int fun, ...)
 		retval = history_setsize(h, ev, va_arg(va, int));
 		break;
 
+	case H_SETMAXBYTES:
+	{
+		size_t max = va_arg(va, size_t);
+		retval = history_setmaxbytes(h, ev, max, va_arg(va, size_t));
+		break;
+	}
+
+	case H_GETMAXBYTES:
+	{
+		size_t *max = va_arg(va, size_t *);
+		retval = history_getmaxbytes(h, ev, max, va_arg(va, size_t *));
+		break;
+	}
+
+	case H_GETBYTES:
+		retval = history_getbytes(h, ev, va_arg(va, size_t *));
+		break;
+
+	case H_SETCOLD:
+		retval = history_setcold(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETCOLD:
+		retval = history_getcold(h, ev);
+		break;
+
+	case H_SETMULTIBYTE:
+		retval = history_setmultibyte(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETMULTIBYTE:
+		retval = history_getmultibyte(h, ev);
+		break;
+
+	case H_GETGENERATION:
+		retval = history_getgeneration(h, ev);
+		break;
+
 	case H_GETUNIQUE:
 		retval = history_getunique(h, ev);
 		break;
@@ -1035,10 +5819,30 @@ FUNW(history)(TYPE(History) *h, TYPE(HistEvent) *ev, int fun, ...)
 		break;
 
 	case H_ENTER:
+	{
+		int locked;
+
 		str = va_arg(va, const Char *);
+		/*
+		 * under the lock what the others wrote is entered first and
+		 * ours last, in memory as in the journal
+		 */
+		locked = h->h_jfd != -1 && history_journal_lock(h) != -1;
+		if (h->h_share)
+			(void) history_share_sync(h);
 		if ((retval = HENTER(h, ev, str)) != -1)
 			h->h_ent = ev->num;
+		/* the builtin list returns 0 when it drops a duplicate */
+		if (retval != -1 && h->h_jfd != -1 &&
+		    (retval > 0 || h->h_next != history_def_next) &&
+		    (!locked || history_journal(h, str) == -1)) {
+			he_seterrev(ev, _HE_HIST_WRITE);
+			retval = -1;
+		}
+		if (locked)
+			(void) flock(h->h_jfd, LOCK_UN);
 		break;
+	}
 
 	case H_APPEND:
 		str = va_arg(va, const Char *);
@@ -1081,12 +5885,24 @@ FUNW(history)(TYPE(History) *h, TYPE(HistEvent) *ev, int fun, ...)
 			he_seterrev(ev, _HE_HIST_READ);
 		break;
 
+	case H_IMPORT:
+		retval = history_import(h, va_arg(va, const char *));
+		if (retval == -1)
+			he_seterrev(ev, _HE_HIST_READ);
+		break;
+
 	case H_SAVE:
 		retval = history_save(h, va_arg(va, const char *));
 		if (retval == -1)
 			he_seterrev(ev, _HE_HIST_WRITE);
 		break;
 
+	case H_SAVE_BIN:
+		retval = history_save_bin(h, va_arg(va, const char *));
+		if (retval == -1)
+			he_seterrev(ev, _HE_HIST_WRITE);
+		break;
+
 	case H_SAVE_FP:
 		retval = history_save_fp(h, (size_t)-1, va_arg(va, FILE *));
 		if (retval == -1)
@@ -1157,6 +5973,11 @@ FUNW(history)(TYPE(History) *h, TYPE(HistEvent) *ev, int fun, ...)
 	{
 		int num = va_arg(va, int);
 		void **d = va_arg(va, void **);
+		if (h->h_next != history_def_next) {
+			he_seterrev(ev, _HE_NOT_ALLOWED);
+			retval = -1;
+			break;
+		}
 		retval = history_deldata_nth((history_t *)h->h_ref, ev, num, d);
 		break;
 	}
@@ -1165,17 +5986,160 @@ FUNW(history)(TYPE(History) *h, TYPE(HistEvent) *ev, int fun, ...)
 	{
 		const Char *line = va_arg(va, const Char *);
 		void *d = va_arg(va, void *);
+		history_t *hp = h->h_ref;
+		hentry_t he;
 		const Char *s;
-		if(!line || !(s = Strdup(line))) {
+		if (h->h_next != history_def_next) {
+			he_seterrev(ev, _HE_NOT_ALLOWED);
+			retval = -1;
+			break;
+		}
+		if(!line || hp->cursor == -1 ||
+		    history_def_store(hp, &he, line, Strlen(line)) == -1) {
 			retval = -1;
 			break;
 		}
-		((history_t *)h->h_ref)->cursor->ev.str = s;
-		((history_t *)h->h_ref)->cursor->data = d;
+		if (hp->flags & H_ERASEDUPS)
+			history_def_unindex(hp, HENTRY(hp, hp->cursor));
+		if ((hp->flags & H_RANKED) && (s = history_def_estr(hp,
+		    HENTRY(hp, hp->cursor))) != NULL)
+			history_def_unrank(hp, s);
+		history_def_release(hp, HENTRY(hp, hp->cursor));
+		HENTRY(hp, hp->cursor)->ev.str = he.ev.str;
+		HENTRY(hp, hp->cursor)->chunk = he.chunk;
+		HENTRY(hp, hp->cursor)->data = d;
+		hp->changes++;
+		if (hp->flags & H_ERASEDUPS)
+			(void)history_def_index(hp, HENTRY(hp, hp->cursor));
+		if (hp->flags & H_RANKED)
+			(void)history_def_rank(hp, he.ev.str, 0);
+		if (hp->flags & H_LISTS)
+			hp->tdirty = 1;
 		retval = 0;
 		break;
 	}
 
+	case H_NTH:
+		retval = history_nth(h, ev, va_arg(va, int));
+		break;
+
+	case H_SETARENA:
+		retval = history_setarena(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETARENA:
+		retval = history_getarena(h, ev);
+		break;
+
+	case H_SETERASEDUPS:
+		retval = history_seterasedups(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETERASEDUPS:
+		retval = history_geterasedups(h, ev);
+		break;
+
+	case H_SETTRIGRAMS:
+		retval = history_settrigrams(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETTRIGRAMS:
+		retval = history_gettrigrams(h, ev);
+		break;
+
+	case H_PREV_SUBSTR:
+	{
+		const Char *str = va_arg(va, const Char *);
+		retval = history_substr(h, ev, str, 1, va_arg(va, int *));
+		break;
+	}
+
+	case H_NEXT_SUBSTR:
+	{
+		const Char *str = va_arg(va, const Char *);
+		retval = history_substr(h, ev, str, 0, va_arg(va, int *));
+		break;
+	}
+
+	case H_SETPREFIXES:
+		retval = history_setprefixes(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETPREFIXES:
+		retval = history_getprefixes(h, ev);
+		break;
+
+	case H_SETJOURNAL:
+	{
+		const char *fname = va_arg(va, const char *);
+		retval = history_setjournal(h, ev, fname, va_arg(va, int));
+		break;
+	}
+
+	case H_GETJOURNAL:
+		retval = history_getjournal(h, ev);
+		break;
+
+	case H_SETSHARE:
+		retval = history_setshare(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETSHARE:
+		retval = history_getshare(h, ev);
+		break;
+
+	case H_SYNC:
+		if (!h->h_share) {
+			he_seterrev(ev, _HE_NOT_ALLOWED);
+			retval = -1;
+		} else if ((retval = history_share_sync(h)) == -1)
+			he_seterrev(ev, _HE_HIST_READ);
+		break;
+
+	case H_SETMETA:
+		retval = history_setmeta(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETMETA:
+		retval = history_getmeta(h, ev);
+		break;
+
+	case H_SETEVMETA:
+	{
+		int num = va_arg(va, int);
+		retval = history_setevmeta(h, ev, num,
+		    va_arg(va, const HistMeta *));
+		break;
+	}
+
+	case H_GETEVMETA:
+	{
+		int num = va_arg(va, int);
+		retval = history_getevmeta(h, ev, num, va_arg(va, HistMeta *));
+		break;
+	}
+
+	case H_SETFILTER:
+		retval = history_setfilter(h, ev,
+		    va_arg(va, const HistFilter *));
+		break;
+
+	case H_SETFRECENCY:
+		retval = history_setfrecency(h, ev, va_arg(va, int));
+		break;
+
+	case H_GETFRECENCY:
+		retval = history_getfrecency(h, ev);
+		break;
+
+	case H_FRECENT:
+	{
+		const Char *str = va_arg(va, const Char *);
+		const Char **lines = va_arg(va, const Char **);
+		retval = history_frecent(h, ev, str, lines, va_arg(va, int));
+		break;
+	}
+
 	default:
 		retval = -1;
 		he_seterrev(ev, _HE_UNKNOWN);
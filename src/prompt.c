@@ -44,8 +44,12 @@ __RCSID("$NetBSD: prompt.c,v 1.27 2017/06/27 23:25:13 christos Exp $");
 /*
  * prompt.c: Prompt printing functions
  */
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "edited/el.h"
+#include "edited/read.h"
 
 static wchar_t	*edited_prompt_default(Edited *);
 static wchar_t	*edited_prompt_default_r(Edited *);
@@ -76,39 +80,329 @@ edited_prompt_default_r(Edited *el __attribute__((__unused__)))
 }
 
 
-/* edited_prompt_print():
- *	Print the prompt and update the prompt position.
+/* edited_prompt_key():
+ *	Remember the string returned by the prompt function.
+ *	Return 1 if it differs from the one rendered last time.
  */
-libedited_private void
-edited_prompt_print(Edited *el, int op)
+static int
+edited_prompt_key(edited_prompt_t *elp, const void *p, int wide)
 {
-	edited_prompt_t *elp;
-	wchar_t *p;
+	size_t len;
+	void *k;
 
-	if (op == EL_PROMPT)
-		elp = &el->edited_prompt;
+	if (wide)
+		len = (wcslen(p) + 1) * sizeof(wchar_t);
 	else
-		elp = &el->edited_rprompt;
+		len = strlen(p) + 1;
+
+	if (elp->p_key != NULL && elp->p_keylen == len &&
+	    elp->p_keywide == wide && memcmp(elp->p_key, p, len) == 0)
+		return 0;
+
+	if (len > elp->p_keysize) {
+		k = edited_realloc(elp->p_key, len);
+		if (k == NULL) {
+			/* render uncached; try again next time */
+			elp->p_keylen = 0;
+			return 1;
+		}
+		elp->p_key = k;
+		elp->p_keysize = len;
+	}
+	memcpy(elp->p_key, p, len);
+	elp->p_keylen = len;
+	elp->p_keywide = wide;
+	return 1;
+}
+
+
+/* edited_prompt_addcell():
+ *	Append a cell to the rendered prompt
+ */
+static void
+edited_prompt_addcell(edited_prompt_t *elp, wint_t c, int w)
+{
+	edited_pcell_t *cp;
+
+	if (elp->p_ncells == elp->p_csize) {
+		size_t n = elp->p_csize ? elp->p_csize * 2 : 64;
 
-	if (elp->p_wide)
-		p = (*elp->p_func)(el);
+		cp = edited_realloc(elp->p_cells, n * sizeof(*cp));
+		if (cp == NULL)
+			return;
+		elp->p_cells = cp;
+		elp->p_csize = n;
+	}
+	elp->p_cells[elp->p_ncells].c_char = c;
+	elp->p_cells[elp->p_ncells].c_width = w;
+	elp->p_ncells++;
+}
+
+
+/* edited_prompt_render():
+ *	Split the prompt into cells, turning the literal
+ *	sequences into entries of the literal table.
+ */
+static void
+edited_prompt_render(Edited *el, edited_prompt_t *elp, const void *s,
+    int wide)
+{
+	const wchar_t *p;
+	wint_t c;
+	int w;
+
+	elp->p_ncells = 0;
+
+	if (wide)
+		p = s;
 	else
-		p = edited_ct_decode_string((char *)(void *)(*elp->p_func)(el),
-		    &el->edited_scratch);
+		p = edited_ct_decode_string(s, &el->edited_scratch);
+	if (p == NULL)
+		return;
 
 	for (; *p; p++) {
 		if (elp->p_ignore == *p) {
-			wchar_t *litstart = ++p;
+			const wchar_t *litstart = ++p;
 			while (*p && *p != elp->p_ignore)
 				p++;
 			if (!*p || !p[1]) {
 				// XXX: We lose the last literal
 				break;
 			}
-			edited_re_putliteral(el, litstart, p++);
+			c = edited_lit_add(el, litstart, p++, &w);
+			if (c != 0 && w > 0)
+				edited_prompt_addcell(elp, c, w);
 			continue;
 		}
-		edited_re_putc(el, *p, 1);
+		edited_prompt_addcell(elp, *p, 0);
+	}
+}
+
+
+/* edited_prompt_fetch():
+ *	Return the current text of the prompt; the completed
+ *	text once an asynchronous prompt has been completed.
+ */
+static const void *
+edited_prompt_fetch(Edited *el, edited_prompt_t *elp, int *wide)
+{
+	const void *p;
+
+	if (elp->p_async != NULL) {
+		*wide = 1;
+		return elp->p_async;
+	}
+	*wide = elp->p_wide;
+	p = (*elp->p_func)(el);
+	if (p == NULL)
+		p = *wide ? (const void *)L"" : "";
+	return p;
+}
+
+
+/* edited_prompt_prepare():
+ *	Fetch both prompts once for this refresh and render them
+ *	again only if what the prompt functions returned changed.
+ *	The literal table is shared between the prompts, so both
+ *	are rebuilt together.
+ */
+libedited_private void
+edited_prompt_prepare(Edited *el)
+{
+	const void *p, *rp;
+	int changed, w, rw;
+
+	p = edited_prompt_fetch(el, &el->edited_prompt, &w);
+	rp = edited_prompt_fetch(el, &el->edited_rprompt, &rw);
+
+	changed = edited_prompt_key(&el->edited_prompt, p, w);
+	changed |= edited_prompt_key(&el->edited_rprompt, rp, rw);
+	if (!changed)
+		return;
+
+	edited_lit_clear(el);
+	edited_prompt_render(el, &el->edited_prompt, p, w);
+	edited_prompt_render(el, &el->edited_rprompt, rp, rw);
+}
+
+
+/* edited_prompt_newline():
+ *	A new line is being edited; completions for the
+ *	prompts of the previous one are dropped.
+ */
+libedited_private void
+edited_prompt_newline(Edited *el)
+{
+	edited_prompt_t *elp[2];
+	int i;
+
+	elp[0] = &el->edited_prompt;
+	elp[1] = &el->edited_rprompt;
+
+	edited_read_lock(el);
+	for (i = 0; i < 2; i++) {
+		elp[i]->p_gen = (elp[i]->p_gen + 1) & (INT_MAX >> 1);
+		if (elp[i]->p_gen == 0)
+			elp[i]->p_gen = 1;
+		edited_free(elp[i]->p_pending);
+		elp[i]->p_pending = NULL;
+	}
+	edited_read_unlock(el);
+
+	for (i = 0; i < 2; i++) {
+		edited_free(elp[i]->p_async);
+		elp[i]->p_async = NULL;
+	}
+}
+
+
+/* edited_prompt_pending():
+ *	Install the prompts completed by other threads.
+ *	Return 1 if the display needs to be refreshed.
+ */
+libedited_private int
+edited_prompt_pending(Edited *el)
+{
+	edited_prompt_t *elp[2];
+	int i, changed = 0;
+
+	elp[0] = &el->edited_prompt;
+	elp[1] = &el->edited_rprompt;
+
+	edited_read_lock(el);
+	for (i = 0; i < 2; i++) {
+		if (elp[i]->p_pending == NULL)
+			continue;
+		edited_free(elp[i]->p_async);
+		elp[i]->p_async = elp[i]->p_pending;
+		elp[i]->p_pending = NULL;
+		changed = 1;
+	}
+	edited_read_unlock(el);
+	return changed;
+}
+
+
+/* edited_prompt_defer():
+ *	Called by a prompt function that returns placeholder text;
+ *	the token returned is later passed to edited_prompt_complete()
+ *	with the real prompt, which then replaces the placeholder
+ *	until the line is done.
+ */
+int
+edited_prompt_defer(Edited *el, int op)
+{
+
+	if (op != EL_PROMPT && op != EL_RPROMPT)
+		return -1;
+	if (edited_read_wakeinit(el) == -1)
+		return -1;
+	if (op == EL_PROMPT)
+		return el->edited_prompt.p_gen << 1;
+	else
+		return el->edited_rprompt.p_gen << 1 | 1;
+}
+
+
+/* edited_prompt_complete1():
+ *	Queue the text for the deferred prompt, taking ownership
+ */
+static int
+edited_prompt_complete1(Edited *el, int token, wchar_t *str)
+{
+	edited_prompt_t *elp;
+
+	if (str == NULL || token <= 0)
+		goto out;
+
+	if (token & 1)
+		elp = &el->edited_rprompt;
+	else
+		elp = &el->edited_prompt;
+
+	edited_read_lock(el);
+	if (elp->p_gen != token >> 1) {
+		edited_read_unlock(el);
+		goto out;		/* the line is gone */
+	}
+	edited_free(elp->p_pending);
+	elp->p_pending = str;
+	edited_read_unlock(el);
+
+	edited_read_wakeup(el);
+	return 0;
+out:
+	edited_free(str);
+	return -1;
+}
+
+
+/* edited_wprompt_complete():
+ *	Supply the text of a deferred prompt; callable from any thread
+ */
+int
+edited_wprompt_complete(Edited *el, int token, const wchar_t *str)
+{
+	wchar_t *s;
+	size_t len;
+
+	if (str == NULL)
+		return -1;
+	len = wcslen(str) + 1;
+	if ((s = edited_calloc(len, sizeof(*s))) == NULL)
+		return -1;
+	(void) memcpy(s, str, len * sizeof(*s));
+	return edited_prompt_complete1(el, token, s);
+}
+
+
+/* edited_prompt_complete():
+ *	Narrow version of edited_wprompt_complete(); the conversion
+ *	cannot use the editor's scratch buffers from another thread.
+ */
+int
+edited_prompt_complete(Edited *el, int token, const char *str)
+{
+	mbstate_t mbs;
+	const char *p;
+	wchar_t *s;
+	size_t len;
+
+	if (str == NULL)
+		return -1;
+	memset(&mbs, 0, sizeof(mbs));
+	p = str;
+	if ((len = mbsrtowcs(NULL, &p, (size_t)0, &mbs)) == (size_t)-1)
+		return -1;
+	if ((s = edited_calloc(len + 1, sizeof(*s))) == NULL)
+		return -1;
+	memset(&mbs, 0, sizeof(mbs));
+	p = str;
+	(void) mbsrtowcs(s, &p, len + 1, &mbs);
+	return edited_prompt_complete1(el, token, s);
+}
+
+
+/* edited_prompt_print():
+ *	Print the prompt and update the prompt position.
+ */
+libedited_private void
+edited_prompt_print(Edited *el, int op)
+{
+	edited_prompt_t *elp;
+	size_t i;
+
+	if (op == EL_PROMPT)
+		elp = &el->edited_prompt;
+	else
+		elp = &el->edited_rprompt;
+
+	for (i = 0; i < elp->p_ncells; i++) {
+		if (elp->p_cells[i].c_char & EL_LITERAL)
+			edited_re_putliteral(el, elp->p_cells[i].c_char,
+			    elp->p_cells[i].c_width);
+		else
+			edited_re_putc(el, elp->p_cells[i].c_char, 1);
 	}
 
 	elp->p_pos.v = el->edited_refresh.r_cursor.v;
@@ -123,14 +417,18 @@ libedited_private int
 edited_prompt_init(Edited *el)
 {
 
+	memset(&el->edited_prompt, 0, sizeof(el->edited_prompt));
+	memset(&el->edited_rprompt, 0, sizeof(el->edited_rprompt));
 	el->edited_prompt.p_func = edited_prompt_default;
 	el->edited_prompt.p_pos.v = 0;
 	el->edited_prompt.p_pos.h = 0;
 	el->edited_prompt.p_ignore = '\0';
+	el->edited_prompt.p_gen = 1;
 	el->edited_rprompt.p_func = edited_prompt_default_r;
 	el->edited_rprompt.p_pos.v = 0;
 	el->edited_rprompt.p_pos.h = 0;
 	el->edited_rprompt.p_ignore = '\0';
+	el->edited_rprompt.p_gen = 1;
 	return 0;
 }
 
@@ -139,9 +437,19 @@ edited_prompt_init(Edited *el)
  *	Clean up the prompt stuff
  */
 libedited_private void
-/*ARGSUSED*/
-edited_prompt_end(Edited *el __attribute__((__unused__)))
+edited_prompt_end(Edited *el)
 {
+
+	edited_free(el->edited_prompt.p_key);
+	edited_free(el->edited_prompt.p_cells);
+	edited_free(el->edited_prompt.p_async);
+	edited_free(el->edited_prompt.p_pending);
+	edited_free(el->edited_rprompt.p_key);
+	edited_free(el->edited_rprompt.p_cells);
+	edited_free(el->edited_rprompt.p_async);
+	edited_free(el->edited_rprompt.p_pending);
+	memset(&el->edited_prompt, 0, sizeof(el->edited_prompt));
+	memset(&el->edited_rprompt, 0, sizeof(el->edited_rprompt));
 }
 
 
@@ -172,6 +480,7 @@ edited_prompt_set(Edited *el, edited_pfunc_t prf, wchar_t c, int op, int wide)
 	p->p_pos.v = 0;
 	p->p_pos.h = 0;
 	p->p_wide = wide;
+	p->p_keylen = 0;	/* render again on the next refresh */
 
 	return 0;
 }
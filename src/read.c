@@ -48,15 +48,20 @@ __RCSID("$NetBSD: read.c,v 1.108 2022/10/30 19:11:31 christos Exp $");
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef _REENTRANT
+#include <pthread.h>
+#endif
 
 #include "edited/el.h"
 #include "edited/fcns.h"
 #include "edited/read.h"
 
 #define	EL_MAXMACRO	10
+#define	EL_RESIZE_SETTLE 50	/* msec without SIGWINCH ending a burst */
 
 struct macros {
 	wchar_t	**macro;
@@ -68,10 +73,21 @@ struct edited_read_t {
 	struct macros	 macros;
 	edited_rfunc_t	 edited_read_char;	/* Function to read a character. */
 	int		 edited_read_errno;
+	int		 edited_read_active;	/* Between prepare and finish */
+	int		 edited_read_wake[2];	/* Wakeup pipe, -1 if unused */
+	char		*edited_read_msg;	/* Queued for edited_print_above */
+	size_t		 edited_read_msglen;
+	size_t		 edited_read_msgsize;
+#ifdef _REENTRANT
+	pthread_mutex_t	 edited_read_mutex;	/* Guards the async state */
+#endif
 };
 
 static int	edited_read__fixio(int, int);
 static int	edited_read_char(Edited *, wchar_t *);
+static int	edited_read_wait(Edited *);
+static void	edited_read_resize(Edited *);
+static void	edited_read_pending(Edited *);
 static int	edited_read_getcmd(Edited *, edited_action_t *, wchar_t *);
 static void	edited_read_clearmacros(struct macros *);
 static void	edited_read_pop(struct macros *);
@@ -94,6 +110,16 @@ edited_read_init(Edited *el)
 	ma->level = -1;
 	ma->offset = 0;
 
+	el->edited_read->edited_read_active = 0;
+	el->edited_read->edited_read_wake[0] = -1;
+	el->edited_read->edited_read_wake[1] = -1;
+	el->edited_read->edited_read_msg = NULL;
+	el->edited_read->edited_read_msglen = 0;
+	el->edited_read->edited_read_msgsize = 0;
+#ifdef _REENTRANT
+	pthread_mutex_init(&el->edited_read->edited_read_mutex, NULL);
+#endif
+
 	/* builtin edited_read_char */
 	el->edited_read->edited_read_char = edited_read_char;
 	return 0;
@@ -112,6 +138,14 @@ edited_read_end(Edited *el)
 	edited_read_clearmacros(&el->edited_read->macros);
 	edited_free(el->edited_read->macros.macro);
 	el->edited_read->macros.macro = NULL;
+	if (el->edited_read->edited_read_wake[0] != -1) {
+		(void) close(el->edited_read->edited_read_wake[0]);
+		(void) close(el->edited_read->edited_read_wake[1]);
+	}
+#ifdef _REENTRANT
+	pthread_mutex_destroy(&el->edited_read->edited_read_mutex);
+#endif
+	edited_free(el->edited_read->edited_read_msg);
 	edited_free(el->edited_read);
 	el->edited_read = NULL;
 }
@@ -140,6 +174,286 @@ edited_read_getfn(struct edited_read_t *edited_read)
 }
 
 
+/* edited_read_wakeinit():
+ *	Create the pipe used to interrupt edited_read_char()
+ *	when asynchronous work is queued for the editor, once
+ *	whichever threads get here. Until then the editor reads
+ *	the terminal directly, so work queued as the pipe is made
+ *	waits for the next key.
+ */
+libedited_private int
+edited_read_wakeinit(Edited *el)
+{
+	struct edited_read_t *rd = el->edited_read;
+	int i, fl, rv = 0;
+
+	edited_read_lock(el);
+	if (rd->edited_read_wake[0] != -1)
+		goto out;
+	if (pipe(rd->edited_read_wake) == -1) {
+		rd->edited_read_wake[0] = rd->edited_read_wake[1] = -1;
+		rv = -1;
+		goto out;
+	}
+	for (i = 0; i < 2; i++) {
+		(void) fcntl(rd->edited_read_wake[i], F_SETFD, FD_CLOEXEC);
+		if ((fl = fcntl(rd->edited_read_wake[i], F_GETFL, 0)) != -1)
+			(void) fcntl(rd->edited_read_wake[i], F_SETFL,
+			    fl | O_NONBLOCK);
+	}
+out:
+	edited_read_unlock(el);
+	return rv;
+}
+
+/* edited_read_wakefd():
+ *	Return the end of the wakeup pipe the editor polls,
+ *	or -1 if there is none yet; another thread may be
+ *	creating it.
+ */
+static int
+edited_read_wakefd(Edited *el)
+{
+	int fd;
+
+	edited_read_lock(el);
+	fd = el->edited_read->edited_read_wake[0];
+	edited_read_unlock(el);
+	return fd;
+}
+
+/* edited_read_wakeup():
+ *	Make a pending or future edited_read_char() look at
+ *	the queued asynchronous work. Callable from any thread.
+ */
+libedited_private void
+edited_read_wakeup(Edited *el)
+{
+	int fd = el->edited_read->edited_read_wake[1];
+	int save_errno = errno;
+
+	/* a full pipe already has a wakeup pending */
+	if (fd != -1)
+		(void) write(fd, "", (size_t)1);
+	errno = save_errno;
+}
+
+/* edited_read_lock():
+ *	Serialize access to the state shared with other threads
+ */
+libedited_private void
+/*ARGSUSED*/
+edited_read_lock(Edited *el __attribute__((__unused__)))
+{
+#ifdef _REENTRANT
+	pthread_mutex_lock(&el->edited_read->edited_read_mutex);
+#endif
+}
+
+libedited_private void
+/*ARGSUSED*/
+edited_read_unlock(Edited *el __attribute__((__unused__)))
+{
+#ifdef _REENTRANT
+	pthread_mutex_unlock(&el->edited_read->edited_read_mutex);
+#endif
+}
+
+/* edited_print_above1():
+ *	Queue len bytes of output; only the first message
+ *	queued since the last batch needs to wake the editor.
+ */
+static int
+edited_print_above1(Edited *el, const char *str, size_t len)
+{
+	struct edited_read_t *rd = el->edited_read;
+	size_t n;
+	char *p;
+	int wake;
+
+	if (edited_read_wakeinit(el) == -1)
+		return -1;
+
+	edited_read_lock(el);
+	if (rd->edited_read_msglen + len > rd->edited_read_msgsize) {
+		n = rd->edited_read_msgsize ? rd->edited_read_msgsize : EL_BUFSIZ;
+		while (n < rd->edited_read_msglen + len)
+			n *= 2;
+		if ((p = edited_realloc(rd->edited_read_msg, n)) == NULL) {
+			edited_read_unlock(el);
+			return -1;
+		}
+		rd->edited_read_msg = p;
+		rd->edited_read_msgsize = n;
+	}
+	wake = rd->edited_read_msglen == 0;
+	(void) memcpy(rd->edited_read_msg + rd->edited_read_msglen, str, len);
+	rd->edited_read_msglen += len;
+	edited_read_unlock(el);
+
+	if (wake)
+		edited_read_wakeup(el);
+	return 0;
+}
+
+/* edited_print_above():
+ *	Print str above the line being edited. Callable from any
+ *	thread; the messages queued are written in one batch and
+ *	the prompt and line are redrawn once after them.
+ */
+int
+edited_print_above(Edited *el, const char *str)
+{
+
+	if (str == NULL)
+		return -1;
+	return edited_print_above1(el, str, strlen(str));
+}
+
+int
+edited_wprint_above(Edited *el, const wchar_t *str)
+{
+	mbstate_t mbs;
+	const wchar_t *p;
+	size_t len;
+	char *s;
+	int rv;
+
+	if (str == NULL)
+		return -1;
+	memset(&mbs, 0, sizeof(mbs));
+	p = str;
+	if ((len = wcsrtombs(NULL, &p, (size_t)0, &mbs)) == (size_t)-1)
+		return -1;
+	if ((s = edited_malloc(len + 1)) == NULL)
+		return -1;
+	memset(&mbs, 0, sizeof(mbs));
+	p = str;
+	(void) wcsrtombs(s, &p, len + 1, &mbs);
+	rv = edited_print_above1(el, s, len);
+	edited_free(s);
+	return rv;
+}
+
+/* edited_read_messages():
+ *	Take the queued messages, leaving an empty buffer behind
+ *	so that producers do not wait for the terminal.
+ */
+static char *
+edited_read_messages(Edited *el, size_t *len)
+{
+	struct edited_read_t *rd = el->edited_read;
+	char *msg;
+
+	edited_read_lock(el);
+	msg = rd->edited_read_msg;
+	*len = rd->edited_read_msglen;
+	if (*len == 0)
+		msg = NULL;
+	else {
+		rd->edited_read_msg = NULL;
+		rd->edited_read_msglen = 0;
+		rd->edited_read_msgsize = 0;
+	}
+	edited_read_unlock(el);
+	return msg;
+}
+
+/* edited_read_pending():
+ *	Apply the asynchronous work queued since the last wakeup
+ */
+static void
+edited_read_pending(Edited *el)
+{
+	size_t len;
+	char *msg;
+	int prompt;
+
+	if (!el->edited_read->edited_read_active)
+		return;
+	prompt = edited_prompt_pending(el);
+	if ((msg = edited_read_messages(el, &len)) != NULL) {
+		edited_re_print_above(el, msg, len);
+		edited_free(msg);
+	} else if (prompt)
+		edited_re_refresh(el);
+	else
+		return;
+	edited_term__flush(el);
+}
+
+/* edited_read_resize():
+ *	Apply a terminal resize once the burst of SIGWINCH that
+ *	a window drag produces is over, or as soon as input arrives.
+ */
+static void
+edited_read_resize(Edited *el)
+{
+	struct pollfd pfd;
+	coord_t size;
+
+	for (;;) {
+		el->edited_signal->edited_sig_winch = 0;
+		pfd.fd = el->edited_infd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, EL_RESIZE_SETTLE) != -1 || errno != EINTR)
+			break;
+		if (!el->edited_signal->edited_sig_winch)
+			break;
+		edited_sig_set(el);	/* the handler is reset every time */
+	}
+	el->edited_signal->edited_sig_winch = 0;
+
+	size = el->edited_terminal.t_size;
+	edited_resize(el);
+	if (el->edited_read->edited_read_active &&
+	    (el->edited_flags & EDIT_DISABLED) == 0 &&
+	    (size.h != el->edited_terminal.t_size.h ||
+	    size.v != el->edited_terminal.t_size.v)) {
+		edited_re_refresh(el);
+		edited_term__flush(el);
+	}
+}
+
+/* edited_read_wait():
+ *	Wait until the input is readable, servicing wakeups
+ *	in the meantime.
+ */
+static int
+edited_read_wait(Edited *el)
+{
+	struct edited_read_t *rd = el->edited_read;
+	struct pollfd pfd[3];
+	char buf[64];
+
+	for (;;) {
+		pfd[0].fd = el->edited_infd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = edited_read_wakefd(el);
+		pfd[1].events = POLLIN;
+		pfd[2].fd = el->edited_outfd;
+		pfd[2].events = POLLOUT;
+		if (!rd->edited_read_active || (!edited_term_backlog(el) &&
+		    !el->edited_refresh.r_deferred))
+			pfd[2].fd = -1;
+		if (poll(pfd, 3, -1) == -1)
+			return -1;
+		if (pfd[1].revents & POLLIN) {
+			while (read(pfd[1].fd, buf, sizeof(buf)) > 0)
+				continue;
+			edited_read_pending(el);
+		}
+		if (pfd[2].revents) {
+			/* the terminal took some output, catch up */
+			edited_term__flush(el);
+			edited_re_deferred(el);
+			edited_term__flush(el);
+		}
+		if (pfd[0].revents)
+			return 0;
+	}
+}
+
 /* edited_read__fixio():
  *	Try to recover from a read error
  */
@@ -233,6 +547,11 @@ edited_read_getcmd(Edited *el, edited_action_t *cmdnum, wchar_t *ch)
 	edited_action_t cmd;
 
 	do {
+		/* read functions other than ours leave resizing to us */
+		if (el->edited_signal->edited_sig_winch) {
+			edited_sig_set(el);
+			edited_read_resize(el);
+		}
 		if (edited_wgetc(el, ch) != 1)
 			return -1;
 
@@ -286,15 +605,24 @@ edited_read_char(Edited *el, wchar_t *cp)
 	int save_errno = errno;
 
  again:
+	if (el->edited_signal->edited_sig_winch) {
+		/* delivered while we were not waiting for input */
+		edited_sig_set(el);
+		edited_read_resize(el);
+	}
 	el->edited_signal->edited_sig_no = 0;
-	while ((num_read = read(el->edited_infd, cbuf + cbp, (size_t)1)) == -1) {
+	while ((num_read = ((edited_read_wakefd(el) != -1 ||
+	    (el->edited_flags & FRAMEDROP)) && edited_read_wait(el) == -1) ? -1 :
+	    read(el->edited_infd, cbuf + cbp, (size_t)1)) == -1) {
 		int e = errno;
 		switch (el->edited_signal->edited_sig_no) {
 		case SIGCONT:
 			edited_wset(el, EL_REFRESH);
-			/*FALLTHROUGH*/
+			edited_sig_set(el);
+			goto again;
 		case SIGWINCH:
 			edited_sig_set(el);
+			edited_read_resize(el);
 			goto again;
 		default:
 			break;
@@ -422,6 +750,9 @@ edited_wgetc(Edited *el, wchar_t *cp)
 libedited_private void
 edited_read_prepare(Edited *el)
 {
+	size_t len;
+	char *msg;
+
 	if (el->edited_flags & HANDLE_SIGNALS)
 		edited_sig_set(el);
 	if (el->edited_flags & NO_TTY)
@@ -431,10 +762,20 @@ edited_read_prepare(Edited *el)
 
 	/* This is relatively cheap, and things go terribly wrong if
 	   we have the wrong size. */
+	el->edited_signal->edited_sig_winch = 0;
 	edited_resize(el);
 	edited_re_clear_display(el);	/* reset the display stuff */
 	ch_reset(el);
+	edited_prompt_newline(el);	/* forget the last line's prompts */
+	/* messages queued between lines go before the prompt */
+	if ((msg = edited_read_messages(el, &len)) != NULL) {
+		edited_term__write(el, msg, len);
+		if (msg[len - 1] != '\n')
+			edited_term__putc(el, '\n');
+		edited_free(msg);
+	}
 	edited_re_refresh(el);		/* print the prompt */
+	el->edited_read->edited_read_active = 1;
 
 	if (el->edited_flags & UNBUFFERED)
 		edited_term__flush(el);
@@ -443,6 +784,7 @@ edited_read_prepare(Edited *el)
 libedited_private void
 edited_read_finish(Edited *el)
 {
+	el->edited_read->edited_read_active = 0;
 	if ((el->edited_flags & UNBUFFERED) == 0)
 		(void) edited_tty_cookedmode(el);
 	if (el->edited_flags & HANDLE_SIGNALS)
@@ -604,6 +946,12 @@ edited_wgets(Edited *el, int *nread)
 			break;
 	}
 
+	if (el->edited_flags & FRAMEDROP) {
+		/* the application writes after us; deliver everything */
+		edited_term__drain(el);
+		edited_re_deferred(el);
+		edited_term__drain(el);
+	}
 	edited_term__flush(el);		/* flush any buffered output */
 	/* make sure the tty is set up correctly */
 	if ((el->edited_flags & UNBUFFERED) == 0) {
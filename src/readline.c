@@ -35,6 +35,8 @@ __RCSID("$NetBSD: readline.c,v 1.182 2024/03/26 18:02:04 christos Exp $");
 #endif /* not lint && not SCCSID */
 
 #include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <ctype.h>
 #include <dirent.h>
@@ -1281,140 +1283,103 @@ history_is_stifled(void)
 	return max_input_history != INT_MAX;
 }
 
-static const char _history_tmp_template[] = "/tmp/.historyXXXXXX";
+/* the first line of the files written by write_history() */
+static const char _history_cookie[] = "_HiStOrY_V2_\n";
 
+/*
+ * Keep the last nlines lines of the history file. They are found by
+ * scanning the file backward from its end, and written with the
+ * cookie line, if any, to a new file renamed over the old one, locked
+ * against the processes appending to it meanwhile.
+ */
 int
 history_truncate_file (const char *filename, int nlines)
 {
-	int ret = 0;
-	FILE *fp, *tp;
-	char template[sizeof(_history_tmp_template)];
-	char buf[4096];
-	int fd;
-	char *cp;
-	off_t off;
-	int count = 0;
-	ssize_t left = 0;
+	struct stat st, nst;
+	const char *base, *data, *end, *cp;
+	char *path, *template = NULL;
+	void *map;
+	size_t head, len;
+	ssize_t n;
+	int fd, tfd, ret = 0;
 
+	if (nlines <= 0)
+		return EINVAL;
 	if (filename == NULL && (filename = _default_history_file()) == NULL)
 		return errno;
-	if ((fp = fopen(filename, "r+")) == NULL)
+	/* replace the file a symbolic link points to, not the link */
+	if ((path = realpath(filename, NULL)) == NULL)
 		return errno;
-	strcpy(template, _history_tmp_template);
-	if ((fd = mkstemp(template)) == -1) {
-		ret = errno;
-		goto out1;
-	}
-
-	if ((tp = fdopen(fd, "r+")) == NULL) {
-		close(fd);
-		ret = errno;
-		goto out2;
-	}
-
-	for(;;) {
-		if (fread(buf, sizeof(buf), (size_t)1, fp) != 1) {
-			if (ferror(fp)) {
-				ret = errno;
-				break;
-			}
-			if (fseeko(fp, (off_t)sizeof(buf) * count, SEEK_SET) ==
-			    (off_t)-1) {
-				ret = errno;
-				break;
-			}
-			left = (ssize_t)fread(buf, (size_t)1, sizeof(buf), fp);
-			if (ferror(fp)) {
-				ret = errno;
-				break;
-			}
-			if (left == 0) {
-				count--;
-				left = sizeof(buf);
-			} else if (fwrite(buf, (size_t)left, (size_t)1, tp)
-			    != 1) {
-				ret = errno;
-				break;
-			}
-			fflush(tp);
-			break;
-		}
-		if (fwrite(buf, sizeof(buf), (size_t)1, tp) != 1) {
+	for (;;) {
+		if ((fd = open(path, O_RDONLY)) == -1) {
 			ret = errno;
-			break;
-		}
-		count++;
-	}
-	if (ret)
-		goto out3;
-	cp = buf + left - 1;
-	if(*cp != '\n')
-		cp++;
-	for(;;) {
-		while (--cp >= buf) {
-			if (*cp == '\n') {
-				if (--nlines == 0) {
-					if (++cp >= buf + sizeof(buf)) {
-						count++;
-						cp = buf;
-					}
-					break;
-				}
-			}
+			goto out1;
 		}
-		if (nlines <= 0 || count == 0)
-			break;
-		count--;
-		if (fseeko(tp, (off_t)sizeof(buf) * count, SEEK_SET) < 0) {
+		if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
 			ret = errno;
-			break;
+			goto out2;
 		}
-		if (fread(buf, sizeof(buf), (size_t)1, tp) != 1) {
-			if (ferror(tp)) {
-				ret = errno;
-				break;
-			}
-			ret = EAGAIN;
+		/* another truncation renamed a new file over it meanwhile */
+		if (stat(path, &nst) == 0 && nst.st_dev == st.st_dev &&
+		    nst.st_ino == st.st_ino)
 			break;
-		}
-		cp = buf + sizeof(buf);
+		close(fd);
 	}
+	if (st.st_size == 0)
+		goto out2;
+	if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+	    fd, 0)) == MAP_FAILED) {
+		ret = errno;
+		goto out2;
+	}
+	base = map;
+	head = (size_t)st.st_size >= sizeof(_history_cookie) - 1 &&
+	    memcmp(base, _history_cookie, sizeof(_history_cookie) - 1) == 0 ?
+	    sizeof(_history_cookie) - 1 : 0;
+	data = base + head;
+
+	end = cp = base + st.st_size;
+	if (cp > data && cp[-1] == '\n')
+		cp--;
+	for (; nlines > 0 && cp > data; nlines--)
+		while (--cp > data && *cp != '\n')
+			continue;
+	if (cp == data && (nlines > 0 || cp == end || *cp != '\n'))
+		goto out3;		/* nothing to drop */
+	cp++;
 
-	if (ret || nlines > 0)
-		goto out3;
-
-	if (fseeko(fp, (off_t)0, SEEK_SET) == (off_t)-1) {
+	len = strlen(path) + sizeof(".XXXXXX");
+	if ((template = malloc(len)) == NULL) {
 		ret = errno;
 		goto out3;
 	}
-
-	if (fseeko(tp, (off_t)sizeof(buf) * count + (cp - buf), SEEK_SET) ==
-	    (off_t)-1) {
+	(void)snprintf(template, len, "%s.XXXXXX", path);
+	if ((tfd = mkstemp(template)) == -1) {
 		ret = errno;
 		goto out3;
 	}
-
-	for(;;) {
-		if ((left = (ssize_t)fread(buf, (size_t)1, sizeof(buf), tp)) == 0) {
-			if (ferror(fp))
-				ret = errno;
-			break;
-		}
-		if (fwrite(buf, (size_t)left, (size_t)1, fp) != 1) {
+	(void)fchmod(tfd, st.st_mode & 07777);
+	if (head > 0 && write(tfd, base, head) != (ssize_t)head)
+		ret = errno ? errno : EIO;
+	for (len = (size_t)(end - cp); ret == 0 && len > 0;
+	    cp += n, len -= (size_t)n)
+		if ((n = write(tfd, cp, len)) == -1)
 			ret = errno;
-			break;
-		}
-	}
-	fflush(fp);
-	if((off = ftello(fp)) > 0)
-		(void)ftruncate(fileno(fp), off);
+	if (ret == 0 && fsync(tfd) == -1)
+		ret = errno;
+	if (close(tfd) == -1 && ret == 0)
+		ret = errno;
+	if (ret == 0 && rename(template, path) == -1)
+		ret = errno;
+	if (ret != 0)
+		(void)unlink(template);
 out3:
-	fclose(tp);
+	(void)munmap(map, (size_t)st.st_size);
 out2:
-	unlink(template);
+	close(fd);
 out1:
-	fclose(fp);
-
+	free(template);
+	free(path);
 	return ret;
 }
 
@@ -1462,6 +1427,7 @@ int
 append_history(int n, const char *filename)
 {
 	HistEvent ev;
+	struct stat st, fst;
 	FILE *fp;
 
 	if (h == NULL || e == NULL)
@@ -1469,8 +1435,19 @@ append_history(int n, const char *filename)
 	if (filename == NULL && (filename = _default_history_file()) == NULL)
 		return errno;
 
-	if ((fp = fopen(filename, "a")) == NULL)
-		return errno;
+	for (;;) {
+		if ((fp = fopen(filename, "a")) == NULL)
+			return errno;
+		/* keep out other writers until fclose() flushes and unlocks */
+		if (flock(fileno(fp), LOCK_EX) == -1 ||
+		    fstat(fileno(fp), &fst) == -1)
+			break;
+		/* a truncation renamed a new file over it meanwhile */
+		if (stat(filename, &st) == 0 && st.st_dev == fst.st_dev &&
+		    st.st_ino == fst.st_ino)
+			break;
+		fclose(fp);
+	}
 
 	if (history(h, &ev, H_NSAVE_FP, (size_t)n,  fp) == -1) {
 		int serrno = errno ? errno : EINVAL;
@@ -1592,6 +1569,7 @@ replace_history_entry(int num, const char *line, histdata_t data)
 	HIST_ENTRY *he;
 	HistEvent ev;
 	int curr_num;
+	char *old;
 
 	if (h == NULL || e == NULL)
 		rl_initialize();
@@ -1612,12 +1590,15 @@ replace_history_entry(int num, const char *line, histdata_t data)
 	if (history(h, &ev, H_NEXT_EVDATA, num, &he->data))
 		goto out;
 
-	he->line = ev.str;
-	if (he->line == NULL)
+	/* the history frees the old line once it is replaced */
+	if (ev.str == NULL || (old = strdup(ev.str)) == NULL)
 		goto out;
 
-	if (history(h, &ev, H_REPLACE, line, data))
+	if (history(h, &ev, H_REPLACE, line, data)) {
+		edited_free(old);
 		goto out;
+	}
+	he->line = old;
 
 	/* restore pointer to where it was */
 	if (history(h, &ev, H_SET, curr_num))
@@ -1713,23 +1694,13 @@ int
 history_total_bytes(void)
 {
 	HistEvent ev;
-	int curr_num;
 	size_t size;
 
-	if (history(h, &ev, H_CURR) != 0)
+	if (h == NULL || e == NULL)
+		rl_initialize();
+	if (history(h, &ev, H_GETBYTES, &size) != 0)
 		return -1;
-	curr_num = ev.num;
-
-	(void)history(h, &ev, H_FIRST);
-	size = 0;
-	do
-		size += strlen(ev.str) * sizeof(*ev.str);
-	while (history(h, &ev, H_NEXT) == 0);
-
-	/* get to the same position as before */
-	history(h, &ev, H_PREV_EVENT, curr_num);
-
-	return (int)size;
+	return size > INT_MAX ? INT_MAX : (int)size;
 }
 
 
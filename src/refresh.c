@@ -62,6 +62,8 @@ static void	edited_re__strncopy(wchar_t *, wchar_t *, size_t);
 static void	edited_re__copy_and_pad(wchar_t *, const wchar_t *, size_t);
 static void edited_re_addc_styled(Edited *, wint_t, edited_style_t);
 static void edited_re_putc_styled(Edited *, wint_t, edited_style_t);
+static void	edited_re_ghost(Edited *);
+static void	edited_re_unghost(Edited *);
 
 #ifdef DEBUG_REFRESH
 static void	edited_re_printstr(EditLine *, const char *, wchar_t *, wchar_t *);
@@ -175,19 +177,16 @@ edited_re_addc_styled(Edited *el, wint_t c, edited_style_t style)
 }
 
 /* edited_re_putliteral():
- *	Place the literal string given
+ *	Place the literal c, previously added with edited_lit_add(),
+ *	which occupies w columns
  */
 libedited_private void
-edited_re_putliteral(Edited *el, const wchar_t *begin, const wchar_t *end)
+edited_re_putliteral(Edited *el, wint_t c, int w)
 {
 	coord_t *cur = &el->edited_refresh.r_cursor;
-	wint_t c;
 	int sizeh = el->edited_terminal.t_size.h;
-	int i, w;
+	int i;
 
-	c = edited_lit_add(el, begin, end, &w);
-	if (c == 0 || w <= 0)
-		return;
 	el->edited_vdisplay[cur->v][cur->h] = c;
 
 	i = w;
@@ -269,7 +268,19 @@ edited_re_refresh(Edited *el)
 	ELRE_DEBUG(1, (__F, "el->edited_line.buffer = :%ls:\r\n",
 	    el->edited_line.buffer));
 
-	edited_lit_clear(el);
+	/*
+	 * If the terminal has not taken the last frame yet, skip
+	 * this one; edited_re_deferred() draws the newest state
+	 * against what was actually sent once the output drains.
+	 */
+	if (edited_term_congested(el)) {
+		el->edited_refresh.r_deferred = 1;
+		return;
+	}
+	el->edited_refresh.r_deferred = 0;
+	edited_re_unghost(el);
+
+	edited_prompt_prepare(el);
 	/* reset the Drawing cursor */
 	el->edited_refresh.r_cursor.h = 0;
 	el->edited_refresh.r_cursor.v = 0;
@@ -412,6 +423,7 @@ edited_re_refresh(Edited *el)
 	    cur.h, cur.v));
 	edited_term_move_to_line(el, cur.v);	/* go to where the cursor is */
 	edited_term_move_to_char(el, cur.h);
+	edited_re_ghost(el);
 
 	if (use_style) {
 		for (i = 0; i < el->edited_terminal.t_size.v; i++)
@@ -428,6 +440,12 @@ libedited_private void
 edited_re_goto_bottom(Edited *el)
 {
 
+	if (el->edited_refresh.r_deferred) {
+		/* the final state of the line must be on the screen */
+		edited_term__drain(el);
+		edited_re_refresh(el);
+	}
+	edited_re_unghost(el);
 	edited_term_move_to_line(el, el->edited_refresh.r_oldcv);
 	edited_term__putc(el, '\n');
 	edited_re_clear_display(el);
@@ -1088,10 +1106,14 @@ edited_re_refresh_cursor(Edited *el)
 	wchar_t *cp;
 	int h, v, th, w;
 
-	if (el->edited_use_style) {
+	if (el->edited_use_style || el->edited_refresh.r_deferred) {
 		edited_re_refresh(el);
 		return;
 	}
+	if (edited_term_congested(el)) {
+		el->edited_refresh.r_deferred = 1;
+		return;
+	}
 
 	if (el->edited_line.cursor >= el->edited_line.lastchar) {
 		if (el->edited_map.current == el->edited_map.alt
@@ -1143,6 +1165,7 @@ edited_re_refresh_cursor(Edited *el)
 	/* now go there */
 	edited_term_move_to_line(el, v);
 	edited_term_move_to_char(el, h);
+	edited_re_ghost(el);
 	edited_term__flush(el);
 }
 
@@ -1214,10 +1237,14 @@ edited_re_fastaddc(Edited *el)
 	wchar_t c;
 	int rhdiff;
 
-	if (el->edited_use_style) {
+	if (el->edited_use_style || el->edited_refresh.r_deferred) {
 		edited_re_refresh(el);
 		return;
 	}
+	if (edited_term_congested(el)) {
+		el->edited_refresh.r_deferred = 1;
+		return;
+	}
 	if (el->edited_line.cursor == el->edited_line.buffer) {
 		edited_re_refresh(el);
 		return;
@@ -1234,6 +1261,18 @@ edited_re_fastaddc(Edited *el)
 		edited_re_refresh(el);	/* clear out rprompt if less than 1 char gap */
 		return;
 	}			/* else (only do at end of line, no TAB) */
+	if (el->edited_refresh.r_ghost > 0) {
+		coord_t *g = &el->edited_refresh.r_ghostat;
+
+		if (g->v == el->edited_cursor.v && g->h == el->edited_cursor.h &&
+		    el->edited_display[g->v][g->h] == (wint_t)c &&
+		    wcwidth(c) == 1) {
+			/* typed what was suggested, the rest stays */
+			g->h++;
+			el->edited_refresh.r_ghost--;
+		} else
+			edited_re_unghost(el);
+	}
 	switch (edited_ct_chr_class(c)) {
 	case CHTYPE_TAB: /* already handled, should never happen here */
 		break;
@@ -1251,6 +1290,7 @@ edited_re_fastaddc(Edited *el)
 		break;
 	}
 	}
+	edited_re_ghost(el);
 	edited_term__flush(el);
 }
 
@@ -1265,9 +1305,204 @@ edited_re_clear_display(Edited *el)
 
 	el->edited_cursor.v = 0;
 	el->edited_cursor.h = 0;
-	for (i = 0; i < el->edited_terminal.t_size.v; i++)
+	/* including the lines a smaller terminal does not use */
+	for (i = 0; el->edited_display[i] != NULL; i++)
 		el->edited_display[i][0] = '\0';
 	el->edited_refresh.r_oldcv = 0;
+	el->edited_refresh.r_ghost = 0;
+}
+
+
+/* edited_re_ghost():
+ *	Show the rest of the line that the history suggests dimmed
+ *	after the cursor. These cells are on the screen but not in
+ *	the edit buffer or the virtual display, so they never change
+ *	edited_line; when they already show the same suggestion,
+ *	nothing is drawn.
+ */
+static void
+edited_re_ghost(Edited *el)
+{
+	edited_refresh_t *r = &el->edited_refresh;
+	coord_t at = el->edited_cursor;
+	wint_t *row = el->edited_display[at.v];
+	wchar_t esc[EDITED_STYLE_MAXLEN];
+	const wchar_t *s;
+	size_t i, n = 0;
+	int w, cw, len, j;
+
+	s = hist_suggest(el, &n);
+	/* stop before the margin so that the terminal never wraps */
+	for (i = 0, w = 0; i < n; i++, w += cw) {
+		cw = wcwidth(s[i]);
+		if (cw <= 0 || at.h + w + cw >= el->edited_terminal.t_size.h)
+			break;
+	}
+	n = i;
+	if (el->edited_rprompt.p_pos.h != 0 || at.v != r->r_oldcv)
+		n = w = 0;
+
+	if (w > 0 && w == r->r_ghost && at.v == r->r_ghostat.v &&
+	    at.h == r->r_ghostat.h) {
+		for (i = 0, j = at.h; i < n && row[j] == (wint_t)s[i]; i++)
+			j += wcwidth(s[i]);
+		if (i == n)
+			return;
+	}
+	edited_re_unghost(el);
+	if (w == 0)
+		return;
+
+	len = edited_style_to_escape(el, (edited_style_t){ .dim = 1 }, esc);
+	for (j = 0; j < len; j++)
+		edited_term__putc(el, esc[j]);
+	for (i = 0, j = at.h; i < n; i++) {
+		edited_term__putc(el, s[i]);
+		row[j++] = s[i];
+		for (cw = wcwidth(s[i]); cw > 1; cw--)
+			row[j++] = MB_FILL_CHAR;
+	}
+	len = edited_style_to_escape(el, EDITED_STYLE_RESET, esc);
+	for (j = 0; j < len; j++)
+		edited_term__putc(el, esc[j]);
+	el->edited_cursor.h = at.h + w;
+	r->r_ghostat = at;
+	r->r_ghost = w;
+	edited_term_move_to_char(el, at.h);
+}
+
+
+/* edited_re_unghost():
+ *	Erase the suggestion shown after the edit buffer and go
+ *	back to where the cursor was
+ */
+static void
+edited_re_unghost(Edited *el)
+{
+	edited_refresh_t *r = &el->edited_refresh;
+	coord_t cur = el->edited_cursor;
+	int i;
+
+	if (r->r_ghost == 0)
+		return;
+	edited_term_move_to_line(el, r->r_ghostat.v);
+	edited_term_move_to_char(el, r->r_ghostat.h);
+	edited_term_clear_EOL(el, r->r_ghost);
+	for (i = 0; i < r->r_ghost; i++)
+		el->edited_display[r->r_ghostat.v][r->r_ghostat.h + i] = ' ';
+	r->r_ghost = 0;
+	edited_term_move_to_line(el, cur.v);
+	edited_term_move_to_char(el, cur.h);
+}
+
+
+/* edited_re_reflow():
+ *	The terminal width changed from oldh columns; rewrap what
+ *	is on the screen the way a reflowing terminal does, so that
+ *	the next refresh only repaints what differs. Lines that end
+ *	before the margin were not wrapped and stay separate. Return
+ *	-1 if the result does not fit and the display must be redrawn.
+ */
+libedited_private int
+edited_re_reflow(Edited *el, int oldh)
+{
+	int newh = el->edited_terminal.t_size.h;
+	int oldcv = el->edited_refresh.r_oldcv;
+	coord_t cur = el->edited_cursor;
+	wint_t *old, *row;
+	int *olen;
+	int s, e, v, nv, len, off, rows, i, j;
+
+	if (cur.v > oldcv || oldh <= 0)
+		return -1;
+	el->edited_refresh.r_ghost = 0;	/* now text like the rest */
+
+	old = edited_calloc((size_t)(oldcv + 1) * (size_t)oldh, sizeof(*old));
+	olen = edited_calloc((size_t)(oldcv + 1), sizeof(*olen));
+	if (old == NULL || olen == NULL)
+		goto fail;
+	for (v = 0; v <= oldcv; v++) {
+		for (i = 0; i < oldh && el->edited_display[v][i]; i++)
+			old[v * oldh + i] = el->edited_display[v][i];
+		olen[v] = i;
+	}
+
+	/* first count the lines the new layout needs */
+	for (nv = 0, s = 0; s <= oldcv; s = e + 1) {
+		for (e = s; e < oldcv && olen[e] == oldh; e++)
+			continue;
+		len = (e - s) * oldh + olen[e];
+		if (cur.v >= s && cur.v <= e &&
+		    (cur.v - s) * oldh + cur.h >= len)
+			len = (cur.v - s) * oldh + cur.h + 1;
+		nv += len == 0 ? 1 : (len - 1) / newh + 1;
+	}
+	if (nv > el->edited_terminal.t_size.v)
+		goto fail;
+
+	for (nv = 0, s = 0; s <= oldcv; s = e + 1) {
+		for (e = s; e < oldcv && olen[e] == oldh; e++)
+			continue;
+		len = (e - s) * oldh + olen[e];
+		rows = len == 0 ? 1 : (len - 1) / newh + 1;
+		if (cur.v >= s && cur.v <= e) {
+			off = (cur.v - s) * oldh + cur.h;
+			el->edited_cursor.v = nv + off / newh;
+			el->edited_cursor.h = off % newh;
+			if (off / newh + 1 > rows)
+				rows = off / newh + 1;	/* keep the cursor's line */
+		}
+		for (off = 0; rows > 0; rows--, nv++) {
+			row = el->edited_display[nv];
+			for (j = 0; j < newh && off < len; j++, off++) {
+				v = s + off / oldh;
+				i = off % oldh;
+				row[j] = old[v * oldh + i];
+			}
+			row[j] = '\0';
+		}
+	}
+	for (v = nv; v <= oldcv; v++)
+		el->edited_display[v][0] = '\0';
+	el->edited_refresh.r_oldcv = nv - 1;
+
+	edited_free(olen);
+	edited_free(old);
+	return 0;
+fail:
+	edited_free(olen);
+	edited_free(old);
+	return -1;
+}
+
+
+/* edited_re_deferred():
+ *	Draw the refresh skipped while the terminal was busy,
+ *	if it has caught up
+ */
+libedited_private void
+edited_re_deferred(Edited *el)
+{
+
+	if (el->edited_refresh.r_deferred)
+		edited_re_refresh(el);
+}
+
+
+/* edited_re_print_above():
+ *	Replace the lines being edited with the text given, then
+ *	draw the prompt and the line again below it
+ */
+libedited_private void
+edited_re_print_above(Edited *el, const char *buf, size_t len)
+{
+
+	edited_re_clear_lines(el);	/* leaves us at the top, column 0 */
+	edited_term__write(el, buf, len);
+	if (len > 0 && buf[len - 1] != '\n')
+		edited_term__putc(el, '\n');
+	edited_re_clear_display(el);
+	edited_re_refresh(el);
 }
 
 
@@ -47,11 +47,15 @@ __RCSID("$NetBSD: search.c,v 1.52 2024/06/30 16:26:30 christos Exp $");
 #include <stdlib.h>
 #include <sys/types.h>
 #include <string.h>
+#include <unistd.h>
 #if defined(REGEX)
 #include <regex.h>
 #elif defined(REGEXP)
 #include <regexp.h>
 #endif
+#ifdef _REENTRANT
+#include <pthread.h>
+#endif
 
 #include "edited/el.h"
 #include "edited/common.h"
@@ -64,6 +68,65 @@ __RCSID("$NetBSD: search.c,v 1.52 2024/06/30 16:26:30 christos Exp $");
     ((el)->edited_line.cursor + (((el)->edited_map.type == MAP_VI) && \
 			    ((el)->edited_map.current == (el)->edited_map.alt)))
 
+#define	EL_SCANBATCH	4096	/* Events gathered to match at once	*/
+#define	EL_SCANMIN	1024	/* Fewest events worth more threads	*/
+#define	EL_SCANTHREADS	8	/* Most threads matching events		*/
+
+/*
+ * A slice of the events gathered by edited_c_hsearch()
+ */
+typedef struct edited_scan_t {
+	Edited		 *el;
+	const void	**ev;		/* Strings as the history keeps them */
+	const void	 *line;		/* Skip events equal to this	*/
+	int		  lo, hi;	/* The slice			*/
+	int		  found;	/* First match in it, or -1	*/
+} edited_scan_t;
+
+#define	EL_FUZZYROWS	10	/* Most matches fuzzy search lists	*/
+
+/*
+ * The events matching the first characters of a fuzzy search
+ */
+typedef struct edited_fzlevel_t {
+	int	*set;			/* Their positions, NULL for all */
+	int	 nset;
+	int	 top[EL_FUZZYROWS];	/* The best of them, best first	*/
+	int	 score[EL_FUZZYROWS];
+	int	 ntop;
+} edited_fzlevel_t;
+
+/*
+ * A slice of the events narrowed by edited_c_fzfilter()
+ */
+typedef struct edited_fzscan_t {
+	const void	**ev;		/* Strings as the history keeps them */
+	const unsigned long long *mask;	/* Characters each one contains	*/
+	int		  narrow;
+	const void	 *q;		/* The query, encoded like them	*/
+	size_t		  qlen;
+	unsigned long long qmask;
+	int		  fold;		/* Ignore case			*/
+	const int	 *in;		/* Events to look at, NULL for all */
+	int		  lo, hi;	/* The slice of them		*/
+	int		 *out;		/* Matches go from out[lo] on	*/
+	int		  nout;
+	edited_fzlevel_t  best;
+} edited_fzscan_t;
+
+static int edited_c_recomp(Edited *);
+static ssize_t edited_c_keep(char **, size_t *, size_t *, const void *, int);
+static int edited_c_reexec(Edited *, const char *);
+static int edited_c_rematch(Edited *, const void *, char **, size_t *);
+static void *edited_c_scan(void *);
+static int edited_c_scanbatch(Edited *, const void **, int, const void *);
+static unsigned long long edited_c_fzmask(wint_t);
+static int edited_c_fzscore(const void *, int, const void *, size_t, int);
+static void edited_c_fzrank(edited_fzlevel_t *, int, int);
+static void *edited_c_fzscan(void *);
+static int edited_c_fzfilter(const void **, const unsigned long long *, int,
+    const edited_fzlevel_t *, edited_fzlevel_t *, const void *, size_t, int);
+
 /* search_init():
  *	Initialize the search stuff
  */
@@ -81,6 +144,9 @@ search_init(Edited *el)
 	el->edited_search.chacha = L'\0';
 	el->edited_search.chadir = CHAR_FWD;
 	el->edited_search.chatflg = 0;
+	el->edited_search.repat = NULL;
+	el->edited_search.mbpat = NULL;
+	el->edited_search.reok = 0;
 	return 0;
 }
 
@@ -94,6 +160,18 @@ search_end(Edited *el)
 
 	edited_free(el->edited_search.patbuf);
 	el->edited_search.patbuf = NULL;
+#if defined(REGEX)
+	if (el->edited_search.reok)
+		regfree(&el->edited_search.re);
+#elif defined(REGEXP)
+	if (el->edited_search.reok)
+		edited_free(el->edited_search.re);
+#endif
+	edited_free(el->edited_search.repat);
+	edited_free(el->edited_search.mbpat);
+	el->edited_search.repat = NULL;
+	el->edited_search.mbpat = NULL;
+	el->edited_search.reok = 0;
 }
 
 
@@ -156,18 +234,338 @@ edited_match(const wchar_t *str, const wchar_t *pat)
 }
 
 
+/* edited_c_recomp():
+ *	Compile the pattern unless it is the one compiled last.
+ *	Return -1 if it does not compile
+ */
+static int
+edited_c_recomp(Edited *el)
+{
+	edited_search_t *sp = &el->edited_search;
+	static edited_ct_buffer_t conv;
+	const char *mb;
+
+	if (sp->repat != NULL && wcscmp(sp->repat, sp->patbuf) == 0)
+		return sp->reok ? 0 : -1;
+
+#if defined(REGEX)
+	if (sp->reok)
+		regfree(&sp->re);
+#elif defined(REGEXP)
+	if (sp->reok)
+		edited_free(sp->re);
+#endif
+	edited_free(sp->repat);
+	edited_free(sp->mbpat);
+	sp->mbpat = NULL;
+	sp->reok = 0;
+	if ((sp->repat = wcsdup(sp->patbuf)) == NULL)
+		return -1;
+	if ((mb = edited_ct_encode_string(sp->patbuf, &conv)) == NULL ||
+	    (sp->mbpat = strdup(mb)) == NULL)
+		return -1;
+
+#if defined(REGEX)
+	sp->reok = regcomp(&sp->re, sp->mbpat, 0) == 0;
+#elif defined(REGEXP)
+	sp->reok = (sp->re = regcomp(sp->mbpat)) != NULL;
+#else
+	{
+		extern char	*edited_re_comp(const char *);
+		sp->reok = edited_re_comp(sp->mbpat) == NULL;
+	}
+#endif
+	return sp->reok ? 0 : -1;
+}
+
+
+/* edited_c_reexec():
+ *	Return if the encoded string s matches the compiled pattern
+ */
+static int
+edited_c_reexec(Edited *el, const char *s)
+{
+	edited_search_t *sp = &el->edited_search;
+
+	if (!sp->reok)
+		return 0;
+#if defined(REGEX)
+	return regexec(&sp->re, s, (size_t)0, NULL, 0) == 0;
+#elif defined(REGEXP)
+	return regexec(sp->re, s);
+#else
+	{
+		extern int	 edited_re_exec(const char *);
+		return edited_re_exec(s) == 1;
+	}
+#endif
+}
+
+
+/* edited_c_rematch():
+ *	Return if the string of an event matches the compiled pattern.
+ *	Narrow histories keep their strings encoded already; wide ones
+ *	are encoded into *buf.
+ */
+static int
+edited_c_rematch(Edited *el, const void *str, char **buf, size_t *bsz)
+{
+	edited_search_t *sp = &el->edited_search;
+	const wchar_t *src;
+	mbstate_t st;
+	size_t len;
+	char *nbuf;
+	const char *s;
+
+	if (el->edited_flags & NARROW_HISTORY) {
+		s = str;
+		if (strstr(s, sp->mbpat) != NULL)
+			return 1;
+	} else {
+		src = str;
+		if (wcsstr(src, sp->patbuf) != NULL)
+			return 1;
+		len = wcslen(src) * MB_CUR_MAX + 1;
+		if (len > *bsz) {
+			if ((nbuf = edited_realloc(*buf, len)) == NULL)
+				return 0;
+			*buf = nbuf;
+			*bsz = len;
+		}
+		memset(&st, 0, sizeof(st));
+		if (wcsrtombs(*buf, &src, *bsz, &st) == (size_t)-1)
+			return 0;
+		s = *buf;
+	}
+	return edited_c_reexec(el, s);
+}
+
+
+/* edited_c_keep():
+ *	Append a copy of an event string as the history keeps it to
+ *	*buf, since the history may reuse its own on the next call.
+ *	Return where the copy starts, or -1 if out of memory.
+ */
+static ssize_t
+edited_c_keep(char **buf, size_t *len, size_t *size, const void *str,
+    int narrow)
+{
+	size_t n, at, nsize;
+	char *nbuf;
+
+	n = narrow ? strlen(str) + 1 : (wcslen(str) + 1) * sizeof(wchar_t);
+	/* wide strings stay aligned */
+	at = (*len + sizeof(wchar_t) - 1) / sizeof(wchar_t) * sizeof(wchar_t);
+	if (at + n > *size) {
+		for (nsize = *size ? *size : EL_BUFSIZ; nsize < at + n;)
+			nsize *= 2;
+		if ((nbuf = edited_realloc(*buf, nsize)) == NULL)
+			return -1;
+		*buf = nbuf;
+		*size = nsize;
+	}
+	(void)memcpy(*buf + at, str, n);
+	*len = at + n;
+	return (ssize_t)at;
+}
+
+
+/* edited_c_scan():
+ *	Find the first match in a slice of events
+ */
+static void *
+edited_c_scan(void *arg)
+{
+	edited_scan_t *sc = arg;
+	char *buf = NULL;
+	size_t bsz = 0;
+	int i, narrow = sc->el->edited_flags & NARROW_HISTORY;
+
+	sc->found = -1;
+	for (i = sc->lo; i < sc->hi; i++) {
+		if (sc->line != NULL && (narrow ?
+		    strcmp(sc->ev[i], sc->line) :
+		    wcscmp(sc->ev[i], sc->line)) == 0)
+			continue;
+		if (edited_c_rematch(sc->el, sc->ev[i], &buf, &bsz)) {
+			sc->found = i;
+			break;
+		}
+	}
+	edited_free(buf);
+	return NULL;
+}
+
+
+/* edited_c_scanbatch():
+ *	Return the first of n events matching the pattern, or -1.
+ *	Large batches are split between threads when there are
+ *	several processors.
+ */
+static int
+edited_c_scanbatch(Edited *el, const void **ev, int n, const void *line)
+{
+	edited_scan_t sc[EL_SCANTHREADS];
+	int t, nt = 1;
+#if defined(_REENTRANT) && defined(REGEX)
+	pthread_t tid[EL_SCANTHREADS];
+	int started[EL_SCANTHREADS];
+	long ncpu;
+
+	if (n >= EL_SCANMIN && (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 1)
+		nt = ncpu < EL_SCANTHREADS ? (int)ncpu : EL_SCANTHREADS;
+#endif
+
+	for (t = 0; t < nt; t++) {
+		sc[t].el = el;
+		sc[t].ev = ev;
+		sc[t].line = line;
+		sc[t].lo = (int)((long)n * t / nt);
+		sc[t].hi = (int)((long)n * (t + 1) / nt);
+	}
+#if defined(_REENTRANT) && defined(REGEX)
+	for (t = 1; t < nt; t++)
+		started[t] = pthread_create(&tid[t], NULL, edited_c_scan,
+		    &sc[t]) == 0;
+	(void)edited_c_scan(&sc[0]);
+	for (t = 1; t < nt; t++) {
+		if (started[t])
+			(void)pthread_join(tid[t], NULL);
+		else
+			(void)edited_c_scan(&sc[t]);
+	}
+#else
+	(void)edited_c_scan(&sc[0]);
+#endif
+
+	for (t = 0; t < nt; t++)
+		if (sc[t].found != -1)
+			return sc[t].found;
+	return -1;
+}
+
+
+/* edited_c_hsearch():
+ *	Make current the closest event matching the pattern, from event
+ *	*eventno towards older events if older is set or newer ones
+ *	otherwise, skipping events equal to the line if skip is set.
+ *	Store its position in *eventno and return it.
+ */
+libedited_private const wchar_t *
+edited_c_hsearch(Edited *el, int older, int skip, int *eventno)
+{
+	edited_history_t *h = &el->edited_history;
+	static edited_ct_buffer_t conv;
+	const wchar_t *hp;
+	const void **ev, *raw, *line = NULL;
+	char *keep = NULL;
+	size_t *off, klen, ksize = 0;
+	ssize_t at;
+	int i, n, num = 0, pos = *eventno;
+	int narrow = el->edited_flags & NARROW_HISTORY;
+
+	if (edited_c_literal(el)) {
+		/* let the history find the candidates */
+		while ((hp = hist_search(el, el->edited_search.patbuf, older,
+		    &pos)) != NULL) {
+			if (!skip || wcscmp(hp, el->edited_line.buffer) != 0) {
+				*eventno = pos;
+				return hp;
+			}
+			pos += older ? 1 : -1;
+			if (pos <= 0)
+				break;
+		}
+		return NULL;
+	}
+
+	(void)edited_c_recomp(el);
+	if (hist_seek(el, &pos) == NULL)
+		return NULL;
+	if (skip) {
+		line = el->edited_line.buffer;
+		if (narrow && (line = edited_ct_encode_string(
+		    el->edited_line.buffer, &conv)) == NULL)
+			return NULL;
+	}
+	if ((ev = edited_malloc(EL_SCANBATCH * sizeof(*ev))) == NULL)
+		return NULL;
+	if ((off = edited_malloc(EL_SCANBATCH * sizeof(*off))) == NULL) {
+		edited_free(ev);
+		return NULL;
+	}
+
+	/* gather copies of the events as stored, a batch at a time */
+	raw = hist_raw(el, H_CURR);
+	hp = NULL;
+	while (raw != NULL) {
+		for (klen = 0, n = 0; raw != NULL && n < EL_SCANBATCH; n++) {
+			if ((at = edited_c_keep(&keep, &klen, &ksize, raw,
+			    narrow)) == -1)
+				goto out;
+			off[n] = (size_t)at;
+			num = h->ev.num;
+			raw = hist_raw(el, older ? H_NEXT : H_PREV);
+		}
+		for (i = 0; i < n; i++)
+			ev[i] = keep + off[i];
+		/* remember where the cursor stopped */
+		h->navno = pos + (older ? n : -n) - (raw == NULL ?
+		    (older ? 1 : -1) : 0);
+		h->navnum = raw == NULL ? num : h->ev.num;
+
+		if ((i = edited_c_scanbatch(el, ev, n, line)) != -1) {
+			pos += older ? i : -i;
+			hp = hist_seek(el, &pos);
+			break;
+		}
+		pos += older ? n : -n;
+	}
+out:
+	edited_free(keep);
+	edited_free(off);
+	edited_free(ev);
+	if (hp != NULL)
+		*eventno = pos;
+	return hp;
+}
+
+
 /* edited_c_hmatch():
  *	 return True if the pattern matches the prefix
  */
 libedited_private int
 edited_c_hmatch(Edited *el, const wchar_t *str)
 {
+	static edited_ct_buffer_t conv;
+	const char *s;
 #ifdef SDEBUG
 	(void) fprintf(el->edited_errfile, "match `%ls' with `%ls'\n",
 	    el->edited_search.patbuf, str);
 #endif /* SDEBUG */
 
-	return edited_match(str, el->edited_search.patbuf);
+	if (wcsstr(str, el->edited_search.patbuf) != NULL)
+		return 1;
+	if (edited_c_recomp(el) == -1)
+		return 0;
+	s = edited_ct_encode_string(str, &conv);
+	return s != NULL && edited_c_reexec(el, s);
+}
+
+
+/* edited_c_literal():
+ *	Return if the pattern only matches itself, so that the
+ *	history can look for it as a plain substring
+ */
+libedited_private int
+edited_c_literal(Edited *el)
+{
+	const wchar_t *p;
+
+	for (p = el->edited_search.patbuf; *p; p++)
+		if (wcschr(L".[]\\*^$+?|()", *p) != NULL)
+			return 0;
+	return 1;
 }
 
 
@@ -450,6 +848,444 @@ edited_ce_inc_search(Edited *el, int dir)
 }
 
 
+/*
+ * Fuzzy search helpers; strings are char or wchar_t as the history
+ * keeps them
+ */
+#define	FZCHAR(s, i, narrow) ((narrow) ? \
+    (wint_t)((const unsigned char *)(s))[i] : \
+    (wint_t)((const wchar_t *)(s))[i])
+#define	FZFOLD(c)	((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+#define	FZWORD(c)	(((c) >= 'a' && (c) <= 'z') || \
+    ((c) >= 'A' && (c) <= 'Z') || ((c) >= '0' && (c) <= '9') || (c) >= 0x80)
+
+/* edited_c_fzmask():
+ *	Return the bit standing for a character in the masks used to
+ *	skip events that cannot match before scoring them
+ */
+static unsigned long long
+edited_c_fzmask(wint_t c)
+{
+
+	c = FZFOLD(c);
+	if (c >= 'a' && c <= 'z')
+		return 1ULL << (c - 'a');
+	if (c >= '0' && c <= '9')
+		return 1ULL << (26 + c - '0');
+	if (c < 0x80)
+		return 1ULL << (36 + c % 27);
+	return 1ULL << 63;
+}
+
+
+/* edited_c_fzscore():
+ *	Score the shortest stretch of the string containing the query
+ *	as a subsequence, or return -1 if it does not.  Characters
+ *	starting words or following the previous match score more,
+ *	gaps between them less.
+ */
+static int
+edited_c_fzscore(const void *s, int narrow, const void *q, size_t qlen,
+    int fold)
+{
+	size_t i, j, first, last;
+	wint_t c, prev;
+	int sc, run, gap;
+
+	for (i = j = 0; (c = FZCHAR(s, i, narrow)) != '\0'; i++)
+		if ((fold ? FZFOLD(c) : c) == FZCHAR(q, j, narrow) &&
+		    ++j == qlen)
+			break;
+	if (j < qlen)
+		return -1;
+
+	/* the match ending here that starts last */
+	for (last = i;; i--) {
+		c = FZCHAR(s, i, narrow);
+		if ((fold ? FZFOLD(c) : c) == FZCHAR(q, j - 1, narrow) &&
+		    --j == 0)
+			break;
+	}
+	first = i;
+
+	sc = run = gap = 0;
+	prev = first == 0 ? ' ' : FZCHAR(s, first - 1, narrow);
+	for (i = first; i <= last; prev = c, i++) {
+		c = FZCHAR(s, i, narrow);
+		if (j == qlen || (fold ? FZFOLD(c) : c) !=
+		    FZCHAR(q, j, narrow)) {
+			gap++;
+			continue;
+		}
+		sc += 16;
+		if (!FZWORD(prev) && FZWORD(c))
+			sc += j == 0 ? 12 : 8;
+		if (j > 0 && gap == 0)
+			sc += run < 4 ? 4 * ++run : 16;
+		else {
+			sc -= gap == 0 ? 0 : gap < 10 ? 3 + gap : 13;
+			run = 0;
+		}
+		gap = 0;
+		j++;
+	}
+	sc -= first < 15 ? (int)first / 3 : 5;
+	return sc < 0 ? 0 : sc;
+}
+
+
+/* edited_c_fzrank():
+ *	Keep the event at pos among the best if it scores well enough,
+ *	preferring newer events on ties
+ */
+static void
+edited_c_fzrank(edited_fzlevel_t *lv, int pos, int score)
+{
+	int k;
+
+	if (lv->ntop == EL_FUZZYROWS && (score < lv->score[lv->ntop - 1] ||
+	    (score == lv->score[lv->ntop - 1] && pos > lv->top[lv->ntop - 1])))
+		return;
+	k = lv->ntop < EL_FUZZYROWS ? lv->ntop++ : EL_FUZZYROWS - 1;
+	for (; k > 0 && (score > lv->score[k - 1] ||
+	    (score == lv->score[k - 1] && pos < lv->top[k - 1])); k--) {
+		lv->top[k] = lv->top[k - 1];
+		lv->score[k] = lv->score[k - 1];
+	}
+	lv->top[k] = pos;
+	lv->score[k] = score;
+}
+
+
+/* edited_c_fzscan():
+ *	Keep the events of a slice matching the query and rank them
+ */
+static void *
+edited_c_fzscan(void *arg)
+{
+	edited_fzscan_t *sc = arg;
+	int i, pos, score, age;
+
+	sc->nout = 0;
+	sc->best.ntop = 0;
+	for (i = sc->lo; i < sc->hi; i++) {
+		pos = sc->in != NULL ? sc->in[i] : i;
+		/* one test rules out most events missing a character */
+		if ((sc->qmask & ~sc->mask[pos]) != 0)
+			continue;
+		if ((score = edited_c_fzscore(sc->ev[pos], sc->narrow, sc->q,
+		    sc->qlen, sc->fold)) == -1)
+			continue;
+		sc->out[sc->lo + sc->nout++] = pos;
+		/* recent events get up to a character and a half more */
+		for (age = 0; age < 24 && (pos + 1) >> (age / 2) > 1; age += 2)
+			continue;
+		edited_c_fzrank(&sc->best, pos, score + 24 - age);
+	}
+	return NULL;
+}
+
+
+/* edited_c_fzfilter():
+ *	Narrow the events of level from to those matching the query
+ *	in level to.  Return -1 if out of memory.  Large levels are
+ *	split between threads when there are several processors.
+ */
+static int
+edited_c_fzfilter(const void **ev, const unsigned long long *mask,
+    int narrow, const edited_fzlevel_t *from, edited_fzlevel_t *to,
+    const void *q, size_t qlen, int fold)
+{
+	edited_fzscan_t sc[EL_SCANTHREADS];
+	unsigned long long qmask = 0;
+	int *set;
+	int k, t, nt = 1, n = from->nset;
+	size_t i;
+#ifdef _REENTRANT
+	pthread_t tid[EL_SCANTHREADS];
+	int started[EL_SCANTHREADS];
+	long ncpu;
+
+	if (n >= EL_SCANMIN && (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 1)
+		nt = ncpu < EL_SCANTHREADS ? (int)ncpu : EL_SCANTHREADS;
+#endif
+
+	if ((to->set = edited_malloc((n > 0 ? (size_t)n : 1) *
+	    sizeof(*to->set))) == NULL)
+		return -1;
+	for (i = 0; i < qlen; i++)
+		qmask |= edited_c_fzmask(FZCHAR(q, i, narrow));
+	for (t = 0; t < nt; t++) {
+		sc[t].ev = ev;
+		sc[t].mask = mask;
+		sc[t].narrow = narrow;
+		sc[t].q = q;
+		sc[t].qlen = qlen;
+		sc[t].qmask = qmask;
+		sc[t].fold = fold;
+		sc[t].in = from->set;
+		sc[t].lo = (int)((long)n * t / nt);
+		sc[t].hi = (int)((long)n * (t + 1) / nt);
+		sc[t].out = to->set;
+	}
+#ifdef _REENTRANT
+	for (t = 1; t < nt; t++)
+		started[t] = pthread_create(&tid[t], NULL, edited_c_fzscan,
+		    &sc[t]) == 0;
+	(void)edited_c_fzscan(&sc[0]);
+	for (t = 1; t < nt; t++) {
+		if (started[t])
+			(void)pthread_join(tid[t], NULL);
+		else
+			(void)edited_c_fzscan(&sc[t]);
+	}
+#else
+	(void)edited_c_fzscan(&sc[0]);
+#endif
+
+	/* close the gaps between the slices and merge their best */
+	to->nset = 0;
+	to->ntop = 0;
+	for (t = 0; t < nt; t++) {
+		(void)memmove(to->set + to->nset, to->set + sc[t].lo,
+		    (size_t)sc[t].nout * sizeof(*to->set));
+		to->nset += sc[t].nout;
+		for (k = 0; k < sc[t].best.ntop; k++)
+			edited_c_fzrank(to, sc[t].best.top[k],
+			    sc[t].best.score[k]);
+	}
+	if (to->nset < n && to->nset > 0 && (set = edited_realloc(to->set,
+	    (size_t)to->nset * sizeof(*set))) != NULL)
+		to->set = set;
+	return 0;
+}
+
+
+/* edited_ce_fuzzy_search():
+ *	Emacs fuzzy history search
+ */
+libedited_private edited_action_t
+edited_ce_fuzzy_search(Edited *el)
+{
+	static const wchar_t STRfuzzy[] = L"fuzzy ";
+	static wchar_t endcmd[2] = {'\0', '\0'};
+	static edited_ct_buffer_t conv;
+	edited_fzlevel_t *lv = NULL, *nlv;
+	const void **ev = NULL, *raw, *q;
+	unsigned long long *mask = NULL, *nmask, m;
+	char *keep = NULL;
+	size_t *off = NULL, *noff, klen = 0, ksize = 0;
+	ssize_t at;
+	wchar_t query[EL_BUFSIZ], num[32], *wp, ch;
+	edited_action_t ret = CC_ERROR;
+	edited_action_t cmd;
+	const wchar_t *cp;
+	size_t olen, ocur, need, qlen = 0, nlevels = 0, i;
+	int narrow = el->edited_flags & NARROW_HISTORY;
+	int n = 0, size = 0, sel = 0, rows, cols, k, fold, pos = -1;
+
+	/* gather copies of the events as stored, newest first */
+	for (raw = hist_raw(el, H_FIRST); raw != NULL;
+	    raw = hist_raw(el, H_NEXT)) {
+		if (n == size) {
+			size = size ? size * 2 : 1024;
+			if ((noff = edited_realloc(off, (size_t)size *
+			    sizeof(*off))) == NULL)
+				goto out;
+			off = noff;
+			if ((nmask = edited_realloc(mask, (size_t)size *
+			    sizeof(*mask))) == NULL)
+				goto out;
+			mask = nmask;
+		}
+		for (m = 0, i = 0; FZCHAR(raw, i, narrow) != '\0'; i++)
+			m |= edited_c_fzmask(FZCHAR(raw, i, narrow));
+		if ((at = edited_c_keep(&keep, &klen, &ksize, raw,
+		    narrow)) == -1)
+			goto out;
+		off[n] = (size_t)at;
+		mask[n++] = m;
+	}
+	if (n == 0 || (ev = edited_malloc((size_t)n * sizeof(*ev))) == NULL)
+		goto out;
+	for (k = 0; k < n; k++)
+		ev[k] = keep + off[k];
+	if ((lv = edited_malloc(16 * sizeof(*lv))) == NULL)
+		goto out;
+	nlevels = 16;
+	lv[0].set = NULL;
+	lv[0].nset = n;
+	for (k = 0; k < n && k < EL_FUZZYROWS; k++)
+		lv[0].top[k] = k;
+	lv[0].ntop = k;
+
+	rows = el->edited_terminal.t_size.v - 2;
+	if (rows > EL_FUZZYROWS)
+		rows = EL_FUZZYROWS;
+	if (rows < 1)
+		rows = 1;
+	cols = el->edited_terminal.t_size.h - 3;
+	if (cols < 1)
+		cols = 1;
+	olen = (size_t)(el->edited_line.lastchar - el->edited_line.buffer);
+	ocur = (size_t)(el->edited_line.cursor - el->edited_line.buffer);
+	need = sizeof(STRfuzzy) / sizeof(*STRfuzzy) + sizeof(num) /
+	    sizeof(*num) + EL_BUFSIZ + (size_t)rows * ((size_t)cols + 3);
+	while (el->edited_line.buffer + olen + need >= el->edited_line.limit)
+		if (!ch_enlargebufs(el, need))
+			goto out;
+
+	ret = CC_REFRESH;
+	for (;;) {
+		/* list the best matches below the line */
+		wp = el->edited_line.buffer + olen;
+		*wp++ = '\n';
+		for (cp = STRfuzzy; *cp; *wp++ = *cp++)
+			continue;
+		(void)swprintf(num, sizeof(num) / sizeof(*num), L"%d/%d: ",
+		    lv[qlen].nset, n);
+		for (cp = num; *cp; *wp++ = *cp++)
+			continue;
+		for (i = 0; i < qlen; i++)
+			*wp++ = query[i];
+		el->edited_line.cursor = wp;
+		for (k = 0; k < lv[qlen].ntop && k < rows; k++) {
+			*wp++ = '\n';
+			*wp++ = k == sel ? '>' : ' ';
+			*wp++ = ' ';
+			raw = ev[lv[qlen].top[k]];
+			cp = narrow ? edited_ct_decode_string(raw, &conv) : raw;
+			for (i = 0; cp != NULL && cp[i] != '\0' &&
+			    i < (size_t)cols; i++)
+				*wp++ = cp[i] < ' ' || cp[i] == 0177 ?
+				    ' ' : cp[i];
+		}
+		*wp = '\0';
+		el->edited_line.lastchar = wp;
+		edited_re_refresh(el);
+
+		if (edited_wgetc(el, &ch) != 1) {
+			ret = edited_ed_end_of_file(el, 0);
+			break;
+		}
+
+		cmd = ch < N_KEYS ? el->edited_map.current[ch] :
+		    EDITED_ED_INSERT;
+		/* vi insert mode inserts control characters too */
+		if (cmd == EDITED_ED_INSERT && (ch < ' ' || ch == 0177))
+			cmd = EDITED_ED_UNASSIGNED;
+		switch (cmd) {
+		case EDITED_ED_INSERT:
+		case EDITED_ED_DIGIT:
+			if (qlen >= EL_BUFSIZ - 1) {
+				edited_term_beep(el);
+				continue;
+			}
+			if (qlen + 1 == nlevels) {
+				if ((nlv = edited_realloc(lv, 2 * nlevels *
+				    sizeof(*lv))) == NULL) {
+					edited_term_beep(el);
+					continue;
+				}
+				lv = nlv;
+				nlevels *= 2;
+			}
+			query[qlen] = ch;
+			query[qlen + 1] = '\0';
+			/* smart case: any capital makes case matter */
+			for (fold = 1, i = 0; i <= qlen; i++)
+				if (query[i] >= 'A' && query[i] <= 'Z')
+					fold = 0;
+			q = narrow ? (const void *)edited_ct_encode_string(query,
+			    &conv) : (const void *)query;
+			/* extending the query can only drop matches */
+			if (q == NULL || edited_c_fzfilter(ev, mask, narrow,
+			    &lv[qlen], &lv[qlen + 1], q, narrow ? strlen(q) :
+			    qlen + 1, fold) == -1) {
+				edited_term_beep(el);
+				continue;
+			}
+			qlen++;
+			sel = 0;
+			continue;
+
+		case EDITED_EM_DELETE_PREV_CHAR:
+		case EDITED_ED_DELETE_PREV_CHAR:
+			if (qlen == 0) {
+				edited_term_beep(el);
+				continue;
+			}
+			edited_free(lv[qlen--].set);
+			sel = 0;
+			continue;
+
+		case EDITED_ED_NEXT_HISTORY:
+		case EDITED_ED_NEXT_LINE:
+		case EDITED_EM_INC_SEARCH_PREV:
+		case EDITED_EM_FUZZY_SEARCH:
+			if (sel + 1 < lv[qlen].ntop && sel + 1 < rows)
+				sel++;
+			else
+				edited_term_beep(el);
+			continue;
+
+		case EDITED_ED_PREV_HISTORY:
+		case EDITED_ED_PREV_LINE:
+		case EDITED_EM_INC_SEARCH_NEXT:
+			if (sel > 0)
+				sel--;
+			else
+				edited_term_beep(el);
+			continue;
+
+		default:
+			switch (ch) {
+			case 0007:	/* ^G: Abort */
+				break;
+
+			default:	/* Terminate and execute cmd */
+				endcmd[0] = ch;
+				edited_wpush(el, endcmd);
+				/* FALLTHROUGH */
+
+			case 0033:	/* ESC: Terminate */
+				if (lv[qlen].ntop > 0)
+					pos = lv[qlen].top[sel];
+				break;
+			}
+			break;
+		}
+		break;
+	}
+
+	/* put the line back, then the chosen event if any */
+	el->edited_line.lastchar = el->edited_line.buffer + olen;
+	el->edited_line.cursor = el->edited_line.buffer + ocur;
+	*el->edited_line.lastchar = '\0';
+	if (pos != -1) {
+		if (el->edited_history.eventno == 0) {
+			(void) wcsncpy(el->edited_history.buf,
+			    el->edited_line.buffer, EL_BUFSIZ);
+			el->edited_history.last = el->edited_history.buf +
+			    (el->edited_line.lastchar - el->edited_line.buffer);
+		}
+		el->edited_history.eventno = pos + 1;
+		if (hist_get(el) == CC_ERROR)
+			ret = CC_ERROR;
+	}
+out:
+	if (lv != NULL)
+		while (qlen > 0)
+			edited_free(lv[qlen--].set);
+	edited_free(lv);
+	edited_free(mask);
+	edited_free(ev);
+	edited_free(off);
+	edited_free(keep);
+	return ret;
+}
+
+
 /* edited_cv_search():
  *	Vi search.
  */
@@ -90,7 +90,12 @@ edited_sig_handler(int signo)
 		break;
 
 	case SIGWINCH:
-		edited_resize(sel);
+		/*
+		 * Resizing is not async-signal-safe and comes in
+		 * bursts; the last one is applied before reading the
+		 * next command, or as it interrupts edited_read_char().
+		 */
+		sel->edited_signal->edited_sig_winch = 1;
 		break;
 
 	default:
@@ -125,6 +130,9 @@ edited_sig_init(Edited *el)
 	if (el->edited_signal == NULL)
 		return -1;
 
+	el->edited_signal->edited_sig_no = 0;
+	el->edited_signal->edited_sig_winch = 0;
+
 	nset = &el->edited_signal->edited_sig_set;
 	(void) sigemptyset(nset);
 #define	_DO(a) (void) sigaddset(nset, a);
@@ -35,6 +35,10 @@ int edited_style_to_escape(Edited *el __attribute__((__unused__)), edited_style_
 			*c++ = L'1';
 			*c++ = L';';
 		}
+		if (color.dim) {
+			*c++ = L'2';
+			*c++ = L';';
+		}
 		if (color.italic) {
 			*c++ = L'3';
 			*c++ = L';';
@@ -48,7 +48,9 @@ __RCSID("$NetBSD: terminal.c,v 1.46 2023/02/04 14:34:28 christos Exp $");
  */
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -224,6 +226,7 @@ static void	edited_term_tputs(Edited *, const char *, int);
 static pthread_mutex_t edited_term_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 static FILE *edited_term_outfile = NULL;
+static Edited *edited_term_el = NULL;
 
 
 /* edited_term_setflags():
@@ -325,6 +328,10 @@ edited_term_end(Edited *el)
 	el->edited_terminal.t_val = NULL;
 	edited_free(el->edited_terminal.t_fkey);
 	el->edited_terminal.t_fkey = NULL;
+	edited_free(el->edited_terminal.t_obuf);
+	el->edited_terminal.t_obuf = NULL;
+	el->edited_terminal.t_ooff = el->edited_terminal.t_olen = 0;
+	el->edited_terminal.t_osize = 0;
 	edited_term_free_display(el);
 }
 
@@ -395,6 +402,43 @@ edited_term_alloc(Edited *el, const struct termcapstr *t, const char *cap)
 }
 
 
+/* edited_term_grow_buffer():
+ *	Make room for nv lines of nh columns in the buffer,
+ *	which has ov lines of oh columns, keeping its contents
+ */
+static int
+edited_term_grow_buffer(wint_t ***bp, int ov, int oh, int nv, int nh)
+{
+	wint_t **b, *l;
+	int i;
+
+	if (nv > ov) {
+		b = edited_realloc(*bp, (size_t)(nv + 1) * sizeof(*b));
+		if (b == NULL)
+			return -1;
+		for (i = ov; i <= nv; i++)
+			b[i] = NULL;
+		*bp = b;
+	} else
+		b = *bp;
+
+	for (i = 0; i < nv; i++) {
+		if (b[i] == NULL) {
+			b[i] = edited_calloc((size_t)(nh + 1), sizeof(**b));
+			if (b[i] == NULL)
+				return -1;
+		} else if (nh > oh) {
+			l = edited_realloc(b[i], (size_t)(nh + 1) * sizeof(*l));
+			if (l == NULL)
+				return -1;
+			(void) memset(l + oh + 1, 0,
+			    (size_t)(nh - oh) * sizeof(*l));
+			b[i] = l;
+		}
+	}
+	return 0;
+}
+
 /* edited_term_rebuffer_display():
  *	Rebuffer the display after the screen changed size
  */
@@ -402,14 +446,32 @@ static int
 edited_term_rebuffer_display(Edited *el)
 {
 	coord_t *c = &el->edited_terminal.t_size;
-
-	edited_term_free_display(el);
+	coord_t *a = &el->edited_terminal.t_alloc;
+	int nv, nh;
 
 	c->h = Val(T_co);
 	c->v = Val(T_li);
 
-	if (edited_term_alloc_display(el) == -1)
+	if (el->edited_display == NULL)
+		return edited_term_alloc_display(el);
+
+	/*
+	 * The buffers only grow; a smaller terminal uses part of
+	 * them, so a resize does not lose what is on the screen.
+	 */
+	if (c->v <= a->v && c->h <= a->h)
+		return 0;
+	nv = c->v > a->v ? c->v : a->v;
+	nh = c->h > a->h ? c->h : a->h;
+	if (edited_term_grow_buffer(&el->edited_display, a->v, a->h,
+	    nv, nh) == -1 ||
+	    edited_term_grow_buffer(&el->edited_vdisplay, a->v, a->h,
+	    nv, nh) == -1) {
+		edited_term_free_display(el);
 		return -1;
+	}
+	a->v = nv;
+	a->h = nh;
 	return 0;
 }
 
@@ -465,6 +527,7 @@ edited_term_alloc_display(Edited *el)
 	el->edited_vdisplay = edited_term_alloc_buffer(el);
 	if (el->edited_vdisplay == NULL)
 		goto done;
+	el->edited_terminal.t_alloc = el->edited_terminal.t_size;
 	return 0;
 done:
 	edited_term_free_display(el);
@@ -480,6 +543,8 @@ edited_term_free_display(Edited *el)
 {
 	edited_term_free_buffer(&el->edited_display);
 	edited_term_free_buffer(&el->edited_vdisplay);
+	el->edited_terminal.t_alloc.h = 0;
+	el->edited_terminal.t_alloc.v = 0;
 }
 
 
@@ -675,7 +740,7 @@ libedited_private void
 edited_term_overwrite_styled(Edited *el, const wchar_t *cp, size_t n, edited_style_t *style)
 {
 	int i, j, len;
-	wchar_t *tmp = malloc(sizeof(wchar_t) * 16);
+	wchar_t *tmp = malloc(sizeof(wchar_t) * EDITED_STYLE_MAXLEN);
 	for (i = 0; i < n; i++) {
 		len = edited_style_to_escape(el, style[i], tmp);
 		for (j = 0; j < len; j++)
@@ -795,7 +860,7 @@ libedited_private void
 edited_term_insertwrite_styled(Edited *el, wchar_t *cp, int num, edited_style_t *style)
 {
 	int i, j, len;
-	wchar_t *tmp = malloc(sizeof(wchar_t) * 16);
+	wchar_t *tmp = malloc(sizeof(wchar_t) * EDITED_STYLE_MAXLEN);
 	for (i = 0; i < num; i++) {
 		len = edited_style_to_escape(el, style[i], tmp);
 		for (j = 0; j < len; j++)
@@ -940,9 +1005,6 @@ edited_term_set(Edited *el, const char *term)
 	if (Val(T_li) < 1)
 		Val(T_li) = 24;
 
-	el->edited_terminal.t_size.v = Val(T_co);
-	el->edited_terminal.t_size.h = Val(T_li);
-
 	edited_term_setflags(el);
 
 				/* get the correct window size */
@@ -1000,6 +1062,8 @@ libedited_private int
 edited_term_change_size(Edited *el, int lins, int cols)
 {
 	coord_t cur = el->edited_cursor;
+	coord_t old = el->edited_terminal.t_size;
+	int drawn = el->edited_display != NULL;
 	/*
 	 * Just in case
 	 */
@@ -1009,6 +1073,16 @@ edited_term_change_size(Edited *el, int lins, int cols)
 	/* re-make display buffers */
 	if (edited_term_rebuffer_display(el) == -1)
 		return -1;
+
+	if (drawn && old.h == el->edited_terminal.t_size.h &&
+	    el->edited_refresh.r_oldcv < el->edited_terminal.t_size.v &&
+	    cur.v < el->edited_terminal.t_size.v)
+		return 0;	/* only the height changed, lines still fit */
+
+	if (drawn && (el->edited_flags & REFLOW) && old.h > 0 &&
+	    edited_re_reflow(el, old.h) == 0)
+		return 0;
+
 	edited_re_clear_display(el);
 	el->edited_cursor = cur;
 	return 0;
@@ -1236,8 +1310,14 @@ edited_term_bind_arrow(Edited *el)
 static int
 edited_term_putc(int c)
 {
+	char ch = (char)c;
+
 	if (edited_term_outfile == NULL)
 		return -1;
+	if (edited_term_el != NULL && (edited_term_el->edited_flags & FRAMEDROP)) {
+		edited_term__write(edited_term_el, &ch, (size_t)1);
+		return c;
+	}
 	return fputc(c, edited_term_outfile);
 }
 
@@ -1248,7 +1328,9 @@ edited_term_tputs(Edited *el, const char *cap, int affcnt)
 	pthread_mutex_lock(&edited_term_mutex);
 #endif
 	edited_term_outfile = el->edited_outfile;
+	edited_term_el = el;
 	(void)tputs(cap, affcnt, edited_term_putc);
+	edited_term_el = NULL;
 #ifdef _REENTRANT
 	pthread_mutex_unlock(&edited_term_mutex);
 #endif
@@ -1264,15 +1346,114 @@ edited_term__putc(Edited *el, wint_t c)
 	ssize_t i;
 	if (c == MB_FILL_CHAR)
 		return 0;
-	if (c & EL_LITERAL)
-		return fputs(edited_lit_get(el, c), el->edited_outfile);
+	if (c & EL_LITERAL) {
+		const char *lit = edited_lit_get(el, c);
+
+		if (el->edited_flags & FRAMEDROP) {
+			edited_term__write(el, lit, strlen(lit));
+			return 0;
+		}
+		return fputs(lit, el->edited_outfile);
+	}
 	i = edited_ct_encode_char(buf, (size_t)MB_LEN_MAX, c);
 	if (i <= 0)
 		return (int)i;
+	if (el->edited_flags & FRAMEDROP) {
+		edited_term__write(el, buf, (size_t)i);
+		return 0;
+	}
 	buf[i] = '\0';
 	return fputs(buf, el->edited_outfile);
 }
 
+/* edited_term__send():
+ *	Write as much of the pending output as possible; without
+ *	block, stop as soon as the terminal would make us wait.
+ *	The descriptor is shared with the application, so rather
+ *	than making it non-blocking, poll it before each write and
+ *	write no more than a writable one is sure to take.
+ *	Return the number of bytes still pending.
+ */
+static size_t
+edited_term__send(Edited *el, int block)
+{
+	edited_terminal_t *t = &el->edited_terminal;
+	struct pollfd pfd;
+	size_t len;
+	ssize_t n;
+	int r;
+
+	pfd.fd = el->edited_outfd;
+	pfd.events = POLLOUT;
+	while (t->t_ooff < t->t_olen) {
+		len = t->t_olen - t->t_ooff;
+		if (!block) {
+			if ((r = poll(&pfd, 1, 0)) == -1 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				break;
+			if (len > PIPE_BUF)
+				len = PIPE_BUF;
+		}
+		n = write(pfd.fd, t->t_obuf + t->t_ooff, len);
+		if (n > 0) {
+			t->t_ooff += (size_t)n;
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!block)
+				break;
+			/* inherited a non-blocking descriptor */
+			(void) poll(&pfd, 1, -1);
+			continue;
+		}
+		t->t_ooff = t->t_olen;	/* nowhere to write it */
+	}
+
+	if (t->t_ooff == t->t_olen)
+		t->t_ooff = t->t_olen = 0;
+	return t->t_olen - t->t_ooff;
+}
+
+/* edited_term__write():
+ *	Output len bytes; when dropping frames they are kept
+ *	in our own buffer and written without blocking.
+ */
+libedited_private void
+edited_term__write(Edited *el, const char *buf, size_t len)
+{
+	edited_terminal_t *t = &el->edited_terminal;
+	size_t n;
+	char *p;
+
+	if ((el->edited_flags & FRAMEDROP) == 0) {
+		(void) fwrite(buf, (size_t)1, len, el->edited_outfile);
+		return;
+	}
+
+	if (t->t_olen == t->t_ooff) {
+		/* keep stdio output of the commands in order */
+		(void) fflush(el->edited_outfile);
+	}
+
+	if (t->t_olen + len > t->t_osize) {
+		n = t->t_osize ? t->t_osize : EL_BUFSIZ;
+		while (n < t->t_olen + len)
+			n *= 2;
+		if ((p = edited_realloc(t->t_obuf, n)) == NULL) {
+			(void) edited_term__send(el, 1);
+			(void) fwrite(buf, (size_t)1, len, el->edited_outfile);
+			return;
+		}
+		t->t_obuf = p;
+		t->t_osize = n;
+	}
+	(void) memcpy(t->t_obuf + t->t_olen, buf, len);
+	t->t_olen += len;
+}
+
 /* edited_term__flush():
  *	Flush output
  */
@@ -1280,9 +1461,45 @@ libedited_private void
 edited_term__flush(Edited *el)
 {
 
+	if ((el->edited_flags & FRAMEDROP) == 0 ||
+	    edited_term__send(el, 0) == 0)
+		(void) fflush(el->edited_outfile);
+}
+
+/* edited_term__drain():
+ *	Flush output, waiting for the terminal if needed
+ */
+libedited_private void
+edited_term__drain(Edited *el)
+{
+
+	(void) edited_term__send(el, 1);
 	(void) fflush(el->edited_outfile);
 }
 
+/* edited_term_backlog():
+ *	Return 1 if output is waiting for the terminal to drain
+ */
+libedited_private int
+edited_term_backlog(Edited *el)
+{
+
+	return el->edited_terminal.t_olen != el->edited_terminal.t_ooff;
+}
+
+/* edited_term_congested():
+ *	Return 1 if the previous frame has still not been
+ *	written, in which case the next one should be dropped
+ */
+libedited_private int
+edited_term_congested(Edited *el)
+{
+
+	if ((el->edited_flags & FRAMEDROP) == 0)
+		return 0;
+	return edited_term__send(el, 0) != 0;
+}
+
 /* edited_term_writec():
  *	Write the given character out, in a human readable form
  */
@@ -1415,13 +1632,8 @@ edited_term_settc(Edited *el, int argc __attribute__((__unused__)),
 	}
 	el->edited_terminal.t_val[tv - tval] = (int) i;
 	i = 0;
-	if (tv == &tval[T_co]) {
-		el->edited_terminal.t_size.v = Val(T_co);
+	if (tv == &tval[T_co] || tv == &tval[T_li])
 		i++;
-	} else if (tv == &tval[T_li]) {
-		el->edited_terminal.t_size.h = Val(T_li);
-		i++;
-	}
 	if (i && edited_term_change_size(el, Val(T_li), Val(T_co)) == -1)
 		return -1;
 	return 0;